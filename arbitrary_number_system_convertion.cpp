@@ -1,47 +1,99 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <string>
 #include <iostream>
 
-int to_int(char c) {
-    return '0' <= c && c <= '9' ? c - '0' :
-            'a' <= c && c <= 'z' ? c - 'a' + 10:
-            'A' <= c && c <= 'Z' ? c - 'Z' + 10: -1;
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "radix_batch.h"
+
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [--from R] [--to R] [--threads N] [--block-size BYTES] [file]\n"
+            "  Converts one number per line from file, or stdin, between radices 2..36\n"
+            "  (default 10 to 16). Bad lines come out empty and are reported on stderr.\n"
+            "  With a terminal on stdin and no file, prompts for numbers instead.\n",
+            prog);
+    exit(2);
 }
 
-char to_char(int x) {
-    return x <= 9 ? '0' + x : 'a' + (x - 10);
+// one number at a time, answering each as it is typed
+static int interactive(int from, int to) {
+    RadixConverter converter{from, to};
+    std::string input, output;
+    RadixError error;
+    std::cout << "> " << std::flush;
+    while (std::cin >> input) {
+        if (converter.convert(input, output, &error)) {
+            std::cout << output << "\n> " << std::flush;
+        }
+        else {
+            std::cout << "error: " << error.message() << "\n> " << std::flush;
+        }
+    }
+    return 0;
 }
 
-std::string convert(std::string input, int input_radix, int output_radix) {
-    std::string output;
-    for (int i = 0, n = input.size(), v = 0; i < n;) {
-        if (input[i] == '0') {
-            ++i;
+
+int main(int argc, char **argv) {
+    int from = 10, to = 16;
+    RadixBatch::Options options;
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (arg[0] != '-' || !strcmp(arg, "-")) {
+            if (path) {
+                usage(argv[0]);
+            }
+            path = arg;
             continue;
         }
-        for (int j = i; j < n; ++j) {
-            v *= input_radix;
-            v += to_int(input[j]);
-            input[j] = to_char(v / output_radix);
-            v %= output_radix;
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const char *val = argv[++i];
+        if (!strcmp(arg, "--from")) {
+            from = atoi(val);
+        }
+        else if (!strcmp(arg, "--to")) {
+            to = atoi(val);
+        }
+        else if (!strcmp(arg, "--threads")) {
+            options.threads = atoi(val);
+        }
+        else if (!strcmp(arg, "--block-size")) {
+            options.block_size = strtoull(val, nullptr, 10);
+        }
+        else {
+            usage(argv[0]);
         }
-        output.push_back(to_char(v));
-        v = 0;
     }
-    if (output.empty()) {
-        return "0";
+
+    try {
+        if (!path && isatty(0)) {
+            return interactive(from, to);
+        }
+        int fd = 0;
+        if (path && strcmp(path, "-")) {
+            fd = open(path, O_RDONLY);
+            if (fd < 0) {
+                perror(path);
+                return 2;
+            }
+        }
+        auto result = RadixBatch{from, to, options}.run(fd, 1);
+        if (fd) {
+            close(fd);
+        }
+        return result.errors ? 1 : 0;
     }
-    else {
-        return std::string(output.rbegin(), output.rend());
+    catch (const std::exception &e) {
+        fprintf(stderr, "error: %s\n", e.what());
+        return 2;
     }
 }
-
-
-int main() {
-    std::string hex, dec;
-    std::cout << "> ";
-    while (std::cin >> hex) {
-        dec = convert(hex, 10, 16);
-        std::cout << dec << std::endl;
-        std::cout << "> ";
-    }
-}
\ No newline at end of file
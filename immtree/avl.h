@@ -4,236 +4,1573 @@
 #include <cstdio>
 #include <memory>
 #include <utility>
-#include <optional>
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "policy.h"
+#include "fork_join.h"
 
-template<typename T>
-using Rc = std::shared_ptr<T>;
 
-template <typename K, typename V>
+// Holds the augmentation summary of a node; takes no space when the summary
+// type is empty.
+template <typename Summary, bool = std::is_empty_v<Summary>>
+struct SummarySlot {
+    Summary summary;
+};
+
+template <typename Summary>
+struct SummarySlot<Summary, true> {
+    static constexpr Summary summary{};
+};
+
+
+template <typename K, typename V, typename Policy = DefaultPolicy>
 class AVLMap {
-    struct AVLNode {
+    using Stats = typename Policy::Stats;
+    using Augment = typename Policy::Augment;
+    using Summary = typename Augment::type;
+    static constexpr bool augmented = !std::is_empty_v<Summary>;
+
+    struct AVLNode: SummarySlot<Summary> {
+        using RefCount = typename Policy::RefCount;
+
+        mutable typename RefCount::type refs{1};
         int height;
+        size_t count;   // nodes in this subtree
+        Rc<AVLNode> left, right;
         K key;
         V val;
-        Rc<AVLNode> left, right;
 
-        AVLNode(int height, K key, V val, Rc<AVLNode> left, Rc<AVLNode> right):
-            height{height},
-            key{std::move(key)},
-            val{std::move(val)},
+        // same key, value and shape as `other`, with the given children
+        AVLNode(const AVLNode &other, Rc<AVLNode> left, Rc<AVLNode> right):
+            SummarySlot<Summary>(other),
+            height{other.height},
+            count{other.count},
             left{std::move(left)},
-            right{std::move(right)} {}
+            right{std::move(right)},
+            key{other.key},
+            val{other.val} {}
 
         AVLNode(K key, V val, Rc<AVLNode> left=nullptr, Rc<AVLNode> right=nullptr):
-            height{1 + std::max(left ? left->height : 0, right ? right->height : 0)},
-            key{std::move(key)},
-            val{std::move(val)},
             left{std::move(left)},
-            right{std::move(right)} {}
-        
-        void update_height_without_null_check() {
+            right{std::move(right)},
+            key{std::move(key)},
+            val{std::move(val)} {
+            update_with_null_check();
+        }
+
+        static void destroy(AVLNode *node) {
+            Policy::Reclaim::retire(node);
+        }
+
+        static void free(AVLNode *node) {
+            Policy::Alloc::destroy(node);
+        }
+
+        template <typename F>
+        void drop_children(F &&f) {
+            for (auto link : {&left, &right}) {
+                AVLNode *child = link->release();
+                if (child && RefCount::dec(child->refs)) {
+                    f(child);
+                }
+            }
+        }
+
+        void update_without_null_check() {
             height = std::max(left->height, right->height) + 1;
+            count = left->count + right->count + 1;
+            if constexpr (augmented) {
+                this->summary = Augment::combine(Augment::combine(left->summary, Augment::of(key, val)), right->summary);
+            }
         }
 
-        void update_height_with_null_check() {
+        void update_with_null_check() {
             height = std::max(left ? left->height : 0, right ? right->height : 0) + 1;
+            count = (left ? left->count : 0) + (right ? right->count : 0) + 1;
+            if constexpr (augmented) {
+                this->summary = Augment::combine(
+                    Augment::combine(summary_of(left.get()), Augment::of(key, val)), summary_of(right.get()));
+            }
         }
     };
 
+    static Summary summary_of(const AVLNode *node) {
+        return node ? node->summary : Augment::identity();
+    }
+
 private:
     Rc<AVLNode> root;
-    size_t _size;
 
-    AVLMap(Rc<AVLNode> root, size_t size): root{std::move(root)}, _size(size) {}
+    explicit AVLMap(Rc<AVLNode> root): root{std::move(root)} {}
+
+    template <typename, typename>
+    friend class SnapshotWriter;
+
+    // combiners for the set operations when the caller does not pass one
+    struct KeepMine {
+        const V &operator()(const K &, const V &mine, const V &) const {
+            return mine;
+        }
+    };
+
+    struct KeepTheirs {
+        const V &operator()(const K &, const V &, const V &theirs) const {
+            return theirs;
+        }
+    };
 
 public:
-    AVLMap(): root{}, _size{0} {}
-    AVLMap<K, V> insert(K key, V val) const {
-        auto new_root = insert(root, std::move(key), std::move(val));
-        return AVLMap<K, V>{std::move(new_root), _size + 1};
+    // bytes of one node, not counting memory the key and value own
+    static constexpr size_t node_bytes = sizeof(AVLNode);
+
+    AVLMap(): root{} {}
+
+    class Transient;
+    class InternTable;
+    class iterator;
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+
+    struct Range {
+        iterator first, last;
+
+        iterator begin() const {
+            return first;
+        }
+
+        iterator end() const {
+            return last;
+        }
+    };
+
+    struct Change {
+        K key;
+        V before, after;
+    };
+
+    struct Diff {
+        std::vector<std::pair<K, V>> removed, added;
+        std::vector<Change> changed;
+    };
+
+    struct Sharing {
+        size_t nodes;       // reachable from this version
+        size_t shared;      // of those, also reachable from another version or copy
+    };
+
+    struct Split {
+        AVLMap left;
+        const V *found;     // points into the map that was split
+        AVLMap right;
+    };
+
+    AVLMap insert(K key, V val) const & {
+        auto new_root = root;
+        insert_at(new_root, std::move(key), std::move(val));
+        return AVLMap{std::move(new_root)};
+    }
+
+    // nodes no other version can reach are updated in place instead of copied
+    AVLMap insert(K key, V val) && {
+        insert_at(root, std::move(key), std::move(val));
+        return std::move(*this);
+    }
+
+    // For keys above every key in the map, e.g. timestamps: one comparison
+    // instead of one per level. Other keys are inserted as usual.
+    AVLMap push_back(K key, V val) const & {
+        auto new_root = root;
+        push_back_at(new_root, std::move(key), std::move(val));
+        return AVLMap{std::move(new_root)};
+    }
+
+    AVLMap push_back(K key, V val) && {
+        push_back_at(root, std::move(key), std::move(val));
+        return std::move(*this);
+    }
+
+    AVLMap erase(const K &key) const & {
+        auto new_root = root;
+        erase_at(new_root, key);
+        return AVLMap{std::move(new_root)};
+    }
+
+    AVLMap erase(const K &key) && {
+        erase_at(root, key);
+        return std::move(*this);
+    }
+
+    // [first, last) yields pairs with strictly increasing keys; O(n)
+    template <typename It>
+    static AVLMap from_sorted(It first, It last) {
+        return AVLMap{build(first, std::distance(first, last))};
+    }
+
+    // merges a strictly increasing run of pairs, overwriting equal keys;
+    // subtrees no key of the run falls into are shared with this version
+    template <typename It>
+    AVLMap insert_sorted_batch(It first, It last) const {
+        return AVLMap{insert_sorted(root, first, last, std::distance(first, last))};
+    }
+
+    // entries below key, the value at key if any, and entries above key; O(log n)
+    Split split(const K &key) const {
+        auto s = split(root, key);
+        return {AVLMap{std::move(s.left)}, s.found ? &s.found->val : nullptr, AVLMap{std::move(s.right)}};
+    }
+
+    // every key in left < key < every key in right; O(|height(left) - height(right)|)
+    static AVLMap join(const AVLMap &left, K key, V val, const AVLMap &right) {
+        return AVLMap{join(left.root, std::move(key), std::move(val), right.root)};
+    }
+
+    // every key in left < every key in right; O(log n)
+    static AVLMap concat(const AVLMap &left, const AVLMap &right) {
+        return AVLMap{join2(left.root, right.root)};
+    }
+
+    // The set operations below take O(m log(n/m + 1)) for sizes m <= n and
+    // return subtrees that come out unchanged as they are. With a thread-safe
+    // RefCount, halves larger than Policy::parallel_cutoff run on the
+    // ForkJoinPool.
+
+    // values from other win on equal keys
+    AVLMap union_with(const AVLMap &other) const {
+        return union_with(other, KeepTheirs{});
+    }
+
+    // combine(key, mine, theirs) gives the value for keys in both maps
+    template <typename F>
+    AVLMap union_with(const AVLMap &other, const F &combine) const {
+        return AVLMap{union_nodes(root, other.root, combine)};
+    }
+
+    // keeps the values of this map
+    AVLMap intersect(const AVLMap &other) const {
+        return intersect(other, KeepMine{});
+    }
+
+    template <typename F>
+    AVLMap intersect(const AVLMap &other, const F &combine) const {
+        return AVLMap{intersect_nodes(root, other.root, combine)};
+    }
+
+    // entries of this map whose key is not in other
+    AVLMap difference(const AVLMap &other) const {
+        return AVLMap{difference_nodes(root, other.root)};
+    }
+
+    // number of keys less than key; O(log n)
+    size_t rank(const K &key) const {
+        size_t rank = 0;
+        for (const AVLNode *node = root.get(); node;) {
+            if (node->key < key) {
+                rank += (node->left ? node->left->count : 0) + 1;
+                node = node->right.get();
+            }
+            else {
+                node = node->left.get();
+            }
+        }
+        return rank;
+    }
+
+    // the entry at index i in key order, end() if i >= size(); O(log n)
+    iterator select(size_t i) const;
+
+    // value of the entry at index i in key order, nullptr if i >= size()
+    const V *nth(size_t i) const {
+        const AVLNode *node = nth(root.get(), i);
+        return node ? &node->val : nullptr;
+    }
+
+    // Policy::Augment summary of all entries
+    Summary aggregate() const {
+        return summary_of(root.get());
+    }
+
+    // Policy::Augment summary of the entries with lo <= key < hi; O(log n)
+    Summary aggregate(const K &lo, const K &hi) const {
+        const AVLNode *node = root.get();
+        while (node && (node->key < lo || !(node->key < hi))) {
+            node = node->key < lo ? node->right.get() : node->left.get();
+        }
+        if (!node) {
+            return Augment::identity();
+        }
+
+        // keys >= lo in the left subtree, prepended as we go down
+        Summary left = Augment::identity();
+        for (const AVLNode *l = node->left.get(); l;) {
+            if (l->key < lo) {
+                l = l->right.get();
+            }
+            else {
+                left = Augment::combine(Augment::combine(Augment::of(l->key, l->val), summary_of(l->right.get())), left);
+                l = l->left.get();
+            }
+        }
+        // keys < hi in the right subtree, appended as we go down
+        Summary right = Augment::identity();
+        for (const AVLNode *r = node->right.get(); r;) {
+            if (r->key < hi) {
+                right = Augment::combine(Augment::combine(right, summary_of(r->left.get())), Augment::of(r->key, r->val));
+                r = r->right.get();
+            }
+            else {
+                r = r->left.get();
+            }
+        }
+        return Augment::combine(Augment::combine(left, Augment::of(node->key, node->val)), right);
+    }
+
+    // Reports, in key order, removed(key, val) for entries only in `before`,
+    // added(key, val) for entries only in `after` and changed(key, old, new)
+    // for keys whose values differ (V needs ==). Subtrees the two versions
+    // share are skipped without being visited, so for versions derived from
+    // one another the cost follows the size of the change, not of the maps.
+    template <typename Removed, typename Added, typename Changed>
+    static void diff(const AVLMap &before, const AVLMap &after, Removed &&removed, Added &&added, Changed &&changed) {
+        DiffStack a, b;
+        a.push_subtree(before.root.get());
+        b.push_subtree(after.root.get());
+
+        while (a.n > 0 && b.n > 0) {
+            auto x = a.top(), y = b.top();
+            if (x.node == y.node && x.whole == y.whole) {
+                --a.n;
+                --b.n;
+            }
+            else if (x.whole && (!y.whole || x.node->height >= y.node->height)) {
+                a.expand();
+            }
+            else if (y.whole) {
+                b.expand();
+            }
+            else if (x.node->key < y.node->key) {
+                removed(x.node->key, x.node->val);
+                --a.n;
+            }
+            else if (y.node->key < x.node->key) {
+                added(y.node->key, y.node->val);
+                --b.n;
+            }
+            else {
+                if (!(x.node->val == y.node->val)) {
+                    changed(x.node->key, x.node->val, y.node->val);
+                }
+                --a.n;
+                --b.n;
+            }
+        }
+        a.drain(removed);
+        b.drain(added);
+    }
+
+    static Diff diff(const AVLMap &before, const AVLMap &after) {
+        Diff d;
+        diff(before, after,
+             [&d](const K &key, const V &val) { d.removed.emplace_back(key, val); },
+             [&d](const K &key, const V &val) { d.added.emplace_back(key, val); },
+             [&d](const K &key, const V &old_val, const V &new_val) { d.changed.push_back({key, old_val, new_val}); });
+        return d;
+    }
+
+    // An equal map whose nodes are shared with every structurally identical
+    // subtree hash-consed through `table` before: same key, value and
+    // children. Subtrees already in the table are not visited, so re-interning
+    // a version derived from an interned one costs its changed paths only.
+    // Needs std::hash and == for K and V.
+    AVLMap hash_consed(InternTable &table) const {
+        return AVLMap{table.intern(root)};
+    }
+
+    // O(1); the same tree means the same entries. For versions hash-consed
+    // through one table, equal entries in the same shape mean the same tree.
+    bool same_tree(const AVLMap &other) const {
+        return root == other.root;
+    }
+
+    Transient transient() const & {
+        return Transient{root};
+    }
+
+    Transient transient() && {
+        return Transient{std::move(root)};
     }
 
     size_t size() const {
-        return _size;
+        return root ? root->count : 0;
     }
 
-    std::optional<const V&> find(const K &key) const {
-        auto cur_root = this->root->get();
+    const V *find(const K &key) const {
+        return find(root.get(), key);
+    }
+
+    const V& find_default(const K &key, const V &default_value) const {
+        auto val = find(key);
+        return val ? *val : default_value;
+    }
+
+    // out[i] = find(keys[i]) for i < n. Up to find_lanes searches go down the
+    // tree together, each prefetching its next node before the others take
+    // a step, so their cache misses overlap instead of queueing up.
+    void find_many(const K *keys, size_t n, const V **out) const {
+        struct Lane {
+            size_t i;
+            const AVLNode *node;
+        } lanes[find_lanes];
+        const AVLNode *top = root.get();
+        size_t next = 0;
+        int active = 0;
+        for (; active < find_lanes && next < n; ++active, ++next) {
+            lanes[active] = {next, top};
+        }
+        if (!top) {
+            std::fill(out, out + n, nullptr);
+            return;
+        }
+
+        while (active > 0) {
+            for (int j = 0; j < active;) {
+                Lane &lane = lanes[j];
+                const K &key = keys[lane.i];
+                const AVLNode *node = lane.node;
+                const AVLNode *child = nullptr;
+                bool hit = false;
+                if (key < node->key) {
+                    child = node->left.get();
+                }
+                else if (node->key < key) {
+                    child = node->right.get();
+                }
+                else {
+                    hit = true;
+                }
+                if (child) {
+                    __builtin_prefetch(child);
+                    lane.node = child;
+                    ++j;
+                    continue;
+                }
+                out[lane.i] = hit ? &node->val : nullptr;
+                if (next < n) {
+                    lane = {next++, top};
+                    ++j;
+                }
+                else {
+                    lane = lanes[--active];
+                }
+            }
+        }
+    }
+
+    std::vector<const V *> find_many(const std::vector<K> &keys) const {
+        std::vector<const V *> out(keys.size());
+        find_many(keys.data(), keys.size(), out.data());
+        return out;
+    }
+
+    iterator begin() const;
+    iterator end() const;
+    iterator lower_bound(const K &key) const;
+    iterator upper_bound(const K &key) const;
+
+    reverse_iterator rbegin() const {
+        return reverse_iterator{end()};
+    }
+
+    reverse_iterator rend() const {
+        return reverse_iterator{begin()};
+    }
+
+    // entries with lo <= key < hi
+    Range range(const K &lo, const K &hi) const {
+        return {lower_bound(lo), lower_bound(hi)};
+    }
+
+    // O(unshared nodes): below a shared node everything is shared
+    Sharing sharing() const {
+        Sharing s{size(), 0};
+        count_shared(root.get(), s.shared);
+        return s;
+    }
+
+    // Adds the nodes of this version that are not in `seen` yet and returns
+    // how many there were. Subtrees already seen are skipped whole, so
+    // marking many versions costs their distinct nodes only.
+    size_t mark_nodes(std::unordered_set<const void *> &seen) const {
+        return mark_nodes(root.get(), seen);
+    }
+
+    // checks ordering, heights and balance of the whole tree, O(n)
+    bool verify() const {
+        return verify(root.get(), nullptr, nullptr) >= 0;
+    }
+
+private:
+    static constexpr int find_lanes = 16;
+
+    template <typename... Args>
+    static inline Rc<AVLNode> mk(Args&&... args) {
+        return Rc<AVLNode>::adopt(Policy::Alloc::template create<AVLNode>(std::forward<Args>(args)...));
+    }
+
+    static const V *find(const AVLNode *cur_root, const K &key) {
         while (cur_root) {
             if (key < cur_root->key) {
-                cur_root = cur_root->left->get();
+                cur_root = cur_root->left.get();
             }
             else if (cur_root->key < key) {
-                cur_root = cur_root->right->get();
+                cur_root = cur_root->right.get();
             }
             else {
-                return {cur_root->val};
+                return &cur_root->val;
             }
         }
-        return {};
+        return nullptr;
     }
 
-    const V& find_default(const K &key, const V &default_value) const {
-        return find(key)->value_or(default_value);
+    static const AVLNode *nth(const AVLNode *node, size_t i) {
+        while (node) {
+            size_t left = node->left ? node->left->count : 0;
+            if (i < left) {
+                node = node->left.get();
+            }
+            else if (i > left) {
+                i -= left + 1;
+                node = node->right.get();
+            }
+            else {
+                break;
+            }
+        }
+        return node;
     }
 
-private:
     static inline int get_height(const Rc<AVLNode> &node) {
         return node ? node->height : 0;
     }
 
 
     static inline Rc<AVLNode> rewrite_ll(Rc<AVLNode> root, Rc<AVLNode> l, Rc<AVLNode> ll) {
+        Stats::rotation(Rotation::ll);
         auto &c = l->right;
 
         root->left = std::move(c);
-        root->update_height_with_null_check();
+        root->update_with_null_check();
 
         l->left = std::move(ll);
         l->right = std::move(root);
-        l->update_height_without_null_check();
+        l->update_without_null_check();
 
         return l;
     }
 
     static inline Rc<AVLNode> rewrite_lr(Rc<AVLNode> root, Rc<AVLNode> l, Rc<AVLNode> lr) {
+        Stats::rotation(Rotation::lr);
         auto &b = lr->left;
         auto &c = lr->right;
 
         root->left = std::move(c);
-        root->update_height_with_null_check();
+        root->update_with_null_check();
 
         l->right = std::move(b);
-        l->update_height_with_null_check();
+        l->update_with_null_check();
 
         lr->left = std::move(l);
         lr->right = std::move(root);
-        lr->update_height_without_null_check();
+        lr->update_without_null_check();
 
         return lr;
     }
 
 
     static inline Rc<AVLNode> rewrite_rl(Rc<AVLNode> root, Rc<AVLNode> r, Rc<AVLNode> rl) {
+        Stats::rotation(Rotation::rl);
         auto &b = rl->left;
         auto &c = rl->right;
 
         root->right = std::move(b);
-        root->update_height_with_null_check();
+        root->update_with_null_check();
 
         r->left = std::move(c);
-        r->update_height_with_null_check();
+        r->update_with_null_check();
 
         rl->left = std::move(root);
         rl->right = std::move(r);
-        rl->update_height_without_null_check();
+        rl->update_without_null_check();
 
         return rl;
     }
 
     static inline Rc<AVLNode> rewrite_rr(Rc<AVLNode> root, Rc<AVLNode> r, Rc<AVLNode> rr) {
+        Stats::rotation(Rotation::rr);
         auto &b = r->left;
 
         root->right = std::move(b);
-        root->update_height_with_null_check();
+        root->update_with_null_check();
 
         r->left = std::move(root);
         r->right = std::move(rr);
-        r->update_height_without_null_check();
+        r->update_without_null_check();
 
         return r;
     }
 
+    // replaces a shared node with a private copy so it can be modified
+    static inline AVLNode *own(Rc<AVLNode> &slot) {
+        if (!slot.unique()) {
+            slot = mk(*slot, slot->left, slot->right);
+            Stats::node_copied();
+        }
+        return slot.get();
+    }
+
+    // Updates the height of *slot and rotates if its children differ by two.
+    // The node in *slot must not be shared; rotated children are copied if they are.
+    static void rebalance(Rc<AVLNode> &slot) {
+        AVLNode *node = slot.get();
+        int lh = get_height(node->left);
+        int rh = get_height(node->right);
 
-    static Rc<AVLNode> insert(AVLNode *root, K key, V val) {
+        if (lh > rh + 1) {
+            auto l = std::move(node->left);
+            own(l);
+            if (get_height(l->left) >= get_height(l->right)) {
+                auto ll = std::move(l->left);
+                slot = rewrite_ll(std::move(slot), std::move(l), std::move(ll));
+            }
+            else {
+                auto lr = std::move(l->right);
+                own(lr);
+                slot = rewrite_lr(std::move(slot), std::move(l), std::move(lr));
+            }
+        }
+        else if (rh > lh + 1) {
+            auto r = std::move(node->right);
+            own(r);
+            if (get_height(r->right) >= get_height(r->left)) {
+                auto rr = std::move(r->right);
+                slot = rewrite_rr(std::move(slot), std::move(r), std::move(rr));
+            }
+            else {
+                auto rl = std::move(r->left);
+                own(rl);
+                slot = rewrite_rl(std::move(slot), std::move(r), std::move(rl));
+            }
+        }
+        else {
+            node->update_with_null_check();
+        }
+    }
+
+
+    // The search path of the last insert into a Transient, from which the
+    // next one resumes at the deepest subtree whose key range holds its key.
+    // low and high bound the keys below each slot, null for no bound. Every
+    // node above the last slot is owned, as long as the root is; copies
+    // start empty, and copying a Transient empties the finger of the source
+    // too, since the nodes below the root are then shared.
+    struct Finger {
         Rc<AVLNode> *path[48];
+        const K *low[48], *high[48];
+        int depth = 0;
+
+        Finger() = default;
+
+        Finger(const Finger &) {}
+
+        Finger &operator=(const Finger &) {
+            depth = 0;
+            return *this;
+        }
+    };
+
+    // Inserts into the tree held by `slot`, changing uniquely owned nodes in
+    // place and copying the rest of the path. Returns whether the key is new.
+    static bool insert_at(Rc<AVLNode> &slot, K key, V val, Finger *finger = nullptr) {
+        Finger local;
+        Finger &f = finger ? *finger : local;
+        auto &path = f.path;
         int n = 0;
-        Rc<AVLNode> new_root = nullptr;
-        auto ptr = &new_root;
+        auto ptr = &slot;
+        const K *low = nullptr, *high = nullptr;
+        Stats::op_begin();
+
+        if (f.depth > 0 && slot.unique()) {
+            n = f.depth - 1;
+            while (n > 0 && ((f.low[n] && !(*f.low[n] < key)) || (f.high[n] && !(key < *f.high[n])))) {
+                --n;
+            }
+            ptr = path[n];
+            low = f.low[n];
+            high = f.high[n];
+        }
+        f.depth = 0;
+
+        while (ptr->unique()) {
+            auto node = ptr->get();
+            if (key < node->key) {
+                f.low[n] = low;
+                f.high[n] = high;
+                path[n++] = ptr;
+                ptr = &node->left;
+                high = &node->key;
+            }
+            else if (node->key < key) {
+                f.low[n] = low;
+                f.high[n] = high;
+                path[n++] = ptr;
+                ptr = &node->right;
+                low = &node->key;
+            }
+            else {
+                node->val = std::move(val);
+                Stats::op_end(TreeOp::insert, n + 1);
+                f.depth = n;
+                if constexpr (augmented) {
+                    path[n++] = ptr;
+                    update_above(path, n, 0);
+                }
+                return false;
+            }
+        }
+
+        // everything below a shared node is shared too, so copy from here on;
+        // `shared` keeps the old path alive while it is being read
+        Rc<AVLNode> shared = std::move(*ptr);
+        const AVLNode *root = shared.get();
 
         while (root) {
+            Stats::node_copied();
+            f.low[n] = low;
+            f.high[n] = high;
             if (key < root->key) {
-                *ptr = std::make_shared<AVLNode>(root->height, root->key, root->val, nullptr, root->right);
+                *ptr = mk(*root, nullptr, root->right);
                 path[n++] = ptr;
+                high = &(*ptr)->key;
                 ptr = &(*ptr)->left;
                 root = root->left.get();
             }
             else if (root->key < key) {
-                *ptr = std::make_shared<AVLNode>(root->height, root->key, root->val, root->left, nullptr);
+                *ptr = mk(*root, root->left, nullptr);
                 path[n++] = ptr;
+                low = &(*ptr)->key;
                 ptr = &(*ptr)->right;
                 root = root->right.get();
             }
             else {
-                *ptr = std::make_shared<AVLNode>(root->height, std::move(key), std::move(val), root->left, root->right);
-                return new_root;
+                *ptr = mk(std::move(key), std::move(val), root->left, root->right);
+                Stats::op_end(TreeOp::insert, n + 1);
+                f.depth = n;
+                if constexpr (augmented) {
+                    update_above(path, n, 0);
+                }
+                return false;
+            }
+        }
+
+        *ptr = mk(std::move(key), std::move(val));
+        f.low[n] = low;
+        f.high[n] = high;
+        path[n] = ptr;
+        const AVLNode *added = ptr->get();
+        int rotated = grow(path, n);
+        f.depth = rotated < 0 ? n + 1 : rotated + 1;
+        check_path(slot.get(), added->key);
+        Stats::op_end(TreeOp::insert, n + 1);
+        return true;
+    }
+
+    // Inserts a key above every key in the tree without comparing it to
+    // anything but the largest; any other key goes through insert_at.
+    static bool push_back_at(Rc<AVLNode> &slot, K key, V val) {
+        const AVLNode *last = slot.get();
+        while (last && last->right) {
+            last = last->right.get();
+        }
+        if (last && !(last->key < key)) {
+            return insert_at(slot, std::move(key), std::move(val));
+        }
+
+        Rc<AVLNode> *path[48];
+        int n = 0;
+        auto ptr = &slot;
+        Stats::op_begin();
+        while (ptr->unique()) {
+            path[n++] = ptr;
+            ptr = &(*ptr)->right;
+        }
+        Rc<AVLNode> shared = std::move(*ptr);
+        for (const AVLNode *root = shared.get(); root; root = root->right.get()) {
+            Stats::node_copied();
+            *ptr = mk(*root, root->left, nullptr);
+            path[n++] = ptr;
+            ptr = &(*ptr)->right;
+        }
+        *ptr = mk(std::move(key), std::move(val));
+        const AVLNode *added = ptr->get();
+        grow(path, n);
+        check_path(slot.get(), added->key);
+        Stats::op_end(TreeOp::insert, n + 1);
+        return true;
+    }
+
+    // The subtree below the n nodes on `path` gained a node. Rebalances
+    // them bottom-up; heights above the first subtree whose height did not
+    // change are already right, only the counts still need the new node.
+    // Returns the level of the rotation, -1 if there was none.
+    static int grow(Rc<AVLNode> *const *path, int n) {
+        while (n-- > 0) {
+            const AVLNode *before = path[n]->get();
+            int old_height = before->height;
+            rebalance(*path[n]);
+            if ((*path[n])->height == old_height) {
+                Stats::early_break();
+                update_above(path, n, 1);
+                return path[n]->get() != before ? n : -1;
+            }
+        }
+        return -1;
+    }
+
+    // The n nodes on `path` keep their height; their count changes by delta
+    // and their summary is recomputed from the children.
+    static void update_above(Rc<AVLNode> *const *path, int n, int delta) {
+        while (n-- > 0) {
+            AVLNode *node = path[n]->get();
+            if constexpr (augmented) {
+                node->update_with_null_check();
+            }
+            else {
+                node->count += delta;
             }
         }
+    }
+
+    // Removes key from the tree held by `slot`, with the same in-place and
+    // copying rules as insert_at. Returns whether the key was there.
+    static bool erase_at(Rc<AVLNode> &slot, const K &key) {
+        if (!find(slot.get(), key)) {
+            return false;
+        }
 
-        *ptr = std::make_shared<AVLNode>(std::move(key), std::move(val));
+        Rc<AVLNode> *path[48];
+        int n = 0;
+        auto ptr = &slot;
+        AVLNode *node;
+        Stats::op_begin();
+        while (true) {
+            node = own(*ptr);
+            if (key < node->key) {
+                path[n++] = ptr;
+                ptr = &node->left;
+            }
+            else if (node->key < key) {
+                path[n++] = ptr;
+                ptr = &node->right;
+            }
+            else {
+                break;
+            }
+        }
+
+        if (!node->left || !node->right) {
+            auto child = node->left ? std::move(node->left) : std::move(node->right);
+            *ptr = std::move(child);
+        }
+        else {
+            // take over the smallest entry of the right subtree
+            path[n++] = ptr;
+            auto succ = &node->right;
+            while ((*succ)->left) {
+                path[n++] = succ;
+                succ = &own(*succ)->left;
+            }
+            AVLNode *min = succ->get();
+            if (succ->unique()) {
+                node->key = std::move(min->key);
+                node->val = std::move(min->val);
+            }
+            else {
+                node->key = min->key;
+                node->val = min->val;
+            }
+            *succ = Rc<AVLNode>{min->right};
+        }
+        int path_length = n + 1;
+
+        // once a subtree keeps its height nothing above needs rotating
+        while (n-- > 0) {
+            int old_height = (*path[n])->height;
+            rebalance(*path[n]);
+            if ((*path[n])->height == old_height) {
+                Stats::early_break();
+                break;
+            }
+        }
+        update_above(path, n, -1);
+        // the successor that took the erased node's place heads a second path
+        if (const K *succ = check_path(slot.get(), key)) {
+            check_path(slot.get(), *succ);
+        }
+        Stats::op_end(TreeOp::erase, path_length);
+        return true;
+    }
+
+    template <typename It>
+    static Rc<AVLNode> build(It &first, size_t n) {
         if (n == 0) {
-            return *ptr;
-        }
-
-        path[--n]->get()->update_height_with_null_check();
-        while (--n >= 0) {
-            auto &cur_root = *path[n];
-            int old_height = path[n]->get()->height;
-            cur_root->update_height_with_null_check();
-
-            if (get_height(cur_root->left) > get_height(cur_root->right) + 1) {
-                auto &l = cur_root->left;
-                if (get_height(l->left) > get_height(l->right)) {
-                    auto cur_root_new = rewrite_ll(std::move(cur_root), std::move(l), std::move(l->left));
-                    auto new_height = cur_root_new->height;
-                    *path[n] = std::move(cur_root_new);
-                    if (new_height == old_height) {
-                        break;
-                    }
-                    else {
-                        continue;
-                    }
-                }
-                if (get_height(l->left) < get_height(l->right)) {
-                    auto cur_root_new = rewrite_lr(std::move(cur_root), std::move(l), std::move(l->right));
-                    auto new_height = cur_root_new->height;
-                    *path[n] = std::move(cur_root_new);
-                    if (new_height == old_height) {
-                        break;
-                    }
-                    else {
-                        continue;
-                    }
+            return nullptr;
+        }
+        auto left = build(first, n / 2);
+        auto &&kv = *first;
+        ++first;
+        auto right = build(first, n - n / 2 - 1);
+        return mk(kv.first, kv.second, std::move(left), std::move(right));
+    }
+
+    // Joins l, (key, val) and r where every key in l < key < every key in r.
+    // Walks down the spine of the taller tree until the heights are within
+    // one, so it takes O(|height(l) - height(r)|) steps.
+    static Rc<AVLNode> join(Rc<AVLNode> l, K key, V val, Rc<AVLNode> r) {
+        int lh = get_height(l);
+        int rh = get_height(r);
+        if (lh > rh + 1) {
+            auto node = own(l);
+            node->right = join(std::move(node->right), std::move(key), std::move(val), std::move(r));
+            rebalance(l);
+            return l;
+        }
+        if (rh > lh + 1) {
+            auto node = own(r);
+            node->left = join(std::move(l), std::move(key), std::move(val), std::move(node->left));
+            rebalance(r);
+            return r;
+        }
+        return mk(std::move(key), std::move(val), std::move(l), std::move(r));
+    }
+
+    template <typename It>
+    static Rc<AVLNode> insert_sorted(const Rc<AVLNode> &root, It first, It last, size_t n) {
+        if (n == 0) {
+            return root;
+        }
+        if (!root) {
+            return build(first, n);
+        }
+
+        auto mid = std::partition_point(first, last, [&root](const auto &kv) { return kv.first < root->key; });
+        size_t n_left = std::distance(first, mid);
+        bool replace = mid != last && !(root->key < mid->first);
+        auto right_first = replace ? std::next(mid) : mid;
+
+        auto left = insert_sorted(root->left, first, mid, n_left);
+        auto right = insert_sorted(root->right, right_first, last, n - n_left - replace);
+        if (replace) {
+            return join(std::move(left), mid->first, mid->second, std::move(right));
+        }
+        if (left == root->left && right == root->right) {
+            return root;
+        }
+        return join(std::move(left), root->key, root->val, std::move(right));
+    }
+
+    struct SplitNodes {
+        Rc<AVLNode> left;
+        const AVLNode *found;
+        Rc<AVLNode> right;
+    };
+
+    static SplitNodes split(const Rc<AVLNode> &root, const K &key) {
+        if (!root) {
+            return {nullptr, nullptr, nullptr};
+        }
+        if (key < root->key) {
+            auto s = split(root->left, key);
+            s.right = join(std::move(s.right), root->key, root->val, root->right);
+            return s;
+        }
+        if (root->key < key) {
+            auto s = split(root->right, key);
+            s.left = join(root->left, root->key, root->val, std::move(s.left));
+            return s;
+        }
+        return {root->left, root.get(), root->right};
+    }
+
+    // `root` minus its largest entry, which is returned through `last`
+    static Rc<AVLNode> split_last(const Rc<AVLNode> &root, const AVLNode *&last) {
+        if (!root->right) {
+            last = root.get();
+            return root->left;
+        }
+        auto rest = split_last(root->right, last);
+        return join(root->left, root->key, root->val, std::move(rest));
+    }
+
+    static Rc<AVLNode> join2(Rc<AVLNode> l, Rc<AVLNode> r) {
+        if (!l) {
+            return r;
+        }
+        const AVLNode *last;
+        auto rest = split_last(l, last);
+        return join(std::move(rest), last->key, last->val, std::move(r));
+    }
+
+    template <typename F, typename G>
+    static void fork(size_t work, F &&f, G &&g) {
+        if constexpr (Policy::RefCount::thread_safe) {
+            if (work > Policy::parallel_cutoff) {
+                ForkJoinPool::instance().invoke(f, g);
+                return;
+            }
+        }
+        f();
+        g();
+    }
+
+    template <typename F>
+    static Rc<AVLNode> union_nodes(const Rc<AVLNode> &a, const Rc<AVLNode> &b, const F &combine) {
+        if (!a) {
+            return b;
+        }
+        if (!b) {
+            return a;
+        }
+        if constexpr (std::is_same_v<F, KeepTheirs> || std::is_same_v<F, KeepMine>) {
+            if (a == b) {
+                return a;
+            }
+        }
+
+        auto s = split(b, a->key);
+        Rc<AVLNode> l, r;
+        fork(a->count + b->count,
+             [&] { l = union_nodes(a->left, s.left, combine); },
+             [&] { r = union_nodes(a->right, s.right, combine); });
+
+        if (s.found) {
+            return join(std::move(l), a->key, combine(a->key, a->val, s.found->val), std::move(r));
+        }
+        if (l == a->left && r == a->right) {
+            return a;
+        }
+        return join(std::move(l), a->key, a->val, std::move(r));
+    }
+
+    template <typename F>
+    static Rc<AVLNode> intersect_nodes(const Rc<AVLNode> &a, const Rc<AVLNode> &b, const F &combine) {
+        if (!a || !b) {
+            return nullptr;
+        }
+        if constexpr (std::is_same_v<F, KeepTheirs> || std::is_same_v<F, KeepMine>) {
+            if (a == b) {
+                return a;
+            }
+        }
+
+        auto s = split(b, a->key);
+        Rc<AVLNode> l, r;
+        fork(a->count + b->count,
+             [&] { l = intersect_nodes(a->left, s.left, combine); },
+             [&] { r = intersect_nodes(a->right, s.right, combine); });
+
+        if (!s.found) {
+            return join2(std::move(l), std::move(r));
+        }
+        if constexpr (std::is_same_v<F, KeepMine>) {
+            if (l == a->left && r == a->right) {
+                return a;
+            }
+        }
+        return join(std::move(l), a->key, combine(a->key, a->val, s.found->val), std::move(r));
+    }
+
+    static Rc<AVLNode> difference_nodes(const Rc<AVLNode> &a, const Rc<AVLNode> &b) {
+        if (!a || a == b) {
+            return nullptr;
+        }
+        if (!b) {
+            return a;
+        }
+
+        auto s = split(a, b->key);
+        Rc<AVLNode> l, r;
+        fork(a->count + b->count,
+             [&] { l = difference_nodes(s.left, b->left); },
+             [&] { r = difference_nodes(s.right, b->right); });
+
+        return join2(std::move(l), std::move(r));
+    }
+
+    // What is left of one tree during a diff, in key order from the top: whole
+    // subtrees and single entries. Expanding a subtree pushes items of smaller
+    // height only, so two entries per level are enough.
+    struct DiffStack {
+        struct Item {
+            const AVLNode *node;
+            bool whole;
+        };
+
+        Item items[2 * 48 + 1];
+        int n = 0;
+
+        Item top() const {
+            return items[n - 1];
+        }
 
+        void push_subtree(const AVLNode *node) {
+            if (node) {
+                items[n++] = {node, true};
+            }
+        }
+
+        void expand() {
+            const AVLNode *node = items[--n].node;
+            push_subtree(node->right.get());
+            items[n++] = {node, false};
+            push_subtree(node->left.get());
+        }
+
+        template <typename F>
+        void drain(F &report) {
+            while (n > 0) {
+                if (top().whole) {
+                    expand();
+                }
+                else {
+                    const AVLNode *node = items[--n].node;
+                    report(node->key, node->val);
                 }
             }
-            if (get_height(cur_root->left) < get_height(cur_root->right) - 1) {
-                auto &r = cur_root->right;
-                if (get_height(r->left) > get_height(r->right)) {
-                    auto cur_root_new = rewrite_rl(std::move(cur_root), std::move(r), std::move(r->left));
-                    auto new_height = cur_root_new->height;
-                    *path[n] = std::move(cur_root_new);
-                    if (new_height == old_height) {
-                        break;
-                    }
-                    else {
-                        continue;
-                    }
+        }
+    };
+
+    static void count_shared(const AVLNode *node, size_t &shared) {
+        if (!node) {
+            return;
+        }
+        if (Policy::RefCount::load(node->refs) > 1) {
+            shared += node->count;
+            return;
+        }
+        count_shared(node->left.get(), shared);
+        count_shared(node->right.get(), shared);
+    }
+
+    static size_t mark_nodes(const AVLNode *node, std::unordered_set<const void *> &seen) {
+        if (!node || !seen.insert(node).second) {
+            return 0;
+        }
+        return 1 + mark_nodes(node->left.get(), seen) + mark_nodes(node->right.get(), seen);
+    }
+
+    // With Policy::checked, walks from the root to where key goes and checks
+    // each node on the way and both its children: heights, balance, counts,
+    // and keys against the bounds the ancestors set. A rotation moves nodes
+    // off that path only to a child of it, so this covers every node an
+    // update at key changed. Returns the smallest key above key it passed.
+    static const K *check_path(const AVLNode *node, const K &key) {
+        const K *low = nullptr, *high = nullptr;
+        if constexpr (Policy::checked) {
+            while (node) {
+                check_node(node, low, high);
+                check_node(node->left.get(), low, &node->key);
+                check_node(node->right.get(), &node->key, high);
+                if (key < node->key) {
+                    high = &node->key;
+                    node = node->left.get();
                 }
-                if (get_height(r->left) < get_height(r->right)) {
-                    auto cur_root_new = rewrite_rr(std::move(cur_root), std::move(r), std::move(r->right));
-                    auto new_height = cur_root_new->height;
-                    *path[n] = std::move(cur_root_new);
-                    if (new_height == old_height) {
-                        break;
-                    }
-                    else {
-                        continue;
-                    }
+                else {
+                    low = &node->key;
+                    node = node->right.get();
                 }
             }
         }
-        return new_root;
+        return high;
+    }
+
+    static bool within(const AVLNode *node, const K *low, const K *high) {
+        return !node || ((!low || *low < node->key) && (!high || node->key < *high));
+    }
+
+    // the node and its children within (low, high) and on the right side of
+    // it, heights and count against the children
+    static void check_node(const AVLNode *node, const K *low, const K *high) {
+        if (!node) {
+            return;
+        }
+        const AVLNode *l = node->left.get(), *r = node->right.get();
+        if (!within(node, low, high) || !within(l, low, &node->key) || !within(r, &node->key, high)) {
+            invariant_failed("AVLMap", "order");
+        }
+        int lh = l ? l->height : 0, rh = r ? r->height : 0;
+        if (std::abs(lh - rh) > 1 || node->height != 1 + std::max(lh, rh)) {
+            invariant_failed("AVLMap", "height");
+        }
+        if (node->count != (l ? l->count : 0) + (r ? r->count : 0) + 1) {
+            invariant_failed("AVLMap", "count");
+        }
+    }
+
+    static int verify(const AVLNode *node, const K *low, const K *high) {
+        if (!node) {
+            return 0;
+        }
+        if ((low && !(*low < node->key)) || (high && !(node->key < *high))) {
+            return -1;
+        }
+        int lh = verify(node->left.get(), low, &node->key);
+        int rh = verify(node->right.get(), &node->key, high);
+        if (lh < 0 || rh < 0 || std::abs(lh - rh) > 1 || node->height != 1 + std::max(lh, rh)) {
+            return -1;
+        }
+        size_t count = (node->left ? node->left->count : 0) + (node->right ? node->right->count : 0) + 1;
+        if (node->count != count) {
+            return -1;
+        }
+        return node->height;
+    }
+};
+
+
+// Mutable builder over an AVLMap. Nodes shared with other versions are copied
+// on first write; after that the builder owns them and updates them in place.
+//
+// Inserts remember their path. The next one starts from the deepest node on
+// it whose subtree can hold the new key, so increasing or clustered keys
+// take an amortised constant number of comparisons.
+template <typename K, typename V, typename Policy>
+class AVLMap<K, V, Policy>::Transient {
+    friend class AVLMap;
+
+    Rc<AVLNode> root;
+    mutable Finger finger;
+
+    explicit Transient(Rc<AVLNode> root): root{std::move(root)} {}
+
+public:
+    Transient(): root{} {}
+
+    Transient(const Transient &other): root{other.root} {
+        other.finger.depth = 0;
+    }
+
+    Transient(Transient &&) = default;
+
+    Transient &operator=(const Transient &other) {
+        root = other.root;
+        finger.depth = 0;
+        other.finger.depth = 0;
+        return *this;
+    }
+
+    Transient &operator=(Transient &&) = default;
+
+    void insert(K key, V val) {
+        insert_at(root, std::move(key), std::move(val), &finger);
+    }
+
+    // the same as insert, which already makes appends cheap
+    void push_back(K key, V val) {
+        insert(std::move(key), std::move(val));
+    }
+
+    void erase(const K &key) {
+        finger.depth = 0;
+        erase_at(root, key);
+    }
+
+    size_t size() const {
+        return root ? root->count : 0;
+    }
+
+    const V *find(const K &key) const {
+        return AVLMap::find(root.get(), key);
+    }
+
+    AVLMap persistent() && {
+        return AVLMap{std::move(root)};
+    }
+};
+
+
+// Canonical nodes for AVLMap::hash_consed, keyed by key, value and child
+// pointers. The table holds a reference to each node, so an interned node is
+// never unique and updates of any version copy it rather than change it in
+// place; sweep() drops the nodes no version uses any more. Not thread-safe.
+template <typename K, typename V, typename Policy>
+class AVLMap<K, V, Policy>::InternTable {
+    friend class AVLMap;
+
+    std::unordered_multimap<size_t, Rc<AVLNode>> nodes;
+
+    static size_t hash(const K &key, const V &val, const AVLNode *left, const AVLNode *right) {
+        size_t h = std::hash<K>{}(key);
+        for (size_t x : {std::hash<V>{}(val), std::hash<const void *>{}(left), std::hash<const void *>{}(right)}) {
+            h ^= x + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+        }
+        return h;
+    }
+
+    const Rc<AVLNode> *lookup(size_t h, const AVLNode &node, const AVLNode *left, const AVLNode *right) const {
+        auto [first, last] = nodes.equal_range(h);
+        for (auto it = first; it != last; ++it) {
+            const AVLNode &c = *it->second;
+            if (c.left.get() == left && c.right.get() == right && c.key == node.key && c.val == node.val) {
+                return &it->second;
+            }
+        }
+        return nullptr;
+    }
+
+    Rc<AVLNode> intern(const Rc<AVLNode> &node) {
+        if (!node) {
+            return nullptr;
+        }
+        // an interned node has interned children, so it finds itself
+        size_t h = hash(node->key, node->val, node->left.get(), node->right.get());
+        if (auto found = lookup(h, *node, node->left.get(), node->right.get())) {
+            return *found;
+        }
+
+        auto left = intern(node->left), right = intern(node->right);
+        if (left != node->left || right != node->right) {
+            h = hash(node->key, node->val, left.get(), right.get());
+            if (auto found = lookup(h, *node, left.get(), right.get())) {
+                return *found;
+            }
+        }
+        auto canonical = left == node->left && right == node->right ? node : mk(*node, std::move(left), std::move(right));
+        nodes.emplace(h, canonical);
+        return canonical;
+    }
+
+public:
+    size_t size() const {
+        return nodes.size();
+    }
+
+    // Drops the nodes only the table still holds and returns how many.
+    // Parents go first and let go of their children on the spot, before a
+    // deferred Policy::Reclaim gets to them, so the children are caught in
+    // the same pass.
+    size_t sweep() {
+        std::vector<std::pair<int, typename decltype(nodes)::iterator>> order;
+        for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+            order.emplace_back(it->second->height, it);
+        }
+        std::sort(order.begin(), order.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+        size_t dropped = 0;
+        for (auto &[height, it] : order) {
+            if (it->second.unique()) {
+                it->second->left = nullptr;
+                it->second->right = nullptr;
+                nodes.erase(it);
+                ++dropped;
+            }
+        }
+        return dropped;
+    }
+
+    void clear() {
+        nodes.clear();
+    }
+};
+
+
+// Keeps the whole path from the root to the current node on a fixed stack
+// (48 levels, like insert), so iterating neither allocates nor touches
+// reference counts. Iterators stay valid as long as the version they come from.
+template <typename K, typename V, typename Policy>
+class AVLMap<K, V, Policy>::iterator {
+    friend class AVLMap;
+
+    const AVLNode *root = nullptr;
+    const AVLNode *stack[48];
+    int depth = 0;     // 0 at end()
+
+    const AVLNode *top() const {
+        return stack[depth - 1];
+    }
+
+    void push_leftmost(const AVLNode *node) {
+        for (; node; node = node->left.get()) {
+            stack[depth++] = node;
+        }
+    }
+
+    void push_rightmost(const AVLNode *node) {
+        for (; node; node = node->right.get()) {
+            stack[depth++] = node;
+        }
+    }
+
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::pair<const K &, const V &>;
+    using difference_type = std::ptrdiff_t;
+    using reference = value_type;
+
+    struct pointer {
+        value_type kv;
+
+        const value_type *operator->() const {
+            return &kv;
+        }
+    };
+
+    iterator() = default;
+
+    const K &key() const {
+        return top()->key;
+    }
+
+    const V &value() const {
+        return top()->val;
+    }
+
+    reference operator*() const {
+        return {top()->key, top()->val};
+    }
+
+    pointer operator->() const {
+        return {{top()->key, top()->val}};
+    }
+
+    iterator &operator++() {
+        const AVLNode *node = top();
+        if (node->right) {
+            push_leftmost(node->right.get());
+            return *this;
+        }
+        // climb until we leave a left subtree
+        do {
+            node = stack[--depth];
+        } while (depth > 0 && top()->right.get() == node);
+        return *this;
+    }
+
+    iterator &operator--() {
+        if (depth == 0) {
+            push_rightmost(root);
+            return *this;
+        }
+        const AVLNode *node = top();
+        if (node->left) {
+            push_rightmost(node->left.get());
+            return *this;
+        }
+        do {
+            node = stack[--depth];
+        } while (depth > 0 && top()->left.get() == node);
+        return *this;
+    }
+
+    iterator operator++(int) {
+        auto old = *this;
+        ++*this;
+        return old;
+    }
+
+    iterator operator--(int) {
+        auto old = *this;
+        --*this;
+        return old;
+    }
+
+    friend bool operator==(const iterator &a, const iterator &b) {
+        return a.depth == b.depth && (a.depth == 0 || a.top() == b.top());
+    }
+
+    friend bool operator!=(const iterator &a, const iterator &b) {
+        return !(a == b);
+    }
+};
+
+template <typename K, typename V, typename Policy>
+auto AVLMap<K, V, Policy>::begin() const -> iterator {
+    iterator it;
+    it.root = root.get();
+    it.push_leftmost(root.get());
+    return it;
+}
+
+template <typename K, typename V, typename Policy>
+auto AVLMap<K, V, Policy>::end() const -> iterator {
+    iterator it;
+    it.root = root.get();
+    return it;
+}
+
+// The answer lies on the search path, so descend once and cut the stack back
+// to the last node that qualified.
+template <typename K, typename V, typename Policy>
+auto AVLMap<K, V, Policy>::lower_bound(const K &key) const -> iterator {
+    iterator it;
+    it.root = root.get();
+    int keep = 0;
+    for (const AVLNode *node = root.get(); node;) {
+        it.stack[it.depth++] = node;
+        if (!(node->key < key)) {
+            keep = it.depth;
+            node = node->left.get();
+        }
+        else {
+            node = node->right.get();
+        }
+    }
+    it.depth = keep;
+    return it;
+}
+
+template <typename K, typename V, typename Policy>
+auto AVLMap<K, V, Policy>::select(size_t i) const -> iterator {
+    iterator it;
+    it.root = root.get();
+    if (i >= size()) {
+        return it;
+    }
+    for (const AVLNode *node = root.get(); node;) {
+        it.stack[it.depth++] = node;
+        size_t left = node->left ? node->left->count : 0;
+        if (i < left) {
+            node = node->left.get();
+        }
+        else if (i > left) {
+            i -= left + 1;
+            node = node->right.get();
+        }
+        else {
+            break;
+        }
+    }
+    return it;
+}
+
+template <typename K, typename V, typename Policy>
+auto AVLMap<K, V, Policy>::upper_bound(const K &key) const -> iterator {
+    iterator it;
+    it.root = root.get();
+    int keep = 0;
+    for (const AVLNode *node = root.get(); node;) {
+        it.stack[it.depth++] = node;
+        if (key < node->key) {
+            keep = it.depth;
+            node = node->left.get();
+        }
+        else {
+            node = node->right.get();
+        }
     }
-};
\ No newline at end of file
+    it.depth = keep;
+    return it;
+}
@@ -0,0 +1,770 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <random>
+#include <unordered_set>
+#include <map>
+#include <thread>
+#include <tuple>
+
+#include "avl.h"
+
+
+namespace _test {
+
+    void assert(bool x, const char *msg) {
+        if (!x) {
+            fprintf(stderr, "%s\n", msg); fflush(stderr);
+            abort();
+        }
+    }
+
+    std::vector<int> distinct_numbers(int n) {
+        std::default_random_engine e{};
+        std::unordered_set<int> numbers_set;
+        while (numbers_set.size() < (size_t)n) {
+            numbers_set.insert(e());
+        }
+        return std::vector<int>(numbers_set.begin(), numbers_set.end());
+    }
+
+    template <typename Policy>
+    void test_insert(int n) {
+        using Map = AVLMap<int, int, Policy>;
+        auto numbers = distinct_numbers(n);
+        std::vector<Map> maps(1);
+
+        for (int i = 0; i < n; ++i) {
+            maps.push_back(maps.back().insert(numbers[i], i));
+            auto &m = maps.back();
+            assert(m.size() == (size_t)i + 1, "size");
+            assert(m.verify(), "verify");
+
+            auto same = m.insert(numbers[i / 2], -1);
+            assert(same.size() == m.size(), "size -- insert same");
+            assert(*same.find(numbers[i / 2]) == -1, "insert same -- value");
+            assert(*m.find(numbers[i / 2]) == i / 2, "insert same -- old value");
+        }
+        for (int j = 0; j <= n; ++j) {
+            auto &m = maps[j];
+            assert(m.verify(), "verify -- old version");
+            for (int i = 0; i < n; ++i) {
+                assert(m.find_default(numbers[i], -1) == (i < j ? i : -1), "find");
+            }
+        }
+    }
+
+    // moving inserts must never change a version someone else kept
+    template <typename Policy>
+    void test_insert_in_place(int n) {
+        using Map = AVLMap<int, int, Policy>;
+        auto numbers = distinct_numbers(n);
+        std::vector<std::pair<int, Map>> kept;
+        Map m;
+
+        for (int i = 0; i < n; ++i) {
+            m = std::move(m).insert(numbers[i], i);
+            if (i % 7 == 0) {
+                kept.emplace_back(i + 1, m);
+            }
+            if (i % 5 == 0) {
+                m = std::move(m).insert(numbers[i / 2], -i);
+            }
+        }
+        assert(m.size() == (size_t)n && m.verify(), "in place -- verify");
+
+        for (auto &[count, old] : kept) {
+            assert(old.size() == (size_t)count && old.verify(), "in place -- kept version");
+            for (int i = 0; i < count; ++i) {
+                const int *v = old.find(numbers[i]);
+                assert(v && (*v == i || *v <= 0), "in place -- kept value");
+            }
+            assert(count == n || !old.find(numbers[count]), "in place -- kept absent");
+        }
+
+        auto t = m.transient();
+        for (int i = 0; i < n; ++i) {
+            t.insert(numbers[i], 2 * i);
+            t.insert(-numbers[i] - 1, i);
+        }
+        auto doubled = std::move(t).persistent();
+        assert(doubled.verify(), "transient -- verify");
+        for (int i = 0; i < n; ++i) {
+            assert(*doubled.find(numbers[i]) == 2 * i, "transient -- value");
+            assert(*m.find(numbers[i]) != 2 * i || i == 0, "transient -- source untouched");
+        }
+    }
+
+    template <typename Policy>
+    void test_from_sorted(int n) {
+        using Map = AVLMap<int, int, Policy>;
+        for (int size = 0; size <= n; size = size * 2 + 1) {
+            std::vector<std::pair<int, int>> kvs;
+            for (int i = 0; i < size; ++i) {
+                kvs.emplace_back(i * 2, i);
+            }
+            auto m = Map::from_sorted(kvs.begin(), kvs.end());
+            assert(m.size() == (size_t)size && m.verify(), "from sorted -- verify");
+            for (int i = 0; i < size; ++i) {
+                assert(*m.find(i * 2) == i && !m.find(i * 2 + 1), "from sorted -- find");
+            }
+        }
+    }
+
+    template <typename Policy>
+    void test_insert_sorted_batch(int n) {
+        using Map = AVLMap<int, int, Policy>;
+        std::default_random_engine e{};
+        std::map<int, int> expect;
+        Map m;
+
+        for (int round = 0; round < 50; ++round) {
+            // runs alternate between dense, sparse and clustered keys
+            int lo = std::uniform_int_distribution<int>(0, n)(e);
+            int step = round % 3 == 0 ? 1 : round % 3 == 1 ? 97 : 5;
+            int count = std::uniform_int_distribution<int>(0, n / 10 + 1)(e);
+            std::vector<std::pair<int, int>> run;
+            for (int i = 0; i < count; ++i) {
+                run.emplace_back(lo + i * step, round);
+                expect[lo + i * step] = round;
+            }
+            auto next = m.insert_sorted_batch(run.begin(), run.end());
+            assert(next.size() == expect.size() && next.verify(), "sorted batch -- verify");
+            for (auto &[k, v] : expect) {
+                assert(next.find_default(k, -1) == v, "sorted batch -- find");
+            }
+            assert(m.verify(), "sorted batch -- old version");
+            m = next;
+        }
+    }
+
+    template <typename Policy, typename V = int>
+    AVLMap<int, V, Policy> random_map(std::default_random_engine &e, int n, int range, std::map<int, V> &expect) {
+        auto t = AVLMap<int, V, Policy>{}.transient();
+        for (int i = 0; i < n; ++i) {
+            int k = std::uniform_int_distribution<int>(0, range)(e);
+            t.insert(k, i);
+            expect[k] = i;
+        }
+        return std::move(t).persistent();
+    }
+
+    template <typename Map>
+    void assert_same(const Map &m, const std::map<int, int> &expect, const char *msg) {
+        assert(m.size() == expect.size() && m.verify(), msg);
+        for (auto &[k, v] : expect) {
+            assert(m.find_default(k, -1) == v, msg);
+        }
+    }
+
+    template <typename Policy>
+    void test_split_join(int n) {
+        using Map = AVLMap<int, int, Policy>;
+        std::default_random_engine e{};
+        std::map<int, int> expect;
+        auto m = random_map<Policy>(e, n, n * 2, expect);
+
+        for (int k = -1; k <= n * 2 + 1; k += 7) {
+            auto s = m.split(k);
+            std::map<int, int> lo(expect.begin(), expect.lower_bound(k));
+            std::map<int, int> hi(expect.upper_bound(k), expect.end());
+            assert_same(s.left, lo, "split -- left");
+            assert_same(s.right, hi, "split -- right");
+            assert((s.found != nullptr) == (expect.count(k) == 1), "split -- found");
+
+            auto joined = lo;
+            joined.insert(hi.begin(), hi.end());
+            assert_same(Map::concat(s.left, s.right), joined, "concat");
+            joined[k] = -2;
+            assert_same(Map::join(s.left, k, -2, s.right), joined, "join");
+        }
+    }
+
+    template <typename Policy>
+    void test_set_operations(int n) {
+        std::default_random_engine e{};
+        for (int round = 0; round < 8; ++round) {
+            std::map<int, int> ea, eb;
+            auto a = random_map<Policy>(e, n >> (round % 4), n, ea);
+            auto b = random_map<Policy>(e, n >> (3 - round % 4), n, eb);
+
+            auto eu = eb;
+            eu.insert(ea.begin(), ea.end());
+            assert_same(a.union_with(b), eu, "union");
+
+            std::map<int, int> esum = ea, ei, ed;
+            for (auto &[k, v] : eb) {
+                esum[k] = ea.count(k) ? ea[k] + v : v;
+            }
+            assert_same(a.union_with(b, [](int, int x, int y) { return x + y; }), esum, "union -- combine");
+
+            for (auto &[k, v] : ea) {
+                (eb.count(k) ? ei : ed)[k] = v;
+            }
+            assert_same(a.intersect(b), ei, "intersect");
+            assert_same(a.difference(b), ed, "difference");
+
+            assert_same(a.union_with(a), ea, "union -- self");
+            assert_same(a.intersect(a), ea, "intersect -- self");
+            assert(a.difference(a).size() == 0, "difference -- self");
+        }
+    }
+
+    template <typename Policy>
+    void test_erase(int n) {
+        using Map = AVLMap<int, int, Policy>;
+        std::default_random_engine e{};
+        std::map<int, int> expect;
+        auto m = random_map<Policy>(e, n, n, expect);
+        std::vector<std::pair<Map, std::map<int, int>>> kept;
+
+        for (int i = 0; i < n; ++i) {
+            int k = std::uniform_int_distribution<int>(0, n)(e);
+            if (i % 3 == 0) {
+                m = m.erase(k);
+            }
+            else {
+                m = std::move(m).erase(k);
+            }
+            expect.erase(k);
+            if (i % 50 == 0) {
+                assert_same(m, expect, "erase");
+                kept.emplace_back(m, expect);
+            }
+            if (i % 4 == 0) {
+                m = std::move(m).insert(k + 1, i);
+                expect[k + 1] = i;
+            }
+        }
+        for (auto &[old, old_expect] : kept) {
+            assert_same(old, old_expect, "erase -- kept version");
+        }
+
+        auto same = m.erase(-1);
+        assert(same.size() == m.size(), "erase -- absent key");
+
+        auto t = m.transient();
+        for (auto &[k, v] : expect) {
+            t.erase(k);
+        }
+        assert(t.size() == 0, "transient erase");
+        assert_same(m, expect, "transient erase -- source untouched");
+    }
+
+    template <typename Policy>
+    void test_iterate(int n) {
+        std::default_random_engine e{};
+        std::map<int, int> expect;
+        auto m = random_map<Policy>(e, n, n * 2, expect);
+
+        auto it = m.begin();
+        for (auto &[k, v] : expect) {
+            assert(it != m.end() && it->first == k && (*it).second == v, "iterate");
+            ++it;
+        }
+        assert(it == m.end(), "iterate -- end");
+
+        auto rit = m.rbegin();
+        for (auto eit = expect.rbegin(); eit != expect.rend(); ++eit, ++rit) {
+            assert(rit != m.rend() && (*rit).first == eit->first, "iterate -- reverse");
+        }
+        assert(rit == m.rend(), "iterate -- rend");
+
+        for (int k = -1; k <= n * 2 + 1; ++k) {
+            auto lo = m.lower_bound(k);
+            auto hi = m.upper_bound(k);
+            auto elo = expect.lower_bound(k);
+            auto ehi = expect.upper_bound(k);
+            assert(elo == expect.end() ? lo == m.end() : lo.key() == elo->first, "lower bound");
+            assert(ehi == expect.end() ? hi == m.end() : hi.key() == ehi->first, "upper bound");
+            if (lo != m.begin()) {
+                assert((--lo).key() == std::prev(elo)->first, "lower bound -- prev");
+            }
+        }
+
+        for (int lo = -1; lo <= n * 2; lo += n / 7 + 1) {
+            int hi = lo + n / 3;
+            auto eit = expect.lower_bound(lo);
+            for (auto [k, v] : m.range(lo, hi)) {
+                assert(eit != expect.end() && k == eit->first && v == eit->second, "range");
+                ++eit;
+            }
+            assert(eit == expect.lower_bound(hi), "range -- end");
+        }
+
+        AVLMap<int, int, Policy> empty;
+        assert(empty.begin() == empty.end() && empty.lower_bound(0) == empty.end(), "iterate -- empty");
+    }
+
+    template <typename Map>
+    void assert_diff(const Map &before, const Map &after, const std::map<int, int> &eb, const std::map<int, int> &ea) {
+        auto d = Map::diff(before, after);
+        std::vector<std::pair<int, int>> removed, added;
+        std::vector<std::tuple<int, int, int>> changed, got_changed;
+        for (auto &[k, v] : eb) {
+            auto it = ea.find(k);
+            if (it == ea.end()) {
+                removed.emplace_back(k, v);
+            }
+            else if (it->second != v) {
+                changed.emplace_back(k, v, it->second);
+            }
+        }
+        for (auto &[k, v] : ea) {
+            if (!eb.count(k)) {
+                added.emplace_back(k, v);
+            }
+        }
+        for (auto &c : d.changed) {
+            got_changed.emplace_back(c.key, c.before, c.after);
+        }
+        assert(d.removed == removed && d.added == added && got_changed == changed, "diff");
+    }
+
+    template <typename Policy>
+    void test_diff(int n) {
+        using Map = AVLMap<int, int, Policy>;
+        std::default_random_engine e{};
+        std::map<int, int> expect;
+        auto m = random_map<Policy>(e, n, n * 2, expect);
+
+        for (int round = 0; round < 20; ++round) {
+            auto before = m;
+            auto eb = expect;
+            int edits = std::uniform_int_distribution<int>(0, 1 << (round % 8))(e);
+            for (int i = 0; i < edits; ++i) {
+                int k = std::uniform_int_distribution<int>(0, n * 2)(e);
+                if (e() % 3 == 0) {
+                    m = m.erase(k);
+                    expect.erase(k);
+                }
+                else {
+                    int v = e() % 4;
+                    m = m.insert(k, v);
+                    expect[k] = v;
+                }
+            }
+            assert_diff(before, m, eb, expect);
+            assert_diff(m, before, expect, eb);
+        }
+
+        // nothing shared
+        std::map<int, int> other;
+        auto unrelated = random_map<Policy>(e, n, n * 2, other);
+        assert_diff(m, unrelated, expect, other);
+        assert_diff(Map{}, m, {}, expect);
+        assert_diff(m, Map{}, expect, {});
+    }
+
+    struct SumPolicy: DefaultPolicy {
+        using Augment = SumAugment<long long>;
+    };
+
+    // polynomial hash of the key sequence, so combining out of order shows up
+    struct SequenceHash {
+        struct type {
+            unsigned long long hash, pow;
+        };
+
+        static type identity() {
+            return {0, 1};
+        }
+
+        static type of(int key, long long) {
+            return {(unsigned long long)key + 1, 1000003};
+        }
+
+        static type combine(type a, type b) {
+            return {a.hash * b.pow + b.hash, a.pow * b.pow};
+        }
+    };
+
+    struct HashPolicy: DefaultPolicy {
+        using Augment = SequenceHash;
+    };
+
+    bool same_summary(long long a, long long b) {
+        return a == b;
+    }
+
+    bool same_summary(SequenceHash::type a, SequenceHash::type b) {
+        return a.hash == b.hash && a.pow == b.pow;
+    }
+
+    bool same_summary(NoAugment::type, NoAugment::type) {
+        return true;
+    }
+
+    template <typename Policy>
+    void test_rank_aggregate(int n) {
+        using Map = AVLMap<int, long long, Policy>;
+        using Augment = typename Policy::Augment;
+        std::default_random_engine e{};
+        std::map<int, long long> expect;
+        std::vector<std::pair<Map, std::map<int, long long>>> kept;
+        Map m;
+
+        for (int i = 0; i < n; ++i) {
+            int k = std::uniform_int_distribution<int>(0, n / 2)(e);
+            switch (i % 5) {
+            case 0:
+                m = m.erase(k);
+                expect.erase(k);
+                break;
+            case 1:
+                m = std::move(m).erase(k);
+                expect.erase(k);
+                break;
+            case 2:
+                m = m.insert(k, i);
+                expect[k] = i;
+                break;
+            default:
+                m = std::move(m).insert(k, i);
+                expect[k] = i;
+                break;
+            }
+            if (i % (n / 8 + 1) == 0) {
+                kept.emplace_back(m, expect);
+            }
+        }
+        kept.emplace_back(m, expect);
+
+        for (auto &[m, expect] : kept) {
+            assert(m.verify() && m.size() == expect.size(), "augment -- verify");
+            size_t i = 0;
+            for (auto &[k, v] : expect) {
+                assert(m.rank(k) == i && m.rank(k + 1) == i + 1, "rank");
+                assert(*m.nth(i) == v && m.select(i).key() == k, "nth");
+                ++i;
+            }
+            assert(!m.nth(i) && m.select(i) == m.end(), "nth -- past the end");
+
+            for (int lo = -1; lo <= n / 2 + 1; lo += n / 40 + 1) {
+                for (int hi = lo; hi <= n / 2 + 2; hi += n / 20 + 1) {
+                    auto want = Augment::identity();
+                    for (auto it = expect.lower_bound(lo); it != expect.lower_bound(hi); ++it) {
+                        want = Augment::combine(want, Augment::of(it->first, it->second));
+                    }
+                    assert(same_summary(m.aggregate(lo, hi), want), "aggregate");
+                }
+            }
+        }
+
+        // the other ways of building a tree have to maintain the summary too
+        std::map<int, long long> other;
+        auto a = random_map<Policy>(e, n, n, expect);
+        auto b = random_map<Policy>(e, n, n, other);
+        auto u = a.union_with(b);
+        auto all = Augment::identity();
+        for (auto [k, v] : u) {
+            all = Augment::combine(all, Augment::of(k, v));
+        }
+        assert(same_summary(u.aggregate(), all), "aggregate -- union");
+    }
+
+    struct StatsPolicy: DefaultPolicy {
+        using Stats = CountingStats;
+    };
+
+    void test_stats(int n) {
+        using Map = AVLMap<int, int, StatsPolicy>;
+        auto &c = CountingStats::local();
+        CountingStats::reset();
+
+        // ascending keys only ever lean right
+        Map m;
+        for (int i = 0; i < n; ++i) {
+            m = std::move(m).insert(i, i);
+        }
+        assert(c.ops[0] == (size_t)n && c.nodes_copied == 0, "stats -- in place");
+        assert(c.rotations[(int)Rotation::rr] > 0 && c.rotations[(int)Rotation::ll] == 0, "stats -- rotations");
+        assert(c.early_breaks > 0, "stats -- early breaks");
+        assert(m.sharing().nodes == (size_t)n && m.sharing().shared == 0, "sharing -- unique");
+
+        // every insert into a kept version copies its whole path
+        CountingStats::reset();
+        auto kept = m;
+        assert(m.sharing().shared == (size_t)n, "sharing -- copy");
+        auto next = m.insert(n, n);
+        size_t copies = 0, paths = 0;
+        for (int i = 0; i < CountingStats::buckets; ++i) {
+            copies += c.copies[0][i] * i;
+            paths += c.path_length[0][i] * i;
+        }
+        assert(c.ops[0] == 1 && copies == c.nodes_copied && copies + 1 >= paths && copies > 0, "stats -- copies");
+        auto s = next.sharing();
+        assert(s.nodes == (size_t)n + 1 && s.shared > 0 && s.shared < s.nodes, "sharing -- path copy");
+
+        next = next.erase(n / 2);
+        assert(c.ops[1] == 1, "stats -- erase");
+
+        char buf[4096];
+        FILE *f = fmemopen(buf, sizeof buf, "w");
+        CountingStats::dump_json(f);
+        fclose(f);
+        assert(strstr(buf, "\"rotations\": {\"ll\": 0") && strstr(buf, "\"copies_per_op\""), "stats -- json");
+    }
+
+    struct ParallelPolicy: ThreadSafePolicy {
+        static constexpr size_t parallel_cutoff = 64;
+    };
+
+    // versions built on one thread and released on another hand pool blocks across threads
+    void test_cross_thread_release(int n) {
+        using Map = AVLMap<int, int, ThreadSafePolicy>;
+        std::vector<Map> maps(4);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&maps, t, n] {
+                for (int i = 0; i < n; ++i) {
+                    maps[t] = maps[t].insert(i * 4 + t, i);
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        for (int t = 0; t < 4; ++t) {
+            assert(maps[t].size() == (size_t)n && maps[t].verify(), "cross thread -- build");
+            maps[t] = Map{};
+        }
+        Map m;
+        for (int i = 0; i < n; ++i) {
+            m = m.insert(i, i);
+        }
+        assert(m.verify(), "cross thread -- reuse");
+    }
+
+    struct HeapPolicy: DefaultPolicy {
+        using Alloc = HeapAlloc;
+    };
+
+    // batches of every size around the lane count, hits and misses, against find
+    template <typename Map>
+    void test_find_many(int n) {
+        std::default_random_engine e{};
+        Map m;
+        std::vector<const int *> out;
+        assert(Map{}.find_many(std::vector<int>{1, 2, 3}) == std::vector<const int *>(3), "find many -- empty map");
+        for (int i = 0; i < n; ++i) {
+            m = std::move(m).insert(e() % (4 * n), i);
+        }
+        for (int len : {0, 1, 15, 16, 17, 100, n}) {
+            std::vector<int> keys(len);
+            for (auto &k : keys) {
+                k = e() % (4 * n);
+            }
+            if (len > 2) {
+                keys[1] = keys[0];
+            }
+            out.assign(len + 1, &len);
+            m.find_many(keys.data(), len, out.data());
+            for (int i = 0; i < len; ++i) {
+                assert(out[i] == m.find(keys[i]), "find many -- same as find");
+            }
+            assert(out[len] == &len, "find many -- stays in bounds");
+        }
+    }
+
+    // counts its comparisons
+    struct Tick {
+        static inline size_t compared = 0;
+        long t;
+
+        friend bool operator<(const Tick &a, const Tick &b) {
+            ++compared;
+            return a.t < b.t;
+        }
+    };
+
+    template <typename Map>
+    void assert_same(const Map &m, const std::map<long, int> &expect, const char *msg) {
+        assert(m.verify() && m.size() == expect.size(), msg);
+        auto it = expect.begin();
+        for (auto [key, val] : m) {
+            assert(key.t == it->first && val == it->second, msg);
+            ++it;
+        }
+    }
+
+    // appends, late arrivals and kept versions, through the map and a transient
+    void test_push_back(int n) {
+        using Map = AVLMap<Tick, int>;
+        std::default_random_engine e{};
+        std::vector<std::pair<Map, std::map<long, int>>> kept;
+        Map m;
+        std::map<long, int> expect;
+        long now = 0;
+        for (int i = 0; i < n; ++i) {
+            long t = e() % 8 == 0 ? now - e() % 50 : now += 1 + e() % 3;
+            m = i % 2 ? m.push_back({t}, i) : std::move(m).push_back({t}, i);
+            expect[t] = i;
+            if (i % 97 == 0) {
+                kept.emplace_back(m, expect);
+            }
+        }
+        assert_same(m, expect, "push back -- map");
+        for (auto &[old, old_expect] : kept) {
+            assert_same(old, old_expect, "push back -- kept version");
+        }
+
+        auto t = m.transient();
+        for (int i = 0; i < n; ++i) {
+            long key = e() % 8 == 0 ? now - e() % 50 : now += 1 + e() % 3;
+            if (e() % 16 == 0) {
+                t.erase({key - 5});
+                expect.erase(key - 5);
+            }
+            t.push_back({key}, -i);
+            expect[key] = -i;
+            if (i == n / 2) {
+                auto copy = t;
+                copy.insert({now + 1}, 0);
+                copy.erase({key});
+                assert(t.find({key}) && !t.find({now + 1}), "push back -- copied transient");
+            }
+        }
+        assert_same(std::move(t).persistent(), expect, "push back -- transient");
+        assert_same(kept.back().first, kept.back().second, "push back -- version under the transient");
+
+        // both copies of a transient written to while the other is alive;
+        // the nodes under their roots are shared, so neither may resume
+        // its finger into them
+        auto first = Map{}.transient();
+        std::map<long, int> first_expect;
+        for (int i = 0; i < 100; ++i) {
+            first.insert({i}, i);
+            first_expect[i] = i;
+        }
+        auto second = first;
+        auto second_expect = first_expect;
+        second.insert({-1}, 1);
+        second_expect[-1] = 1;
+        for (int i = 100; i < 110; ++i) {
+            first.insert({i}, i);
+            first_expect[i] = i;
+            second.insert({i + 100}, i);
+            second_expect[i + 100] = i;
+        }
+        assert_same(std::move(second).persistent(), second_expect, "push back -- written copy");
+        assert_same(std::move(first).persistent(), first_expect, "push back -- written original");
+
+        // an append costs a few comparisons, not one per level
+        auto appends = Map{}.transient();
+        Tick::compared = 0;
+        for (int i = 0; i < n; ++i) {
+            appends.push_back({i}, i);
+        }
+        assert(Tick::compared < (size_t)n * 8, "push back -- comparisons");
+        Tick::compared = 0;
+        Map spine;
+        for (int i = 0; i < n; ++i) {
+            spine = std::move(spine).push_back({i}, i);
+        }
+        assert(Tick::compared <= (size_t)n && spine.verify(), "push back -- map comparisons");
+    }
+
+    // separately built versions end up sharing nodes; interned nodes are
+    // copied rather than changed when a version is updated in place
+    void test_hash_consing(int n) {
+        using Map = AVLMap<int, int>;
+        auto numbers = distinct_numbers(n);
+        std::vector<std::pair<int, int>> sorted;
+        for (int i = 0; i < n; ++i) {
+            sorted.emplace_back(numbers[i], i);
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        Map::InternTable table;
+        Map a = Map::from_sorted(sorted.begin(), sorted.end()).hash_consed(table);
+        Map b = Map::from_sorted(sorted.begin(), sorted.end()).hash_consed(table);
+        assert(a.same_tree(b) && table.size() == (size_t)n, "hash consing -- identical versions");
+        assert(a.hash_consed(table).same_tree(a), "hash consing -- idempotent");
+
+        std::vector<Map> versions;
+        for (int i = 0; i < 50; ++i) {
+            Map v = Map::from_sorted(sorted.begin(), sorted.end());
+            for (int j = 0; j < 5; ++j) {
+                v = std::move(v).insert(sorted[(i * 97 + j * 31) % n].first, -i);
+            }
+            versions.push_back(v.hash_consed(table));
+        }
+        assert(table.size() < (size_t)n + 50 * 5 * 48, "hash consing -- shared paths");
+        for (auto &v : versions) {
+            assert(v.verify() && v.size() == (size_t)n && v.sharing().shared == v.size(), "hash consing -- versions");
+        }
+
+        Map c = std::move(a).insert(numbers[0], -1).erase(numbers[1]);
+        assert(c.verify() && *c.find(numbers[0]) == -1 && !c.find(numbers[1]), "hash consing -- update");
+        assert(b.verify() && *b.find(numbers[0]) == 0 && *b.find(numbers[1]) == 1, "hash consing -- interned untouched");
+        std::map<int, int> expect(sorted.begin(), sorted.end());
+        assert(std::equal(b.begin(), b.end(), expect.begin(),
+                          [](auto x, const auto &y) { return x.first == y.first && x.second == y.second; }),
+               "hash consing -- interned contents");
+
+        versions.clear();
+        assert(table.sweep() > 0 && table.size() == (size_t)n, "hash consing -- sweep versions");
+        a = b = c = Map{};
+        assert(table.sweep() == (size_t)n && table.size() == 0, "hash consing -- sweep all");
+    }
+
+    struct DeferredPolicy: DefaultPolicy {
+        using Reclaim = DeferredReclaim;
+    };
+
+    // a dropped node keeps its children until the reclaim queue drains, yet
+    // sweep must not wait for that
+    void test_sweep_deferred(int n) {
+        using Map = AVLMap<int, int, DeferredPolicy>;
+        std::vector<std::pair<int, int>> sorted;
+        for (int i = 0; i < n; ++i) {
+            sorted.emplace_back(i, i);
+        }
+        Map::InternTable table;
+        Map a = Map::from_sorted(sorted.begin(), sorted.end()).hash_consed(table);
+        Map b = a.insert(n / 2, -1).erase(0).hash_consed(table);
+        size_t interned = table.size();
+        assert(interned > (size_t)n, "sweep deferred -- interned");
+
+        b = Map{};
+        assert(table.sweep() > 0 && table.size() == (size_t)n, "sweep deferred -- one version");
+        a = Map{};
+        assert(table.sweep() == (size_t)n && table.size() == 0, "sweep deferred -- empty in one pass");
+        DeferredReclaim::drain();
+        assert(DeferredReclaim::pending() == 0, "sweep deferred -- drained");
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000;
+    _test::test_insert<DefaultPolicy>(n);
+    _test::test_insert<ThreadSafePolicy>(n);
+    _test::test_insert<_test::HeapPolicy>(n);
+    _test::test_insert_in_place<DefaultPolicy>(n * 10);
+    _test::test_insert_in_place<ThreadSafePolicy>(n * 10);
+    _test::test_insert_in_place<_test::HeapPolicy>(n);
+    _test::test_from_sorted<DefaultPolicy>(n * 10);
+    _test::test_insert_sorted_batch<DefaultPolicy>(n * 10);
+    _test::test_insert_sorted_batch<_test::HeapPolicy>(n);
+    _test::test_erase<DefaultPolicy>(n * 10);
+    _test::test_erase<ThreadSafePolicy>(n);
+    _test::test_erase<_test::HeapPolicy>(n);
+    _test::test_split_join<DefaultPolicy>(n);
+    _test::test_set_operations<DefaultPolicy>(n * 10);
+    _test::test_set_operations<_test::ParallelPolicy>(n * 10);
+    _test::test_iterate<DefaultPolicy>(n * 10);
+    _test::test_rank_aggregate<DefaultPolicy>(n);
+    _test::test_diff<DefaultPolicy>(n * 10);
+    _test::test_stats(n);
+    _test::test_rank_aggregate<_test::SumPolicy>(n * 10);
+    _test::test_rank_aggregate<_test::HashPolicy>(n * 10);
+    _test::test_cross_thread_release(n * 10);
+    _test::test_hash_consing(n);
+    _test::test_sweep_deferred(n);
+    _test::test_push_back(n * 10);
+    _test::test_find_many<AVLMap<int, int>>(n * 10);
+}
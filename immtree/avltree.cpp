@@ -6,49 +6,60 @@
 #include <array>
 #include <map>
 
+#include "rc.h"
 
-template<typename T>
-using Rc = std::shared_ptr<T>;
 
-template <typename K, typename V>
+template <typename K, typename V, typename RC = LocalCount>
 struct AVLNode {
+    using RefCount = RC;
+
+    mutable typename RefCount::type refs{1};
     int height;
+    size_t count;   // nodes in this subtree
     K key;
     V val;
-    Rc<AVLNode<K, V>> left, right;
+    Rc<AVLNode<K, V, RC>> left, right;
 
-    AVLNode(int height, K key, V val, Rc<AVLNode<K, V>> left, Rc<AVLNode<K, V>> right):
+    AVLNode(int height, size_t count, K key, V val, Rc<AVLNode<K, V, RC>> left, Rc<AVLNode<K, V, RC>> right):
         height{height},
+        count{count},
         key{std::move(key)},
         val{std::move(val)},
         left{std::move(left)},
         right{std::move(right)} {}
 
-    AVLNode(K key, V val, Rc<AVLNode<K, V>> left=nullptr, Rc<AVLNode<K, V>> right=nullptr):
+    AVLNode(K key, V val, Rc<AVLNode<K, V, RC>> left=nullptr, Rc<AVLNode<K, V, RC>> right=nullptr):
         height{1 + std::max(left ? left->height : 0, right ? right->height : 0)},
+        count{1 + (left ? left->count : 0) + (right ? right->count : 0)},
         key{std::move(key)},
         val{std::move(val)},
         left{std::move(left)},
         right{std::move(right)} {}
-    
+
+    static void destroy(AVLNode *node) {
+        delete node;
+    }
+
     void update_height_without_null_check() {
         height = std::max(left->height, right->height) + 1;
+        count = left->count + right->count + 1;
     }
 
     void update_height_with_null_check() {
         height = std::max(left ? left->height : 0, right ? right->height : 0) + 1;
+        count = (left ? left->count : 0) + (right ? right->count : 0) + 1;
     }
 };
 
 
-template <typename K, typename V>
-inline int get_height(const Rc<AVLNode<K, V>> &node) {
+template <typename K, typename V, typename RC>
+inline int get_height(const Rc<AVLNode<K, V, RC>> &node) {
     return node ? node->height : 0;
 }
 
 
-template <typename K, typename V>
-inline Rc<AVLNode<K, V>> rewrite_ll(Rc<AVLNode<K, V>> root, Rc<AVLNode<K, V>> l, Rc<AVLNode<K, V>> ll) {
+template <typename K, typename V, typename RC>
+inline Rc<AVLNode<K, V, RC>> rewrite_ll(Rc<AVLNode<K, V, RC>> root, Rc<AVLNode<K, V, RC>> l, Rc<AVLNode<K, V, RC>> ll) {
     auto &c = l->right;
 
     root->left = std::move(c);
@@ -61,8 +72,8 @@ inline Rc<AVLNode<K, V>> rewrite_ll(Rc<AVLNode<K, V>> root, Rc<AVLNode<K, V>> l,
     return l;
 }
 
-template <typename K, typename V>
-inline Rc<AVLNode<K, V>> rewrite_lr(Rc<AVLNode<K, V>> root, Rc<AVLNode<K, V>> l, Rc<AVLNode<K, V>> lr) {
+template <typename K, typename V, typename RC>
+inline Rc<AVLNode<K, V, RC>> rewrite_lr(Rc<AVLNode<K, V, RC>> root, Rc<AVLNode<K, V, RC>> l, Rc<AVLNode<K, V, RC>> lr) {
     auto &b = lr->left;
     auto &c = lr->right;
 
@@ -80,8 +91,8 @@ inline Rc<AVLNode<K, V>> rewrite_lr(Rc<AVLNode<K, V>> root, Rc<AVLNode<K, V>> l,
 }
 
 
-template <typename K, typename V>
-inline Rc<AVLNode<K, V>> rewrite_rl(Rc<AVLNode<K, V>> root, Rc<AVLNode<K, V>> r, Rc<AVLNode<K, V>> rl) {
+template <typename K, typename V, typename RC>
+inline Rc<AVLNode<K, V, RC>> rewrite_rl(Rc<AVLNode<K, V, RC>> root, Rc<AVLNode<K, V, RC>> r, Rc<AVLNode<K, V, RC>> rl) {
     auto &b = rl->left;
     auto &c = rl->right;
 
@@ -98,8 +109,8 @@ inline Rc<AVLNode<K, V>> rewrite_rl(Rc<AVLNode<K, V>> root, Rc<AVLNode<K, V>> r,
     return rl;
 }
 
-template <typename K, typename V>
-inline Rc<AVLNode<K, V>> rewrite_rr(Rc<AVLNode<K, V>> root, Rc<AVLNode<K, V>> r, Rc<AVLNode<K, V>> rr) {
+template <typename K, typename V, typename RC>
+inline Rc<AVLNode<K, V, RC>> rewrite_rr(Rc<AVLNode<K, V, RC>> root, Rc<AVLNode<K, V, RC>> r, Rc<AVLNode<K, V, RC>> rr) {
     auto &b = r->left;
 
     root->right = std::move(b);
@@ -113,33 +124,34 @@ inline Rc<AVLNode<K, V>> rewrite_rr(Rc<AVLNode<K, V>> root, Rc<AVLNode<K, V>> r,
 }
 
 
-template <typename K, typename V>
-Rc<AVLNode<K, V>> insert(AVLNode<K, V> *root, K key, V val) {
-    Rc<AVLNode<K, V>> *path[48];
+template <typename K, typename V, typename RC>
+Rc<AVLNode<K, V, RC>> insert(AVLNode<K, V, RC> *root, K key, V val) {
+    using Node = AVLNode<K, V, RC>;
+    Rc<Node> *path[48];
     int n = 0;
-    Rc<AVLNode<K, V>> new_root = nullptr;
+    Rc<Node> new_root = nullptr;
     auto ptr = &new_root;
 
     while (root) {
         if (key < root->key) {
-            *ptr = std::make_shared<AVLNode<K, V>>(root->height, root->key, root->val, nullptr, root->right);
+            *ptr = Rc<Node>::adopt(new Node(root->height, root->count, root->key, root->val, nullptr, root->right));
             path[n++] = ptr;
             ptr = &(*ptr)->left;
             root = root->left.get();
         }
         else if (root->key < key) {
-            *ptr = std::make_shared<AVLNode<K, V>>(root->height, root->key, root->val, root->left, nullptr);
+            *ptr = Rc<Node>::adopt(new Node(root->height, root->count, root->key, root->val, root->left, nullptr));
             path[n++] = ptr;
             ptr = &(*ptr)->right;
             root = root->right.get();
         }
         else {
-            *ptr = std::make_shared<AVLNode<K, V>>(root->height, std::move(key), std::move(val), root->left, root->right);
+            *ptr = Rc<Node>::adopt(new Node(root->height, root->count, std::move(key), std::move(val), root->left, root->right));
             return new_root;
         }
     }
 
-    *ptr = std::make_shared<AVLNode<K, V>>(std::move(key), std::move(val));
+    *ptr = Rc<Node>::adopt(new Node(std::move(key), std::move(val)));
     if (n == 0) {
         return *ptr;
     }
@@ -202,14 +214,19 @@ Rc<AVLNode<K, V>> insert(AVLNode<K, V> *root, K key, V val) {
             }
         }
     }
+    // a rotation that kept the height ends the loop early; above it only the
+    // counts are stale
+    while (n-- > 0) {
+        ++(*path[n])->count;
+    }
     return new_root;
 }
 
 
 
-template <typename K, typename V>
-int size(Rc<AVLNode<K, V>> avl) {
-    return avl ? 1 + size(avl->left) + size(avl->right) : 0;
+template <typename K, typename V, typename RC>
+int size(const Rc<AVLNode<K, V, RC>> &avl) {
+    return avl ? avl->count : 0;
 }
 
 #include <vector>
@@ -217,10 +234,11 @@ int size(Rc<AVLNode<K, V>> avl) {
 #include <unordered_set>
 
 
-using TestNode = Rc<AVLNode<int, int>>;
+template <typename RC = LocalCount>
+using TestNode = Rc<AVLNode<int, int, RC>>;
 
 
-void print_avl_helper(TestNode avl) {
+void print_avl_helper(const TestNode<> &avl) {
     if (avl) {
         print_avl_helper(avl->left);
         printf("%d ", avl->key);
@@ -228,7 +246,7 @@ void print_avl_helper(TestNode avl) {
     }
 }
 
-void print_avl(TestNode avl) {
+void print_avl(const TestNode<> &avl) {
     print_avl_helper(avl);
     putc('\n', stdout);
     fflush(stdout);
@@ -239,10 +257,12 @@ namespace _test {
     void assert(bool x, const char *msg) {
         if (!x) {
             fprintf(stderr, "%s\n", msg); fflush(stderr);
+            abort();
         }
     }
     
-    void validate_order(TestNode root, int64_t low=INT64_MIN, int64_t high=INT64_MAX) {
+    template <typename RC>
+    void validate_order(const TestNode<RC> &root, int64_t low=INT64_MIN, int64_t high=INT64_MAX) {
         if (root) {
             assert(low < (int64_t)root->key && (int64_t)root->key < high, "order error\n");
             if (root->left) {
@@ -254,22 +274,25 @@ namespace _test {
         }
     }
 
-    int validate_height(TestNode root) {
+    template <typename RC>
+    int validate_height(const TestNode<RC> &root) {
         if (!root) {
             return 0;
         }
         assert(root->height == 1 + std::max(validate_height(root->left), validate_height(root->right)), "height");
         assert(std::abs(get_height(root->left) - get_height(root->right)) <= 1, "balance");
+        assert(size(root) == 1 + size(root->left) + size(root->right), "count");
         return root->height;
     }
 
 
+    template <typename RC>
     void test_insert(int n) {
-        std::vector<TestNode> trees(1, nullptr);
+        std::vector<TestNode<RC>> trees(1, nullptr);
         std::default_random_engine e{};
 
         std::unordered_set<int> numbers_set;
-        while (numbers_set.size() < n) {
+        while (numbers_set.size() < (size_t)n) {
             numbers_set.insert(e());
         }
         std::vector<int> numbers(numbers_set.begin(), numbers_set.end());
@@ -283,13 +306,15 @@ namespace _test {
             assert(size(avl_with_same_key) == i + 1, "size -- insert same");
             validate_order(avl_with_same_key);
             validate_height(avl_with_same_key);
-
-            for (int j = 0; j < trees.size(); ++j) {
-                auto avl = trees[j];
-                assert(size(avl) == j, "size");
-                validate_order(avl);
-                validate_height(avl);
-            }
+            assert(size(new_avl) == i + 1, "size");
+            validate_order(new_avl);
+            validate_height(new_avl);
+        }
+        // inserting must leave the old versions alone; a sample of them is enough
+        for (size_t j = 0; j < trees.size(); j += 7) {
+            assert(size(trees[j]) == (int)j, "size -- old version");
+            validate_order(trees[j]);
+            validate_height(trees[j]);
         }
     }
 }
@@ -297,6 +322,7 @@ namespace _test {
 
 int main(int argc, char **argv) {
     int n = atoi(argv[1]);
-    _test::test_insert(n);
+    _test::test_insert<LocalCount>(n);
+    _test::test_insert<AtomicCount>(n);
 }
 
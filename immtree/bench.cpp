@@ -0,0 +1,529 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "avl.h"
+#include "rb.h"
+#include "rbmap.h"
+
+
+// Counts every heap allocation, so std::map and the pools' slabs show up too.
+// Kept out of line so GCC does not pair the inlined malloc/free with new/delete.
+namespace heap {
+    std::atomic<size_t> allocations{0};
+    std::atomic<size_t> live_bytes{0};
+    constexpr size_t header = alignof(std::max_align_t);
+}
+
+[[gnu::noinline]] void *operator new(size_t size) {
+    auto p = static_cast<char *>(malloc(size + heap::header));
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast<size_t *>(p) = size;
+    heap::allocations.fetch_add(1, std::memory_order_relaxed);
+    heap::live_bytes.fetch_add(size, std::memory_order_relaxed);
+    return p + heap::header;
+}
+
+[[gnu::noinline]] void operator delete(void *p) noexcept {
+    if (p) {
+        auto b = static_cast<char *>(p) - heap::header;
+        heap::live_bytes.fetch_sub(*reinterpret_cast<size_t *>(b), std::memory_order_relaxed);
+        free(b);
+    }
+}
+
+[[gnu::noinline]] void operator delete(void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+
+namespace bench {
+
+    using Clock = std::chrono::steady_clock;
+
+    size_t allocations() {
+        return heap::allocations.load() + pool_stats().allocations.load();
+    }
+
+    // bytes held by live nodes: pool blocks in use plus heap memory other than slabs
+    size_t memory() {
+        return heap::live_bytes.load() - pool_stats().slab_bytes.load() + pool_stats().live_bytes.load();
+    }
+
+    // Bijection on [0, 2^31), so distinct ranks give distinct, scattered keys.
+    int scramble(uint64_t x) {
+        return (int)((x * 2654435761u) & 0x7fffffff);
+    }
+
+    // Zipf over [0, n) with skew theta, as in YCSB (Gray et al.)
+    class Zipf {
+        double n, theta, alpha, zetan, eta;
+
+    public:
+        explicit Zipf(size_t n, double theta = 0.99): n(n), theta(theta) {
+            double zeta2 = 1 + std::pow(0.5, theta);
+            zetan = 0;
+            for (size_t i = 1; i <= n; ++i) {
+                zetan += 1 / std::pow((double)i, theta);
+            }
+            alpha = 1 / (1 - theta);
+            eta = (1 - std::pow(2 / this->n, 1 - theta)) / (1 - zeta2 / zetan);
+        }
+
+        size_t operator()(std::mt19937_64 &e) {
+            double u = std::uniform_real_distribution<double>(0, 1)(e);
+            double uz = u * zetan;
+            if (uz < 1) {
+                return 0;
+            }
+            if (uz < 1 + std::pow(0.5, theta)) {
+                return 1;
+            }
+            return std::min<size_t>(n - 1, (size_t)(n * std::pow(eta * u - eta + 1, alpha)));
+        }
+    };
+
+    enum class Pattern { sequential, random, zipf };
+
+    const char *pattern_name(Pattern p) {
+        return p == Pattern::sequential ? "seq" : p == Pattern::random ? "random" : "zipf";
+    }
+
+    // n keys in insertion order: each key once for seq and random, skewed repeats for zipf
+    std::vector<int> insert_keys(Pattern p, size_t n, Zipf *zipf) {
+        std::mt19937_64 e{1};
+        std::vector<int> keys(n);
+        for (size_t i = 0; i < n; ++i) {
+            keys[i] = p == Pattern::zipf ? scramble((*zipf)(e)) : p == Pattern::random ? scramble(i) : (int)i;
+        }
+        if (p == Pattern::random) {
+            std::shuffle(keys.begin(), keys.end(), e);
+        }
+        return keys;
+    }
+
+    // n lookups: ascending for seq, uniform or skewed over the inserted keys otherwise
+    std::vector<int> lookup_keys(Pattern p, size_t n, Zipf *zipf) {
+        std::mt19937_64 e{2};
+        std::vector<int> keys(n);
+        for (size_t i = 0; i < n; ++i) {
+            keys[i] = p == Pattern::zipf ? scramble((*zipf)(e))
+                    : p == Pattern::random ? scramble(std::uniform_int_distribution<size_t>(0, n - 1)(e))
+                    : (int)i;
+        }
+        return keys;
+    }
+
+    struct Result {
+        const char *structure;
+        size_t n;
+        Pattern pattern;
+        const char *op;
+        size_t ops;
+        double seconds;
+        double p99_ns;          // NaN for whole-structure operations
+        size_t allocations;
+        double bytes_per_entry; // NaN where it does not apply
+    };
+
+    void print_header() {
+        printf("%-6s %11s %-7s %-9s %10s %10s %10s %12s\n",
+               "struct", "n", "keys", "op", "Mops/s", "p99 ns", "allocs/op", "bytes/entry");
+    }
+
+    void print(const Result &r) {
+        char p99[32] = "-", bytes[32] = "-";
+        if (!std::isnan(r.p99_ns)) {
+            snprintf(p99, sizeof p99, "%.0f", r.p99_ns);
+        }
+        if (!std::isnan(r.bytes_per_entry)) {
+            snprintf(bytes, sizeof bytes, "%.1f", r.bytes_per_entry);
+        }
+        printf("%-6s %11zu %-7s %-9s %10.3f %10s %10.2f %12s\n",
+               r.structure, r.n, pattern_name(r.pattern), r.op,
+               r.ops / r.seconds / 1e6, p99, (double)r.allocations / r.ops, bytes);
+        fflush(stdout);
+    }
+
+    // Runs op(i) for i in [0, ops). Every stride-th call is timed on its own
+    // for the latency percentile, the rest only count towards throughput.
+    template <typename F>
+    void measure(Result &r, size_t ops, F &&op) {
+        size_t stride = std::max<size_t>(1, ops / 100000);
+        std::vector<double> samples;
+        samples.reserve(ops / stride + 1);
+
+        size_t allocs = allocations();
+        auto start = Clock::now();
+        for (size_t i = 0; i < ops; ++i) {
+            if (i % stride == 0) {
+                auto t = Clock::now();
+                op(i);
+                samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - t).count());
+            }
+            else {
+                op(i);
+            }
+        }
+        r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        r.allocations = allocations() - allocs;
+        r.ops = ops;
+
+        auto p99 = samples.begin() + samples.size() * 99 / 100;
+        std::nth_element(samples.begin(), p99, samples.end());
+        r.p99_ns = samples.empty() ? NAN : *p99;
+    }
+
+    template <typename F>
+    void measure_once(Result &r, size_t ops, F &&op) {
+        size_t allocs = allocations();
+        auto start = Clock::now();
+        op();
+        r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        r.allocations = allocations() - allocs;
+        r.ops = ops;
+        r.p99_ns = NAN;
+    }
+
+
+    // Adapters with the same surface for every structure under test.
+
+    template <typename Map>
+    struct Persistent {
+        Map m;
+
+        void insert(int k, int v) {
+            m = m.insert(k, v);
+        }
+
+        bool find(int k) const {
+            return m.find(k) != nullptr;
+        }
+
+        // in batches of the size a request handler would resolve
+        size_t find_many(const std::vector<int> &keys) const {
+            const int *out[256];
+            size_t found = 0;
+            for (size_t at = 0; at < keys.size(); at += 256) {
+                size_t n = std::min<size_t>(256, keys.size() - at);
+                m.find_many(keys.data() + at, n, out);
+                for (size_t i = 0; i < n; ++i) {
+                    found += out[i] != nullptr;
+                }
+            }
+            return found;
+        }
+
+        void erase(int k) {
+            m = m.erase(k);
+        }
+
+        size_t iterate() const {
+            size_t sum = 0;
+            for (auto [k, v] : m) {
+                sum += k + v;
+            }
+            return sum;
+        }
+
+        void build(const std::vector<std::pair<int, int>> &kvs, const std::vector<int> &) {
+            m = Map::from_sorted(kvs.begin(), kvs.end());
+        }
+
+        size_t size() const {
+            return m.size();
+        }
+
+        Map version() const {
+            return m;
+        }
+    };
+
+    struct Avl: Persistent<AVLMap<int, int>> {
+        static constexpr const char *name = "avl";
+    };
+
+    struct RbMap: Persistent<RBMap<int, int>> {
+        static constexpr const char *name = "rbmap";
+    };
+
+    struct RbTree {
+        static constexpr const char *name = "rb";
+        Rb m;
+
+        void insert(int k, int) {
+            m = ::insert(m, k);
+        }
+
+        bool find(int k) const {
+            return contains(m, k);
+        }
+
+        void erase(int k) {
+            m = remove(m, k);
+        }
+
+        static size_t walk(const RbNode *node) {
+            return node ? walk(node->left.get()) + node->key + walk(node->right.get()) : 0;
+        }
+
+        size_t iterate() const {
+            return walk(m.get());
+        }
+
+        void build(const std::vector<std::pair<int, int>> &, const std::vector<int> &keys) {
+            m = from_sorted(keys.begin(), keys.end());
+        }
+
+        size_t size() const {
+            return ::size(m);
+        }
+
+        Rb version() const {
+            return m;
+        }
+    };
+
+    struct StdMap {
+        static constexpr const char *name = "std";
+        std::map<int, int> m;
+
+        void insert(int k, int v) {
+            m[k] = v;
+        }
+
+        bool find(int k) const {
+            return m.find(k) != m.end();
+        }
+
+        void erase(int k) {
+            m.erase(k);
+        }
+
+        size_t iterate() const {
+            size_t sum = 0;
+            for (auto &[k, v] : m) {
+                sum += k + v;
+            }
+            return sum;
+        }
+
+        void build(const std::vector<std::pair<int, int>> &kvs, const std::vector<int> &) {
+            m = std::map<int, int>(kvs.begin(), kvs.end());
+        }
+
+        size_t size() const {
+            return m.size();
+        }
+
+        // std::map has no sharing, keeping a version means copying it
+        std::map<int, int> version() const {
+            return m;
+        }
+    };
+
+
+    template <typename S, typename = void>
+    struct HasFindMany: std::false_type {};
+
+    template <typename S>
+    struct HasFindMany<S, std::void_t<decltype(&S::find_many)>>: std::true_type {};
+
+    volatile size_t sink = 0;   // keeps results alive so the loops are not optimised away
+
+    template <typename S>
+    void run(size_t n, Pattern pattern, Zipf *zipf, size_t retained_versions) {
+        auto inserts = insert_keys(pattern, n, zipf);
+        auto lookups = lookup_keys(pattern, n, zipf);
+        Result r{S::name, n, pattern, "", 0, 0, NAN, 0, NAN};
+
+        {
+            S s;
+            size_t base = memory();
+            r.op = "insert";
+            measure(r, n, [&](size_t i) { s.insert(inserts[i], (int)i); });
+            r.bytes_per_entry = (double)(memory() - base) / s.size();
+            print(r);
+            r.bytes_per_entry = NAN;
+
+            r.op = "find";
+            size_t found = 0;
+            measure(r, n, [&](size_t i) { found += s.find(lookups[i]); });
+            sink += found;
+            print(r);
+
+            if constexpr (HasFindMany<S>::value) {
+                r.op = "find_many";
+                measure_once(r, n, [&] { sink += s.find_many(lookups); });
+                print(r);
+            }
+
+            r.op = "iterate";
+            size_t entries = s.size();
+            measure_once(r, entries, [&] { sink += s.iterate(); });
+            print(r);
+
+            r.op = "erase";
+            measure(r, n, [&](size_t i) { s.erase(inserts[i]); });
+            print(r);
+        }
+
+        {
+            std::vector<int> keys = inserts;
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+            std::vector<std::pair<int, int>> kvs;
+            kvs.reserve(keys.size());
+            for (int k : keys) {
+                kvs.emplace_back(k, k);
+            }
+
+            S s;
+            size_t base = memory();
+            r.op = "build";
+            measure_once(r, keys.size(), [&] { s.build(kvs, keys); });
+            r.bytes_per_entry = (double)(memory() - base) / keys.size();
+            print(r);
+            r.bytes_per_entry = NAN;
+        }
+
+        if (retained_versions > 0) {
+            // inserts keeping every (n / versions)-th version alive
+            S s;
+            std::vector<decltype(s.version())> versions;
+            versions.reserve(retained_versions);
+            size_t every = std::max<size_t>(1, n / retained_versions);
+            size_t base = memory();
+            r.op = "retain";
+            measure(r, n, [&](size_t i) {
+                s.insert(inserts[i], (int)i);
+                if (i % every == every - 1 && versions.size() < retained_versions) {
+                    versions.push_back(s.version());
+                }
+            });
+            r.bytes_per_entry = (double)(memory() - base) / s.size();
+            print(r);
+            r.bytes_per_entry = NAN;
+        }
+    }
+
+    std::vector<std::string> split_list(const char *s) {
+        std::vector<std::string> out;
+        std::string cur;
+        for (; *s; ++s) {
+            if (*s == ',') {
+                out.push_back(cur);
+                cur.clear();
+            }
+            else {
+                cur += *s;
+            }
+        }
+        out.push_back(cur);
+        return out;
+    }
+
+    void usage(const char *prog) {
+        fprintf(stderr,
+                "usage: %s [--sizes N,...] [--keys seq,random,zipf] [--structs avl,rbmap,rb,std]\n"
+                "          [--versions V] [--max-copy-size N]\n"
+                "  --versions       versions kept alive by the retain run (default 64, 0 to skip)\n"
+                "  --max-copy-size  largest n for which std::map copies versions (default 1000000)\n",
+                prog);
+        exit(2);
+    }
+}
+
+
+int main(int argc, char **argv) {
+    using namespace bench;
+    std::vector<size_t> sizes{1000, 100000, 1000000};
+    std::vector<Pattern> patterns{Pattern::sequential, Pattern::random, Pattern::zipf};
+    std::vector<std::string> structs{"avl", "rbmap", "rb", "std"};
+    size_t versions = 64;
+    size_t max_copy_size = 1000000;
+
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const char *arg = argv[i], *val = argv[++i];
+        if (!strcmp(arg, "--sizes")) {
+            sizes.clear();
+            for (auto &s : split_list(val)) {
+                sizes.push_back(strtoull(s.c_str(), nullptr, 10));
+            }
+        }
+        else if (!strcmp(arg, "--keys")) {
+            patterns.clear();
+            for (auto &s : split_list(val)) {
+                if (s == "seq") {
+                    patterns.push_back(Pattern::sequential);
+                }
+                else if (s == "random") {
+                    patterns.push_back(Pattern::random);
+                }
+                else if (s == "zipf") {
+                    patterns.push_back(Pattern::zipf);
+                }
+                else {
+                    usage(argv[0]);
+                }
+            }
+        }
+        else if (!strcmp(arg, "--structs")) {
+            structs = split_list(val);
+        }
+        else if (!strcmp(arg, "--versions")) {
+            versions = strtoull(val, nullptr, 10);
+        }
+        else if (!strcmp(arg, "--max-copy-size")) {
+            max_copy_size = strtoull(val, nullptr, 10);
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    print_header();
+    for (size_t n : sizes) {
+        if (n == 0 || n > (size_t(1) << 31)) {
+            usage(argv[0]);
+        }
+        std::unique_ptr<Zipf> zipf;
+        for (Pattern p : patterns) {
+            if (p == Pattern::zipf && !zipf) {
+                zipf = std::make_unique<Zipf>(n);
+            }
+            for (auto &s : structs) {
+                if (s == "avl") {
+                    run<Avl>(n, p, zipf.get(), versions);
+                }
+                else if (s == "rbmap") {
+                    run<RbMap>(n, p, zipf.get(), versions);
+                }
+                else if (s == "rb") {
+                    run<RbTree>(n, p, zipf.get(), versions);
+                }
+                else if (s == "std") {
+                    run<StdMap>(n, p, zipf.get(), n <= max_copy_size ? versions : 0);
+                }
+                else {
+                    usage(argv[0]);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,140 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "map.h"
+
+
+namespace _test {
+
+    void assert(bool x, const char *msg) {
+        if (!x) {
+            fprintf(stderr, "%s\n", msg); fflush(stderr);
+            abort();
+        }
+    }
+
+    template <typename Map, typename K>
+    void assert_same(const Map &m, const std::map<K, int> &expect, const char *msg) {
+        assert(m.size() == expect.size() && m.verify(), msg);
+        for (auto &[k, v] : expect) {
+            assert(m.find_default(k, -1) == v, msg);
+        }
+    }
+
+    template <typename K>
+    K make_key(int x) {
+        if constexpr (std::is_same_v<K, std::string>) {
+            char buf[16];
+            snprintf(buf, sizeof buf, "%08d", x);
+            return buf;
+        }
+        else {
+            return K(x);
+        }
+    }
+
+    // same random workload against std::map, keeping some old versions
+    template <typename Map, typename K>
+    void test_random_ops(int n) {
+        std::default_random_engine e{};
+        std::map<K, int> expect;
+        std::vector<std::pair<Map, std::map<K, int>>> kept;
+        Map m;
+
+        for (int i = 0; i < n; ++i) {
+            K k = make_key<K>(std::uniform_int_distribution<int>(0, n / 2)(e));
+            switch (e() % 4) {
+            case 0:
+                m = m.insert(k, i);
+                expect[k] = i;
+                break;
+            case 1:
+                m = std::move(m).insert(k, i);
+                expect[k] = i;
+                break;
+            case 2:
+                m = m.erase(k);
+                expect.erase(k);
+                break;
+            default:
+                m = std::move(m).erase(k);
+                expect.erase(k);
+                break;
+            }
+            if (i % (n / 20 + 1) == 0) {
+                assert_same(m, expect, "random ops");
+                kept.emplace_back(m, expect);
+            }
+        }
+        for (auto &[old, old_expect] : kept) {
+            assert_same(old, old_expect, "random ops -- kept version");
+        }
+    }
+
+    template <typename Map>
+    void test_iterate(int n) {
+        std::vector<std::pair<int, int>> kvs;
+        for (int i = 0; i < n; ++i) {
+            kvs.emplace_back(i * 2, i);
+        }
+        auto m = Map::from_sorted(kvs.begin(), kvs.end());
+        assert(m.size() == (size_t)n && m.verify(), "from sorted");
+
+        int i = 0;
+        for (auto [k, v] : m) {
+            assert(k == i * 2 && v == i, "iterate");
+            ++i;
+        }
+        assert(i == n, "iterate -- count");
+
+        for (auto it = m.end(); it != m.begin();) {
+            --it;
+            --i;
+            assert(it->first == i * 2, "iterate -- reverse");
+        }
+
+        for (int k = -1; k <= n * 2; ++k) {
+            auto lo = m.lower_bound(k);
+            auto hi = m.upper_bound(k);
+            int expect_lo = k < 0 ? 0 : (k + 1) / 2;
+            int expect_hi = k < 0 ? 0 : k / 2 + 1;
+            assert(expect_lo >= n ? lo == m.end() : lo.key() == expect_lo * 2, "lower bound");
+            assert(expect_hi >= n ? hi == m.end() : hi.key() == expect_hi * 2, "upper bound");
+        }
+
+        i = n;
+        for (auto it = m.rbegin(); it != m.rend(); ++it) {
+            assert((*it).first == --i * 2, "iterate -- rbegin");
+        }
+        i = n / 4;
+        for (auto [k, v] : m.range(n / 2 - 1, n)) {
+            assert(k == i * 2 && v == i, "range");
+            ++i;
+        }
+        assert(i == n / 2, "range -- end");
+    }
+
+    template <int Fanout>
+    struct SmallNodes {
+        template <typename K, typename V, typename Policy>
+        using Map = BTreeMap<K, V, Policy, Fanout>;
+    };
+}
+
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000;
+    _test::test_random_ops<PersistentMap<int, int, AVLMap>, int>(n * 10);
+    _test::test_random_ops<PersistentMap<int, int, BTreeMap>, int>(n * 10);
+    _test::test_random_ops<PersistentMap<int, int, RBMap>, int>(n * 10);
+    _test::test_random_ops<PersistentMap<int, int, _test::SmallNodes<4>::Map>, int>(n * 10);
+    _test::test_random_ops<PersistentMap<int64_t, int, _test::SmallNodes<6>::Map>, int64_t>(n * 10);
+    _test::test_random_ops<PersistentMap<std::string, int, _test::SmallNodes<4>::Map>, std::string>(n);
+    _test::test_random_ops<PersistentMap<int, int, BTreeMap, ThreadSafePolicy>, int>(n);
+    _test::test_iterate<BTreeMap<int, int>>(n * 10);
+    _test::test_iterate<BTreeMap<int, int, DefaultPolicy, 4>>(n);
+}
@@ -0,0 +1,792 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "policy.h"
+
+
+// Number of keys[i] <= key among the n sorted keys, i.e. upper_bound. Nodes
+// are small enough that for plain arithmetic keys a branchless scan over the
+// whole array beats binary search; other key types use binary search.
+template <typename K>
+inline int count_not_greater(const K *keys, int n, const K &key) {
+    if constexpr (std::is_arithmetic_v<K>) {
+        int count = 0;
+        for (int i = 0; i < n; ++i) {
+            count += !(key < keys[i]);
+        }
+        return count;
+    }
+    else {
+        return std::upper_bound(keys, keys + n, key) - keys;
+    }
+}
+
+#if defined(__SSE2__)
+inline int count_not_greater(const int32_t *keys, int n, const int32_t &key) {
+    int count = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i k8 = _mm256_set1_epi32(key);
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        count += 8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, k8))));
+    }
+#endif
+    __m128i k4 = _mm_set1_epi32(key);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+        count += 4 - __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k4))));
+    }
+    for (; i < n; ++i) {
+        count += keys[i] <= key;
+    }
+    return count;
+}
+#endif
+
+#if defined(__SSE4_2__)
+inline int count_not_greater(const int64_t *keys, int n, const int64_t &key) {
+    int count = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i k4 = _mm256_set1_epi64x(key);
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        count += 4 - __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, k4))));
+    }
+#endif
+    __m128i k2 = _mm_set1_epi64x(key);
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+        count += 2 - __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, k2))));
+    }
+    for (; i < n; ++i) {
+        count += keys[i] <= key;
+    }
+    return count;
+}
+#endif
+
+
+// Persistent B+-tree with the same interface as AVLMap. Every node holds up
+// to Fanout sorted keys in one array, leaves hold the values next to them and
+// inner nodes the children, so a lookup touches one node per level and a
+// write copies log_Fanout(n) nodes. Keys and values must be default
+// constructible. Keys of inner nodes are lower bounds of their child,
+// keys[0] is unused.
+template <typename K, typename V, typename Policy = DefaultPolicy, int Fanout = 32>
+class BTreeMap {
+    static_assert(Fanout >= 4 && Fanout % 2 == 0, "Fanout must be even and at least 4");
+
+    static constexpr int min_fill = Fanout / 2;
+
+    static constexpr int floor_log2(int x) {
+        int r = 0;
+        while (x > 1) {
+            x /= 2;
+            ++r;
+        }
+        return r;
+    }
+
+    // Below the root every node holds at least min_fill entries, so a tree
+    // of d levels has at least 2 * min_fill^(d-1) of them; bounds the
+    // iterator's stack for any size_t count.
+    static constexpr int max_depth = 2 + 64 / floor_log2(min_fill);
+
+    struct Leaf;
+    struct Inner;
+
+    struct Node {
+        using RefCount = typename Policy::RefCount;
+
+        mutable typename RefCount::type refs{1};
+        int n;
+        bool leaf;
+
+        Node(int n, bool leaf): n{n}, leaf{leaf} {}
+
+        static void destroy(Node *node) {
+            Policy::Reclaim::retire(node);
+        }
+
+        static void free(Node *node) {
+            if (node->leaf) {
+                Policy::Alloc::destroy(static_cast<Leaf *>(node));
+            }
+            else {
+                Policy::Alloc::destroy(static_cast<Inner *>(node));
+            }
+        }
+
+        template <typename F>
+        void drop_children(F &&f) {
+            if (leaf) {
+                return;
+            }
+            for (auto &link : static_cast<Inner *>(this)->children) {
+                Node *child = link.release();
+                if (child && RefCount::dec(child->refs)) {
+                    f(child);
+                }
+            }
+        }
+    };
+
+    struct Leaf: Node {
+        K keys[Fanout];
+        V vals[Fanout];
+
+        Leaf(): Node{0, true} {}
+
+        Leaf(const Leaf &other): Node{other.n, true} {
+            std::copy(other.keys, other.keys + other.n, keys);
+            std::copy(other.vals, other.vals + other.n, vals);
+        }
+    };
+
+    struct Inner: Node {
+        K keys[Fanout];
+        Rc<Node> children[Fanout];
+
+        Inner(): Node{0, false} {}
+
+        Inner(const Inner &other): Node{other.n, false} {
+            std::copy(other.keys, other.keys + other.n, keys);
+            std::copy(other.children, other.children + other.n, children);
+        }
+
+        int child_index(const K &key) const {
+            return count_not_greater(keys + 1, this->n - 1, key);
+        }
+    };
+
+    Rc<Node> root;
+    size_t _size;
+
+    BTreeMap(Rc<Node> root, size_t size): root{std::move(root)}, _size{size} {}
+
+public:
+    class iterator;
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+
+    struct Range {
+        iterator first, last;
+
+        iterator begin() const {
+            return first;
+        }
+
+        iterator end() const {
+            return last;
+        }
+    };
+
+    BTreeMap(): root{}, _size{0} {}
+
+    BTreeMap insert(K key, V val) const & {
+        auto new_root = root;
+        bool inserted = insert_at(new_root, key, val);
+        return BTreeMap{std::move(new_root), _size + inserted};
+    }
+
+    BTreeMap insert(K key, V val) && {
+        _size += insert_at(root, key, val);
+        return std::move(*this);
+    }
+
+    BTreeMap erase(const K &key) const & {
+        auto new_root = root;
+        bool erased = erase_at(new_root, key);
+        return BTreeMap{std::move(new_root), _size - erased};
+    }
+
+    BTreeMap erase(const K &key) && {
+        _size -= erase_at(root, key);
+        return std::move(*this);
+    }
+
+    // [first, last) yields pairs with strictly increasing keys; O(n)
+    template <typename It>
+    static BTreeMap from_sorted(It first, It last) {
+        size_t n = std::distance(first, last);
+        return BTreeMap{build(first, n), n};
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    const V *find(const K &key) const {
+        return find(root.get(), key);
+    }
+
+    const V& find_default(const K &key, const V &default_value) const {
+        auto val = find(key);
+        return val ? *val : default_value;
+    }
+
+    iterator begin() const;
+    iterator end() const;
+    iterator lower_bound(const K &key) const;
+    iterator upper_bound(const K &key) const;
+
+    reverse_iterator rbegin() const {
+        return reverse_iterator{end()};
+    }
+
+    reverse_iterator rend() const {
+        return reverse_iterator{begin()};
+    }
+
+    // entries with lo <= key < hi
+    Range range(const K &lo, const K &hi) const {
+        return {lower_bound(lo), lower_bound(hi)};
+    }
+
+    // checks ordering, fill, depth and size of the whole tree, O(n)
+    bool verify() const {
+        if (!root) {
+            return _size == 0;
+        }
+        size_t n = 0;
+        int leaf_depth = -1;
+        return verify(root.get(), nullptr, nullptr, 0, leaf_depth, n) && n == _size;
+    }
+
+private:
+    static const V *find(const Node *node, const K &key) {
+        if (!node) {
+            return nullptr;
+        }
+        while (!node->leaf) {
+            auto inner = static_cast<const Inner *>(node);
+            node = inner->children[inner->child_index(key)].get();
+        }
+        auto leaf = static_cast<const Leaf *>(node);
+        int i = count_not_greater(leaf->keys, leaf->n, key);
+        return i > 0 && !(leaf->keys[i - 1] < key) ? &leaf->vals[i - 1] : nullptr;
+    }
+
+    static Rc<Node> mk_leaf() {
+        return Rc<Node>::adopt(Policy::Alloc::template create<Leaf>());
+    }
+
+    static Rc<Node> mk_inner() {
+        return Rc<Node>::adopt(Policy::Alloc::template create<Inner>());
+    }
+
+    static Leaf *as_leaf(const Rc<Node> &node) {
+        return static_cast<Leaf *>(node.get());
+    }
+
+    static Inner *as_inner(const Rc<Node> &node) {
+        return static_cast<Inner *>(node.get());
+    }
+
+    // replaces a shared node with a private copy so it can be modified
+    static Node *own(Rc<Node> &slot) {
+        if (!slot.unique()) {
+            if (slot->leaf) {
+                slot = Rc<Node>::adopt(Policy::Alloc::template create<Leaf>(*as_leaf(slot)));
+            }
+            else {
+                slot = Rc<Node>::adopt(Policy::Alloc::template create<Inner>(*as_inner(slot)));
+            }
+        }
+        return slot.get();
+    }
+
+    template <typename T>
+    static void shift_right(T *arr, int from, int n) {
+        std::move_backward(arr + from, arr + n, arr + n + 1);
+    }
+
+    template <typename T>
+    static void shift_left(T *arr, int from, int n) {
+        std::move(arr + from + 1, arr + n, arr + from);
+    }
+
+    static void leaf_insert(Leaf *leaf, int i, K &key, V &val) {
+        shift_right(leaf->keys, i, leaf->n);
+        shift_right(leaf->vals, i, leaf->n);
+        leaf->keys[i] = std::move(key);
+        leaf->vals[i] = std::move(val);
+        ++leaf->n;
+    }
+
+    static void inner_insert(Inner *inner, int i, K &key, Rc<Node> &child) {
+        shift_right(inner->keys, i, inner->n);
+        shift_right(inner->children, i, inner->n);
+        inner->keys[i] = std::move(key);
+        inner->children[i] = std::move(child);
+        ++inner->n;
+    }
+
+    // Inserts below `slot`. When the node there overflows it keeps the lower
+    // half and the upper half comes back through `split`, starting at `sep`.
+    static bool insert_rec(Rc<Node> &slot, K &key, V &val, bool &inserted, K &sep, Rc<Node> &split) {
+        if (slot->leaf) {
+            Leaf *leaf = static_cast<Leaf *>(slot.get());
+            int i = count_not_greater(leaf->keys, leaf->n, key);
+            if (i > 0 && !(leaf->keys[i - 1] < key)) {
+                static_cast<Leaf *>(own(slot))->vals[i - 1] = std::move(val);
+                inserted = false;
+                return false;
+            }
+            inserted = true;
+            leaf = static_cast<Leaf *>(own(slot));
+            if (leaf->n < Fanout) {
+                leaf_insert(leaf, i, key, val);
+                return false;
+            }
+
+            split = mk_leaf();
+            Leaf *right = as_leaf(split);
+            std::move(leaf->keys + min_fill, leaf->keys + Fanout, right->keys);
+            std::move(leaf->vals + min_fill, leaf->vals + Fanout, right->vals);
+            leaf->n = min_fill;
+            right->n = Fanout - min_fill;
+            if (i <= min_fill) {
+                leaf_insert(leaf, i, key, val);
+            }
+            else {
+                leaf_insert(right, i - min_fill, key, val);
+            }
+            sep = right->keys[0];
+            return true;
+        }
+
+        Inner *inner = static_cast<Inner *>(own(slot));
+        int i = inner->child_index(key);
+        K child_sep;
+        Rc<Node> child_split;
+        if (!insert_rec(inner->children[i], key, val, inserted, child_sep, child_split)) {
+            return false;
+        }
+        if (inner->n < Fanout) {
+            inner_insert(inner, i + 1, child_sep, child_split);
+            return false;
+        }
+
+        split = mk_inner();
+        Inner *right = as_inner(split);
+        std::move(inner->keys + min_fill, inner->keys + Fanout, right->keys);
+        std::move(inner->children + min_fill, inner->children + Fanout, right->children);
+        inner->n = min_fill;
+        right->n = Fanout - min_fill;
+        if (i + 1 <= min_fill) {
+            inner_insert(inner, i + 1, child_sep, child_split);
+        }
+        else {
+            inner_insert(right, i + 1 - min_fill, child_sep, child_split);
+        }
+        sep = right->keys[0];
+        return true;
+    }
+
+    static bool insert_at(Rc<Node> &slot, K &key, V &val) {
+        if (!slot) {
+            slot = mk_leaf();
+            leaf_insert(as_leaf(slot), 0, key, val);
+            return true;
+        }
+        bool inserted = false;
+        K sep;
+        Rc<Node> split;
+        if (insert_rec(slot, key, val, inserted, sep, split)) {
+            auto new_root = mk_inner();
+            Inner *inner = as_inner(new_root);
+            inner->keys[1] = std::move(sep);
+            inner->children[0] = std::move(slot);
+            inner->children[1] = std::move(split);
+            inner->n = 2;
+            slot = std::move(new_root);
+        }
+        return inserted;
+    }
+
+    // Children i and i + 1 of `parent` hold too few entries between them for
+    // one of them; merges them or evens them out.
+    static void rebalance_children(Inner *parent, int i) {
+        Node *a = own(parent->children[i]);
+        Node *b = own(parent->children[i + 1]);
+
+        if (a->leaf) {
+            Leaf *l = static_cast<Leaf *>(a);
+            Leaf *r = static_cast<Leaf *>(b);
+            if (l->n + r->n <= Fanout) {
+                std::move(r->keys, r->keys + r->n, l->keys + l->n);
+                std::move(r->vals, r->vals + r->n, l->vals + l->n);
+                l->n += r->n;
+                remove_child(parent, i + 1);
+                return;
+            }
+            int total = l->n + r->n;
+            int left_n = total / 2;
+            if (l->n > left_n) {
+                int moved = l->n - left_n;
+                std::move_backward(r->keys, r->keys + r->n, r->keys + r->n + moved);
+                std::move_backward(r->vals, r->vals + r->n, r->vals + r->n + moved);
+                std::move(l->keys + left_n, l->keys + l->n, r->keys);
+                std::move(l->vals + left_n, l->vals + l->n, r->vals);
+            }
+            else {
+                int moved = left_n - l->n;
+                std::move(r->keys, r->keys + moved, l->keys + l->n);
+                std::move(r->vals, r->vals + moved, l->vals + l->n);
+                std::move(r->keys + moved, r->keys + r->n, r->keys);
+                std::move(r->vals + moved, r->vals + r->n, r->vals);
+            }
+            l->n = left_n;
+            r->n = total - left_n;
+            parent->keys[i + 1] = r->keys[0];
+            return;
+        }
+
+        Inner *l = static_cast<Inner *>(a);
+        Inner *r = static_cast<Inner *>(b);
+        // the parent separator becomes the lower bound of r's first child
+        r->keys[0] = parent->keys[i + 1];
+        if (l->n + r->n <= Fanout) {
+            std::move(r->keys, r->keys + r->n, l->keys + l->n);
+            std::move(r->children, r->children + r->n, l->children + l->n);
+            l->n += r->n;
+            remove_child(parent, i + 1);
+            return;
+        }
+        int total = l->n + r->n;
+        int left_n = total / 2;
+        if (l->n > left_n) {
+            int moved = l->n - left_n;
+            std::move_backward(r->keys, r->keys + r->n, r->keys + r->n + moved);
+            std::move_backward(r->children, r->children + r->n, r->children + r->n + moved);
+            std::move(l->keys + left_n, l->keys + l->n, r->keys);
+            std::move(l->children + left_n, l->children + l->n, r->children);
+        }
+        else {
+            int moved = left_n - l->n;
+            std::move(r->keys, r->keys + moved, l->keys + l->n);
+            std::move(r->children, r->children + moved, l->children + l->n);
+            std::move(r->keys + moved, r->keys + r->n, r->keys);
+            std::move(r->children + moved, r->children + r->n, r->children);
+        }
+        l->n = left_n;
+        r->n = total - left_n;
+        parent->keys[i + 1] = r->keys[0];
+    }
+
+    static void remove_child(Inner *parent, int i) {
+        shift_left(parent->keys, i, parent->n);
+        shift_left(parent->children, i, parent->n);
+        parent->children[--parent->n] = nullptr;
+    }
+
+    // the key must be present below `slot`
+    static void erase_rec(Rc<Node> &slot, const K &key) {
+        Node *node = own(slot);
+        if (node->leaf) {
+            Leaf *leaf = static_cast<Leaf *>(node);
+            int i = count_not_greater(leaf->keys, leaf->n, key) - 1;
+            shift_left(leaf->keys, i, leaf->n);
+            shift_left(leaf->vals, i, leaf->n);
+            --leaf->n;
+            return;
+        }
+
+        Inner *inner = static_cast<Inner *>(node);
+        int i = inner->child_index(key);
+        erase_rec(inner->children[i], key);
+        if (inner->children[i]->n < min_fill) {
+            rebalance_children(inner, i > 0 ? i - 1 : i);
+        }
+    }
+
+    static bool erase_at(Rc<Node> &slot, const K &key) {
+        if (!find(slot.get(), key)) {
+            return false;
+        }
+        erase_rec(slot, key);
+        if (slot->n == 0) {
+            slot = nullptr;
+        }
+        else if (!slot->leaf && slot->n == 1) {
+            slot = Rc<Node>{as_inner(slot)->children[0]};
+        }
+        return true;
+    }
+
+    template <typename It>
+    static Rc<Node> build(It first, size_t n) {
+        if (n == 0) {
+            return nullptr;
+        }
+        // leaves filled as evenly as possible, then each level above the same way
+        size_t count = (n + Fanout - 1) / Fanout;
+        std::vector<Rc<Node>> level(count);
+        std::vector<K> lows(count);
+        for (size_t j = 0; j < count; ++j) {
+            int m = n / count + (j < n % count);
+            level[j] = mk_leaf();
+            Leaf *leaf = as_leaf(level[j]);
+            for (int i = 0; i < m; ++i, ++first) {
+                leaf->keys[i] = first->first;
+                leaf->vals[i] = first->second;
+            }
+            leaf->n = m;
+            lows[j] = leaf->keys[0];
+        }
+
+        while (count > 1) {
+            size_t parents = (count + Fanout - 1) / Fanout;
+            size_t next = 0;
+            for (size_t j = 0; j < parents; ++j) {
+                int m = count / parents + (j < count % parents);
+                auto node = mk_inner();
+                Inner *inner = as_inner(node);
+                for (int i = 0; i < m; ++i, ++next) {
+                    inner->keys[i] = lows[next];
+                    inner->children[i] = std::move(level[next]);
+                }
+                inner->n = m;
+                level[j] = std::move(node);
+                lows[j] = inner->keys[0];
+            }
+            count = parents;
+        }
+
+        return std::move(level[0]);
+    }
+
+    static bool verify(const Node *node, const K *low, const K *high, int depth, int &leaf_depth, size_t &n) {
+        if (node->n < 1 || node->n > Fanout || (depth > 0 && node->n < min_fill)) {
+            return false;
+        }
+        if (node->leaf) {
+            auto leaf = static_cast<const Leaf *>(node);
+            if (leaf_depth < 0) {
+                leaf_depth = depth;
+            }
+            for (int i = 0; i < leaf->n; ++i) {
+                if ((i > 0 && !(leaf->keys[i - 1] < leaf->keys[i])) ||
+                    (low && leaf->keys[i] < *low) || (high && !(leaf->keys[i] < *high))) {
+                    return false;
+                }
+            }
+            n += leaf->n;
+            return leaf_depth == depth;
+        }
+        auto inner = static_cast<const Inner *>(node);
+        for (int i = 0; i < inner->n; ++i) {
+            if (i > 1 && !(inner->keys[i - 1] < inner->keys[i])) {
+                return false;
+            }
+            const K *lo = i > 0 ? &inner->keys[i] : low;
+            const K *hi = i + 1 < inner->n ? &inner->keys[i + 1] : high;
+            if (!verify(inner->children[i].get(), lo, hi, depth + 1, leaf_depth, n)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+
+// Walks the tree with the path to the current entry on a fixed stack, so
+// iterating neither allocates nor touches reference counts. Iterators stay
+// valid as long as the version they come from.
+template <typename K, typename V, typename Policy, int Fanout>
+class BTreeMap<K, V, Policy, Fanout>::iterator {
+    friend class BTreeMap;
+
+    struct Frame {
+        const Node *node;
+        int i;
+    };
+
+    const Node *root = nullptr;
+    Frame stack[max_depth];
+    int depth = 0;     // 0 at end()
+
+    void descend_first(const Node *node) {
+        while (true) {
+            stack[depth++] = {node, 0};
+            if (node->leaf) {
+                return;
+            }
+            node = static_cast<const Inner *>(node)->children[0].get();
+        }
+    }
+
+    void descend_last(const Node *node) {
+        while (true) {
+            stack[depth++] = {node, node->n - 1};
+            if (node->leaf) {
+                return;
+            }
+            node = static_cast<const Inner *>(node)->children[node->n - 1].get();
+        }
+    }
+
+    const Leaf *leaf() const {
+        return static_cast<const Leaf *>(stack[depth - 1].node);
+    }
+
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::pair<const K &, const V &>;
+    using difference_type = std::ptrdiff_t;
+    using reference = value_type;
+
+    struct pointer {
+        value_type kv;
+
+        const value_type *operator->() const {
+            return &kv;
+        }
+    };
+
+    iterator() = default;
+
+    const K &key() const {
+        return leaf()->keys[stack[depth - 1].i];
+    }
+
+    const V &value() const {
+        return leaf()->vals[stack[depth - 1].i];
+    }
+
+    reference operator*() const {
+        return {key(), value()};
+    }
+
+    pointer operator->() const {
+        return {{key(), value()}};
+    }
+
+    iterator &operator++() {
+        if (++stack[depth - 1].i < stack[depth - 1].node->n) {
+            return *this;
+        }
+        --depth;
+        while (depth > 0 && ++stack[depth - 1].i >= stack[depth - 1].node->n) {
+            --depth;
+        }
+        if (depth > 0) {
+            auto inner = static_cast<const Inner *>(stack[depth - 1].node);
+            descend_first(inner->children[stack[depth - 1].i].get());
+        }
+        return *this;
+    }
+
+    iterator &operator--() {
+        if (depth == 0) {
+            if (root) {
+                descend_last(root);
+            }
+            return *this;
+        }
+        if (--stack[depth - 1].i >= 0) {
+            return *this;
+        }
+        --depth;
+        while (depth > 0 && --stack[depth - 1].i < 0) {
+            --depth;
+        }
+        if (depth > 0) {
+            auto inner = static_cast<const Inner *>(stack[depth - 1].node);
+            descend_last(inner->children[stack[depth - 1].i].get());
+        }
+        return *this;
+    }
+
+    iterator operator++(int) {
+        auto old = *this;
+        ++*this;
+        return old;
+    }
+
+    iterator operator--(int) {
+        auto old = *this;
+        --*this;
+        return old;
+    }
+
+    friend bool operator==(const iterator &a, const iterator &b) {
+        if (a.depth != b.depth) {
+            return false;
+        }
+        return a.depth == 0 || (a.stack[a.depth - 1].node == b.stack[b.depth - 1].node &&
+                                a.stack[a.depth - 1].i == b.stack[b.depth - 1].i);
+    }
+
+    friend bool operator!=(const iterator &a, const iterator &b) {
+        return !(a == b);
+    }
+};
+
+template <typename K, typename V, typename Policy, int Fanout>
+auto BTreeMap<K, V, Policy, Fanout>::begin() const -> iterator {
+    iterator it;
+    it.root = root.get();
+    if (root) {
+        it.descend_first(root.get());
+    }
+    return it;
+}
+
+template <typename K, typename V, typename Policy, int Fanout>
+auto BTreeMap<K, V, Policy, Fanout>::end() const -> iterator {
+    iterator it;
+    it.root = root.get();
+    return it;
+}
+
+template <typename K, typename V, typename Policy, int Fanout>
+auto BTreeMap<K, V, Policy, Fanout>::lower_bound(const K &key) const -> iterator {
+    iterator it;
+    it.root = root.get();
+    const Node *node = root.get();
+    if (!node) {
+        return it;
+    }
+    while (!node->leaf) {
+        auto inner = static_cast<const Inner *>(node);
+        int i = inner->child_index(key);
+        it.stack[it.depth++] = {node, i};
+        node = inner->children[i].get();
+    }
+    auto leaf = static_cast<const Leaf *>(node);
+    int i = count_not_greater(leaf->keys, leaf->n, key);
+    if (i > 0 && !(leaf->keys[i - 1] < key)) {
+        --i;
+    }
+    it.stack[it.depth++] = {node, i};
+    if (i == leaf->n) {
+        // the answer is the first entry of the next leaf, if any
+        it.stack[it.depth - 1].i = i - 1;
+        ++it;
+    }
+    return it;
+}
+
+template <typename K, typename V, typename Policy, int Fanout>
+auto BTreeMap<K, V, Policy, Fanout>::upper_bound(const K &key) const -> iterator {
+    auto it = lower_bound(key);
+    if (it != end() && !(key < it.key())) {
+        ++it;
+    }
+    return it;
+}
@@ -0,0 +1,99 @@
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "concurrent.h"
+
+
+namespace _test {
+
+    void assert(bool x, const char *msg) {
+        if (!x) {
+            fprintf(stderr, "%s\n", msg); fflush(stderr);
+            abort();
+        }
+    }
+
+    // Writers insert ascending keys of their own residue class, so every
+    // version a reader can see holds a prefix of each writer's keys.
+    void test_readers_and_writers(int n) {
+        const int writers = 4, readers = 4;
+        ConcurrentAVLMap<int, int> map;
+        std::atomic<int> done{0};
+        std::vector<std::thread> threads;
+
+        for (int w = 0; w < writers; ++w) {
+            threads.emplace_back([&map, &done, w, n] {
+                for (int i = 0; i < n; ++i) {
+                    map.insert(i * writers + w, i);
+                }
+                ++done;
+            });
+        }
+        for (int r = 0; r < readers; ++r) {
+            threads.emplace_back([&map, &done, n] {
+                size_t last_size = 0;
+                while (done.load() < writers) {
+                    bool ok = map.read([n](const ConcurrentAVLMap<int, int>::Map &m) {
+                        for (int w = 0; w < writers; ++w) {
+                            bool present = true;
+                            for (int i = 0; i < n; i += n / 16 + 1) {
+                                bool found = m.find(i * writers + w) != nullptr;
+                                if (found && !present) {
+                                    return false;
+                                }
+                                present = found;
+                            }
+                        }
+                        return true;
+                    });
+                    assert(ok, "reader -- prefix");
+                    size_t size = map.size();
+                    assert(size >= last_size, "reader -- size");
+                    last_size = size;
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        auto m = map.snapshot();
+        assert(m.size() == (size_t)n * writers && m.verify(), "writers -- all published");
+
+        // erases and batched updates race as well
+        threads.clear();
+        for (int w = 0; w < writers; ++w) {
+            threads.emplace_back([&map, w, n] {
+                for (int i = 0; i < n; i += 2) {
+                    map.erase(i * writers + w);
+                }
+                map.update([w, n](const ConcurrentAVLMap<int, int>::Map &m) {
+                    auto t = m.transient();
+                    for (int i = 1; i < n; i += 2) {
+                        t.insert(i * writers + w, -i);
+                    }
+                    return std::move(t).persistent();
+                });
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        m = map.snapshot();
+        assert(m.size() == (size_t)(n / 2) * writers && m.verify(), "erase -- size");
+        for (int k = 0; k < n * writers; ++k) {
+            int i = k / writers;
+            assert(map.find_default(k, 0) == (i % 2 ? -i : 0), "erase -- values");
+        }
+        EpochDomain::instance().synchronize();
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000;
+    _test::test_readers_and_writers(n * 2);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <utility>
+
+#include "avl.h"
+#include "epoch.h"
+
+
+// Multi-version map shared between threads. The current AVLMap version sits
+// behind one atomic pointer: readers run on whatever version is current when
+// they start, writers build the next version off to the side and publish it
+// with a compare-and-swap. Replaced versions are freed through EpochDomain,
+// so readers never touch the reference count of the root and never wait.
+template <typename K, typename V, typename Policy = ThreadSafePolicy>
+class ConcurrentAVLMap {
+    static_assert(Policy::RefCount::thread_safe, "versions are released on other threads");
+
+public:
+    using Map = AVLMap<K, V, Policy>;
+
+private:
+    struct Published {
+        Map map;
+
+        explicit Published(Map map): map{std::move(map)} {}
+
+        static void destroy(Published *p) {
+            Policy::Alloc::destroy(p);
+        }
+    };
+
+    std::atomic<Published *> current;
+
+    static Published *publish(Map map) {
+        return Policy::Alloc::template create<Published>(std::move(map));
+    }
+
+public:
+    ConcurrentAVLMap(): ConcurrentAVLMap(Map{}) {}
+
+    explicit ConcurrentAVLMap(Map initial): current{publish(std::move(initial))} {}
+
+    // no reader or writer may still be running
+    ~ConcurrentAVLMap() {
+        Published::destroy(current.load(std::memory_order_relaxed));
+    }
+
+    ConcurrentAVLMap(const ConcurrentAVLMap &) = delete;
+    ConcurrentAVLMap &operator=(const ConcurrentAVLMap &) = delete;
+
+    // Calls f(const Map &) on the current version and returns its result,
+    // which must not point into the map. Wait-free apart from f itself.
+    template <typename F>
+    decltype(auto) read(F &&f) const {
+        EpochDomain::Guard guard;
+        return f(current.load(std::memory_order_acquire)->map);
+    }
+
+    // a version to keep beyond a read(); bumps the root's reference count
+    Map snapshot() const {
+        return read([](const Map &map) { return map; });
+    }
+
+    size_t size() const {
+        return read([](const Map &map) { return map.size(); });
+    }
+
+    bool contains(const K &key) const {
+        return read([&key](const Map &map) { return map.find(key) != nullptr; });
+    }
+
+    V find_default(const K &key, const V &default_value) const {
+        return read([&](const Map &map) { return map.find_default(key, default_value); });
+    }
+
+    // Publishes f(current version) as the new version. If another writer
+    // publishes first, f runs again on the newer version, so it must not have
+    // side effects. Batching several changes into one f, e.g. through a
+    // Transient, makes them land together and costs a single publish.
+    template <typename F>
+    void update(F &&f) {
+        EpochDomain::Guard guard;
+        Published *cur = current.load(std::memory_order_acquire);
+        Published *next = publish(f(cur->map));
+        for (int failures = 0;
+             !current.compare_exchange_strong(cur, next, std::memory_order_acq_rel, std::memory_order_acquire);
+             ++failures) {
+            if (failures >= 4) {
+                std::this_thread::yield();
+            }
+            next->map = f(cur->map);
+        }
+        EpochDomain::instance().retire(cur);
+    }
+
+    void insert(K key, V val) {
+        update([&](const Map &map) { return map.insert(key, val); });
+    }
+
+    void erase(const K &key) {
+        update([&](const Map &map) { return map.erase(key); });
+    }
+};
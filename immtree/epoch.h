@@ -0,0 +1,197 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+
+// Epoch-based reclamation, one domain per process. Readers bracket their
+// accesses with enter/exit, which costs two stores to a slot only their own
+// thread writes. Writers hand unlinked objects to retire(); an object is
+// freed once the global epoch has moved twice past the epoch it was retired
+// in, and the epoch only moves when every thread inside a critical section
+// has seen the current one.
+//
+// That relies on a store-to-load order between a reader and a writer: a
+// reader stores its state and then loads the shared pointer, a writer
+// swaps the pointer and then scans the states, and at least one of them
+// must see the other's store. Acquire and release do not give that, so
+// both sides put a seq_cst fence between their store and their loads.
+class EpochDomain {
+    struct Retired {
+        void *p;
+        void (*free)(void *);
+        uint64_t epoch;
+    };
+
+    struct alignas(64) Record {
+        std::atomic<uint64_t> state{0};     // epoch seen on entry, 0 while outside
+        std::atomic<bool> in_use{true};
+        int nesting = 0;
+        size_t since_advance = 0;
+        std::vector<Retired> limbo;
+        Record *next = nullptr;
+    };
+
+    // a thread's record, handed back for reuse when the thread exits
+    struct Local {
+        EpochDomain *domain = nullptr;
+        Record *record = nullptr;
+
+        ~Local() {
+            if (record) {
+                domain->release(record);
+            }
+        }
+    };
+
+    EpochDomain() = default;
+
+    std::atomic<uint64_t> epoch{1};
+    std::atomic<Record *> records{nullptr};
+    std::mutex orphans_mu;
+    std::vector<Retired> orphans;   // left behind by exited threads
+
+    Record *record() {
+        static thread_local Local local;
+        if (!local.record) {
+            local.domain = this;
+            local.record = acquire();
+        }
+        return local.record;
+    }
+
+    Record *acquire() {
+        for (Record *r = records.load(std::memory_order_acquire); r; r = r->next) {
+            bool expected = false;
+            if (!r->in_use.load(std::memory_order_relaxed) &&
+                r->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                return r;
+            }
+        }
+        Record *r = new Record;
+        r->next = records.load(std::memory_order_relaxed);
+        while (!records.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        return r;
+    }
+
+    void release(Record *r) {
+        if (!r->limbo.empty()) {
+            std::lock_guard<std::mutex> lock{orphans_mu};
+            orphans.insert(orphans.end(), r->limbo.begin(), r->limbo.end());
+            r->limbo.clear();
+        }
+        r->in_use.store(false, std::memory_order_release);
+    }
+
+    void try_advance() {
+        // orders the caller's unlinking before the scan of the states
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t e = epoch.load();
+        for (Record *r = records.load(std::memory_order_acquire); r; r = r->next) {
+            uint64_t s = r->state.load();
+            if (s != 0 && s != e) {
+                return;
+            }
+        }
+        epoch.compare_exchange_strong(e, e + 1);
+    }
+
+    // frees what was retired at least two epochs ago
+    static void free_old(std::vector<Retired> &list, uint64_t now) {
+        size_t kept = 0;
+        for (auto &item : list) {
+            if (item.epoch + 2 <= now) {
+                item.free(item.p);
+            }
+            else {
+                list[kept++] = item;
+            }
+        }
+        list.resize(kept);
+    }
+
+    void collect(Record *r) {
+        try_advance();
+        uint64_t now = epoch.load();
+        free_old(r->limbo, now);
+
+        std::vector<Retired> ready;
+        if (orphans_mu.try_lock()) {
+            std::lock_guard<std::mutex> lock{orphans_mu, std::adopt_lock};
+            ready.swap(orphans);
+        }
+        free_old(ready, now);
+        if (!ready.empty()) {
+            std::lock_guard<std::mutex> lock{orphans_mu};
+            orphans.insert(orphans.end(), ready.begin(), ready.end());
+        }
+    }
+
+public:
+    // retirements per thread between attempts to advance the epoch
+    static constexpr size_t advance_every = 64;
+
+    // never destroyed, so threads exiting after main may still use it
+    static EpochDomain &instance() {
+        static EpochDomain *domain = new EpochDomain;
+        return *domain;
+    }
+
+    void enter() {
+        Record *r = record();
+        if (r->nesting++ == 0) {
+            r->state.store(epoch.load());
+            // orders the state before the reader's loads of shared pointers
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void exit() {
+        Record *r = record();
+        if (--r->nesting == 0) {
+            r->state.store(0, std::memory_order_release);
+        }
+    }
+
+    // Frees p with T::destroy once no thread can still see it. p must
+    // already be unreachable for threads entering from now on.
+    template <typename T>
+    void retire(T *p) {
+        Record *r = record();
+        r->limbo.push_back({p, [](void *p) { T::destroy(static_cast<T *>(p)); }, epoch.load()});
+        if (++r->since_advance >= advance_every) {
+            r->since_advance = 0;
+            collect(r);
+        }
+    }
+
+    // Frees everything that can be freed, advancing the epoch as far as the
+    // threads currently inside allow. Must not be called from inside.
+    void synchronize() {
+        Record *r = record();
+        for (int i = 0; i < 3; ++i) {
+            collect(r);
+        }
+    }
+
+    EpochDomain(const EpochDomain &) = delete;
+    EpochDomain &operator=(const EpochDomain &) = delete;
+
+    class Guard {
+    public:
+        Guard() {
+            instance().enter();
+        }
+
+        ~Guard() {
+            instance().exit();
+        }
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+    };
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Work-stealing pool for nested fork/join. invoke(f, g) offers g to the pool,
+// runs f itself and then either takes g back or, if g was stolen, helps with
+// other tasks until it is done. Each worker pops its own deque from the back
+// and steals from the front of the others; threads outside the pool share
+// one extra deque.
+class ForkJoinPool {
+    struct Task {
+        void (*run)(Task *);
+        std::atomic<bool> done{false};
+        std::exception_ptr error;
+    };
+
+    template <typename G>
+    struct TaskOf: Task {
+        G &g;
+
+        explicit TaskOf(G &g): g{g} {
+            this->run = [](Task *t) {
+                auto self = static_cast<TaskOf *>(t);
+                try {
+                    self->g();
+                }
+                catch (...) {
+                    self->error = std::current_exception();
+                }
+                self->done.store(true, std::memory_order_release);
+            };
+        }
+    };
+
+    struct Queue {
+        std::mutex mu;
+        std::deque<Task *> tasks;
+    };
+
+    std::vector<Queue> queues;  // one per worker, the last one for outside threads
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> pending{0};
+    std::mutex sleep_mu;
+    std::condition_variable wake;
+
+    static int &worker_index() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    Queue &own_queue() {
+        int i = worker_index();
+        return queues[i >= 0 ? i : queues.size() - 1];
+    }
+
+    void push(Task *t) {
+        auto &q = own_queue();
+        {
+            std::lock_guard<std::mutex> lock{q.mu};
+            q.tasks.push_back(t);
+        }
+        pending.fetch_add(1, std::memory_order_release);
+        wake.notify_one();
+    }
+
+    // takes t back if nobody stole it
+    bool take_back(Task *t) {
+        auto &q = own_queue();
+        std::lock_guard<std::mutex> lock{q.mu};
+        auto it = std::find(q.tasks.rbegin(), q.tasks.rend(), t);
+        if (it == q.tasks.rend()) {
+            return false;
+        }
+        q.tasks.erase(std::next(it).base());
+        pending.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    Task *find_task() {
+        auto &own = own_queue();
+        {
+            std::lock_guard<std::mutex> lock{own.mu};
+            if (!own.tasks.empty()) {
+                Task *t = own.tasks.back();
+                own.tasks.pop_back();
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                return t;
+            }
+        }
+        size_t start = std::max(worker_index(), 0);
+        for (size_t k = 0; k < queues.size(); ++k) {
+            auto &q = queues[(start + k) % queues.size()];
+            if (&q == &own) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock{q.mu};
+            if (!q.tasks.empty()) {
+                Task *t = q.tasks.front();
+                q.tasks.pop_front();
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                return t;
+            }
+        }
+        return nullptr;
+    }
+
+    void work(int index) {
+        worker_index() = index;
+        while (!stopping.load(std::memory_order_acquire)) {
+            if (Task *t = find_task()) {
+                t->run(t);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock{sleep_mu};
+            wake.wait_for(lock, std::chrono::milliseconds(1), [this] {
+                return stopping.load(std::memory_order_acquire) || pending.load(std::memory_order_acquire) > 0;
+            });
+        }
+    }
+
+public:
+    explicit ForkJoinPool(unsigned n_workers): queues(n_workers + 1) {
+        for (unsigned i = 0; i < n_workers; ++i) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~ForkJoinPool() {
+        stopping.store(true, std::memory_order_release);
+        wake.notify_all();
+        for (auto &w : workers) {
+            w.join();
+        }
+    }
+
+    ForkJoinPool(const ForkJoinPool &) = delete;
+    ForkJoinPool &operator=(const ForkJoinPool &) = delete;
+
+    static ForkJoinPool &instance() {
+        static ForkJoinPool pool{std::max(2u, std::thread::hardware_concurrency()) - 1};
+        return pool;
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    template <typename F, typename G>
+    void invoke(F &&f, G &&g) {
+        if (workers.empty()) {
+            f();
+            g();
+            return;
+        }
+
+        TaskOf<std::remove_reference_t<G>> task{g};
+        push(&task);
+        try {
+            f();
+        }
+        catch (...) {
+            if (!take_back(&task)) {
+                while (!task.done.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+            }
+            throw;
+        }
+
+        if (take_back(&task)) {
+            g();
+            return;
+        }
+        while (!task.done.load(std::memory_order_acquire)) {
+            if (Task *t = find_task()) {
+                t->run(t);
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+        if (task.error) {
+            std::rethrow_exception(task.error);
+        }
+    }
+};
@@ -0,0 +1,153 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include "map.h"
+
+
+// Random inserts, erases and lookups on each engine next to a std::map,
+// some of them through a transient where the engine has one.
+// The maps use CheckedPolicy, so every update also checks the path it
+// touched. Some versions are retained with a copy of the model and
+// compared in full from time to time; any difference aborts with the seed
+// and the step that found it. The seed is fixed unless given after the
+// number of steps.
+namespace _test {
+
+    using Model = std::map<int, int>;
+
+    unsigned seed;
+    long step;
+
+    void fail(const char *engine, const char *msg) {
+        fprintf(stderr, "%s: %s (seed %u, step %ld)\n", engine, msg, seed, step);
+        fflush(stderr);
+        abort();
+    }
+
+    template <typename Map>
+    void compare(const char *engine, const Map &m, const Model &expect, const char *what) {
+        if (!m.verify() || m.size() != expect.size()) {
+            fail(engine, what);
+        }
+        auto it = expect.begin();
+        for (auto [key, val] : m) {
+            if (key != it->first || val != it->second) {
+                fail(engine, what);
+            }
+            ++it;
+        }
+    }
+
+    // the map agrees with the model about key
+    template <typename Map>
+    bool agrees(const Map &m, const Model &expect, int key) {
+        auto found = m.find(key);
+        auto it = expect.find(key);
+        return it == expect.end() ? !found : found && *found == it->second;
+    }
+
+    template <typename Map, typename = void>
+    struct HasTransient: std::false_type {};
+
+    template <typename Map>
+    struct HasTransient<Map, std::void_t<decltype(std::declval<const Map &>().transient())>>: std::true_type {};
+
+    template <template <typename, typename, typename> class Engine>
+    void fuzz(const char *engine, long ops) {
+        using Map = PersistentMap<int, int, Engine, CheckedPolicy>;
+        constexpr long phase = 1 << 18, check_every = 1 << 16, retain_every = 1 << 12;
+        constexpr size_t retained_max = 16;
+
+        std::mt19937 e{seed};
+        Map m;
+        Model model;
+        std::vector<std::pair<Map, Model>> retained;
+        int key_range = 1;
+
+        for (step = 0; step < ops; ++step) {
+            // small trees churn near the root, big ones grow deep
+            if (step % phase == 0) {
+                key_range = 1 << (4 + e() % 14);
+            }
+            int key = e() % key_range;
+            unsigned op = e() % 16;
+
+            if (op < 7) {
+                int val = (int)e();
+                bool shared = op == 0;
+                Map before = shared ? m : Map{};
+                m = shared ? m.insert(key, val) : std::move(m).insert(key, val);
+                if (shared && !agrees(before, model, key)) {
+                    fail(engine, "insert changed the old version");
+                }
+                model[key] = val;
+            }
+            else if (op < 13) {
+                bool shared = op == 7;
+                Map before = shared ? m : Map{};
+                m = shared ? m.erase(key) : std::move(m).erase(key);
+                if (shared && !agrees(before, model, key)) {
+                    fail(engine, "erase changed the old version");
+                }
+                model.erase(key);
+            }
+            else if (op == 15 && HasTransient<Map>::value) {
+                // a run of nearby keys through a builder, which resumes
+                // each insert where the one before it went down
+                if constexpr (HasTransient<Map>::value) {
+                    auto t = std::move(m).transient();
+                    for (int i = 0; i < 16; ++i) {
+                        int k = key + (int)(e() % 64) - 32;
+                        int val = (int)e();
+                        if (e() % 4) {
+                            t.insert(k, val);
+                            model[k] = val;
+                        }
+                        else {
+                            t.erase(k);
+                            model.erase(k);
+                        }
+                    }
+                    m = std::move(t).persistent();
+                }
+            }
+            else if (!agrees(m, model, key)) {
+                fail(engine, "find");
+            }
+            if (m.size() != model.size()) {
+                fail(engine, "size");
+            }
+
+            if (step % retain_every == 0) {
+                if (retained.size() == retained_max) {
+                    retained.erase(retained.begin() + e() % retained_max);
+                }
+                retained.emplace_back(m, model);
+            }
+            if (step % check_every == 0) {
+                compare(engine, m, model, "head");
+                for (auto &[version, expect] : retained) {
+                    compare(engine, version, expect, "retained version");
+                }
+            }
+        }
+        compare(engine, m, model, "head");
+        for (auto &[version, expect] : retained) {
+            compare(engine, version, expect, "retained version");
+        }
+    }
+}
+
+
+int main(int argc, char **argv) {
+    long ops = argc > 1 ? atol(argv[1]) : 1000000;
+    _test::seed = argc > 2 ? (unsigned)atol(argv[2]) : 1;
+    printf("fuzz: %ld ops per engine, seed %u\n", ops, _test::seed);
+    _test::fuzz<AVLMap>("AVLMap", ops);
+    _test::fuzz<RBMap>("RBMap", ops);
+    _test::fuzz<BTreeMap>("BTreeMap", ops);
+}
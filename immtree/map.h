@@ -0,0 +1,13 @@
+#pragma once
+
+#include "avl.h"
+#include "btree.h"
+#include "rbmap.h"
+
+
+// AVLMap, BTreeMap and RBMap expose the same operations, so code written
+// against PersistentMap switches engines with one template argument.
+template <typename K, typename V,
+          template <typename, typename, typename> class Engine = AVLMap,
+          typename Policy = DefaultPolicy>
+using PersistentMap = Engine<K, V, Policy>;
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "rc.h"
+#include "pool.h"
+#include "reclaim.h"
+#include "stats.h"
+
+
+// Knobs shared by the persistent trees. Custom policies derive from one of
+// these and override the members they care about.
+
+// A monoid summarising the entries of a subtree, kept in every node of an
+// AVLMap next to the entry count. `of` maps one entry, `combine` must be
+// associative with `identity` as its unit; entries are combined in key order.
+struct NoAugment {
+    struct type {};
+
+    static type identity() {
+        return {};
+    }
+
+    template <typename K, typename V>
+    static type of(const K &, const V &) {
+        return {};
+    }
+
+    static type combine(type, type) {
+        return {};
+    }
+};
+
+// sum of the values
+template <typename T>
+struct SumAugment {
+    using type = T;
+
+    static type identity() {
+        return T{};
+    }
+
+    template <typename K>
+    static type of(const K &, const T &val) {
+        return val;
+    }
+
+    static type combine(const T &a, const T &b) {
+        return a + b;
+    }
+};
+
+struct DefaultPolicy {
+    using RefCount = LocalCount;
+    using Alloc = PoolAlloc;
+    using Augment = NoAugment;
+    using Stats = NoStats;
+    using Reclaim = ImmediateReclaim;
+
+    // re-check the nodes each update went through, see CheckedPolicy
+    static constexpr bool checked = false;
+
+    // set operations fork halves bigger than this when nodes may be shared across threads
+    static constexpr size_t parallel_cutoff = 1 << 14;
+};
+
+// for versions that are handed between threads
+struct ThreadSafePolicy: DefaultPolicy {
+    using RefCount = AtomicCount;
+};
+
+// For tests and debug builds at full size. After every insert and erase
+// AVLMap and RBMap walk down from the root along the updated path and check
+// the invariants of its nodes and their children, keys included against the
+// bounds set by every ancestor. That covers every node the update changed;
+// the rest was checked when it was last changed. That costs O(log n) a step (O(log^2 n)
+// for RBMap's black heights) instead of a full verify(). A broken invariant
+// aborts.
+struct CheckedPolicy: DefaultPolicy {
+    static constexpr bool checked = true;
+};
+
+[[noreturn]] inline void invariant_failed(const char *tree, const char *what) {
+    fprintf(stderr, "%s: broken invariant: %s\n", tree, what);
+    fflush(stderr);
+    abort();
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+// Totals over all pools, only counted when built with IMMTREE_POOL_STATS.
+struct PoolStats {
+    std::atomic<size_t> allocations{0};
+    std::atomic<size_t> deallocations{0};
+    std::atomic<size_t> live_bytes{0};      // blocks handed out and not yet returned
+    std::atomic<size_t> slab_bytes{0};
+};
+
+inline PoolStats &pool_stats() {
+    static PoolStats stats;
+    return stats;
+}
+
+
+// Fixed-size block pool, one per size class. Each thread owns a free list and
+// refills it a whole slab (or a spilled batch) at a time, so allocate and
+// deallocate only take the lock once per batch. Memory freed on another
+// thread goes to that thread's list; lists that grow past two batches and
+// lists of exiting threads are handed back to the shared stock. Slabs are
+// kept for the lifetime of the process.
+template <size_t Size>
+class NodePool {
+    static_assert(Size % alignof(std::max_align_t) == 0, "Size must be a multiple of the max alignment");
+
+    struct Block {
+        Block *next;
+    };
+
+    struct Chain {
+        Block *head;
+        size_t count;
+    };
+
+    static constexpr size_t slab_bytes = 64 * 1024;
+    static constexpr size_t batch = slab_bytes / Size;
+
+    struct Shared {
+        std::mutex mu;
+        std::vector<Chain> chains;
+        std::vector<void *> slabs;
+    };
+
+    struct Cache {
+        Block *head = nullptr;
+        size_t count = 0;
+
+        ~Cache() {
+            if (head) {
+                give_back(head, count);
+            }
+            head = nullptr;
+            count = 0;
+            torn_down() = true;
+        }
+    };
+
+    static Shared &shared() {
+        // never destroyed: blocks may still be released during static destruction
+        static Shared *s = new Shared;
+        return *s;
+    }
+
+    static Cache &cache() {
+        static thread_local Cache c;
+        return c;
+    }
+
+    // set once this thread's cache is destroyed. Other thread_local
+    // destructors (a DeferredReclaim queue built before the cache) may still
+    // allocate and free afterwards; they go straight to the shared stock.
+    // Trivially destructible, so it stays readable until the thread is gone.
+    static bool &torn_down() {
+        static thread_local bool gone = false;
+        return gone;
+    }
+
+    static void give_back(Block *head, size_t count) {
+        auto &s = shared();
+        std::lock_guard<std::mutex> lock{s.mu};
+        s.chains.push_back({head, count});
+    }
+
+    static Chain refill() {
+        auto &s = shared();
+        {
+            std::lock_guard<std::mutex> lock{s.mu};
+            if (!s.chains.empty()) {
+                auto chain = s.chains.back();
+                s.chains.pop_back();
+                return chain;
+            }
+        }
+
+        auto slab = static_cast<char *>(::operator new(slab_bytes));
+        Block *head = nullptr;
+        for (size_t i = batch; i-- > 0;) {
+            auto b = reinterpret_cast<Block *>(slab + i * Size);
+            b->next = head;
+            head = b;
+        }
+#ifdef IMMTREE_POOL_STATS
+        pool_stats().slab_bytes.fetch_add(slab_bytes, std::memory_order_relaxed);
+#endif
+
+        std::lock_guard<std::mutex> lock{s.mu};
+        s.slabs.push_back(slab);
+        return {head, batch};
+    }
+
+public:
+    static void *allocate() {
+        Block *b;
+        if (torn_down()) {
+            auto chain = refill();
+            b = chain.head;
+            if (chain.count > 1) {
+                give_back(b->next, chain.count - 1);
+            }
+        }
+        else {
+            auto &c = cache();
+            if (!c.head) {
+                auto chain = refill();
+                c.head = chain.head;
+                c.count = chain.count;
+            }
+            b = c.head;
+            c.head = b->next;
+            --c.count;
+        }
+#ifdef IMMTREE_POOL_STATS
+        pool_stats().allocations.fetch_add(1, std::memory_order_relaxed);
+        pool_stats().live_bytes.fetch_add(Size, std::memory_order_relaxed);
+#endif
+        return b;
+    }
+
+    static void deallocate(void *p) {
+#ifdef IMMTREE_POOL_STATS
+        pool_stats().deallocations.fetch_add(1, std::memory_order_relaxed);
+        pool_stats().live_bytes.fetch_sub(Size, std::memory_order_relaxed);
+#endif
+        auto b = static_cast<Block *>(p);
+        if (torn_down()) {
+            b->next = nullptr;
+            give_back(b, 1);
+            return;
+        }
+        auto &c = cache();
+        b->next = c.head;
+        c.head = b;
+        if (++c.count > 2 * batch) {
+            Block *head = c.head;
+            Block *last = head;
+            for (size_t i = 1; i < batch; ++i) {
+                last = last->next;
+            }
+            c.head = last->next;
+            c.count -= batch;
+            last->next = nullptr;
+            give_back(head, batch);
+        }
+    }
+};
+
+
+// Allocation policies for tree nodes. create/destroy pair up like new/delete.
+
+struct HeapAlloc {
+    template <typename T, typename... Args>
+    static T *create(Args&&... args) {
+        return new T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    static void destroy(T *p) {
+        delete p;
+    }
+};
+
+struct PoolAlloc {
+    static constexpr size_t max_size = 1024;
+
+    template <typename T>
+    static constexpr size_t size_class() {
+        constexpr size_t align = alignof(std::max_align_t);
+        return (sizeof(T) + align - 1) / align * align;
+    }
+
+    template <typename T>
+    static constexpr bool pooled() {
+        return sizeof(T) <= max_size && alignof(T) <= alignof(std::max_align_t);
+    }
+
+    template <typename T, typename... Args>
+    static T *create(Args&&... args) {
+        if constexpr (pooled<T>()) {
+            void *p = NodePool<size_class<T>()>::allocate();
+            try {
+                return new (p) T(std::forward<Args>(args)...);
+            }
+            catch (...) {
+                NodePool<size_class<T>()>::deallocate(p);
+                throw;
+            }
+        }
+        else {
+            return HeapAlloc::create<T>(std::forward<Args>(args)...);
+        }
+    }
+
+    template <typename T>
+    static void destroy(T *p) {
+        if constexpr (pooled<T>()) {
+            p->~T();
+            NodePool<size_class<T>()>::deallocate(p);
+        }
+        else {
+            HeapAlloc::destroy(p);
+        }
+    }
+};
+
+
+// std::allocator adapter over the same pools, for std::allocate_shared and containers
+template <typename T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &) {}
+
+    T *allocate(size_t n) {
+        if constexpr (PoolAlloc::pooled<T>()) {
+            if (n == 1) {
+                return static_cast<T *>(NodePool<PoolAlloc::size_class<T>()>::allocate());
+            }
+        }
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        if constexpr (PoolAlloc::pooled<T>()) {
+            if (n == 1) {
+                NodePool<PoolAlloc::size_class<T>()>::deallocate(p);
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U> &) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U> &) const {
+        return false;
+    }
+};
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <iterator>
+
+#include "pool.h"
+
+
+enum Color {
+    RED = 0,
+    BLACK = 1,
+};
+
+
+struct RbNode {
+    Color color;
+    int key;
+    size_t count;   // nodes in this subtree
+    std::shared_ptr<RbNode> left, right;
+
+    RbNode(Color color, int key, std::shared_ptr<RbNode> left, std::shared_ptr<RbNode> right)
+        :color{color}, key{key}, left{std::move(left)}, right{std::move(right)} {
+        update_count();
+    }
+
+    void update_count() {
+        count = 1 + (left ? left->count : 0) + (right ? right->count : 0);
+    }
+};
+
+using Rb = std::shared_ptr<RbNode>;
+using RbAlloc = PoolAllocator<RbNode>;
+
+inline Rb mk_rb(Color color, int key, Rb left, Rb right) {
+    return std::allocate_shared<RbNode>(RbAlloc{}, color, key, std::move(left), std::move(right));
+}
+
+inline Rb balance(Rb &&root) {
+    if (root->color == BLACK) {
+        if (root->left && root->left->color == RED) {
+            if (root->left->left && root->left->left->color == RED) {
+                Rb l = (root->left);
+                Rb c = (l->right);
+                root->left = c;
+                root->update_count();
+                l->right = root;
+                l->update_count();
+                l->left->color = BLACK;
+                return l;
+            }
+            if (root->left->right && root->left->right->color == RED) {
+                Rb l = (root->left);
+                Rb lr = (l->right);
+                Rb b = (lr->left);
+                Rb c = (lr->right);
+                l->right = b;
+                l->update_count();
+                root->left = c;
+                root->update_count();
+                lr->left = l;
+                lr->right = root;
+                lr->update_count();
+                lr->left->color = BLACK;
+                return lr;
+            }
+        }
+        if (root->right && root->right->color == RED) {
+            if (root->right->left && root->right->left->color == RED) {
+                Rb r = (root->right);
+                Rb rl = (r->left);
+                Rb b = (rl->left);
+                Rb c = (rl->right);
+                root->right = b;
+                root->update_count();
+                r->left = c;
+                r->update_count();
+                rl->left = root;
+                rl->right = r;
+                rl->update_count();
+                rl->right->color = BLACK;
+                return rl;
+            }
+            if (root->right->right && root->right->right->color == RED) {
+                Rb r = (root->right);
+                Rb b = (r->left);
+                root->right = b;
+                root->update_count();
+                r->left = root;
+                r->update_count();
+                r->right->color = BLACK;
+                return r;
+            }
+        }
+    }
+    return root;
+}
+
+
+inline Rb insert_helper(Rb root, int key) {
+    if (!root) {
+        return mk_rb(RED, key, nullptr, nullptr);
+    }
+    else {
+        if (key < root->key) {
+            Rb new_root = mk_rb(root->color, root->key, insert_helper(root->left, key), root->right);
+            return balance(std::move(new_root));
+        }
+        else if (root->key < key) {
+            Rb new_root = mk_rb(root->color, root->key, root->left, insert_helper(root->right, key));
+            return balance(std::move(new_root));
+        }
+        else {
+            Rb new_root = mk_rb(root->color, key, root->left, root->right);
+            return new_root;
+        }
+    }
+}
+
+
+inline Rb insert(Rb root, int key) {
+    Rb new_root = insert_helper(std::move(root), key);
+    new_root->color = BLACK;
+    return new_root;
+}
+
+
+template <typename It>
+Rb from_sorted_helper(It &first, size_t n, int depth, int red_depth) {
+    if (n == 0) {
+        return nullptr;
+    }
+    Rb left = from_sorted_helper(first, n / 2, depth + 1, red_depth);
+    int key = *first;
+    ++first;
+    Rb right = from_sorted_helper(first, n - n / 2 - 1, depth + 1, red_depth);
+    return mk_rb(depth == red_depth ? RED : BLACK, key, std::move(left), std::move(right));
+}
+
+// Keys in [first, last) must be strictly increasing. Splitting at the middle
+// leaves every level complete but the last, whose nodes are coloured red. O(n)
+template <typename It>
+Rb from_sorted(It first, It last) {
+    size_t n = std::distance(first, last);
+    int complete_levels = 0;
+    while ((size_t(2) << complete_levels) - 1 <= n) {
+        ++complete_levels;
+    }
+    return from_sorted_helper(first, n, 0, complete_levels);
+}
+
+// Keys in [first, last) must be strictly increasing. Each key only copies its
+// own search path, so subtrees the run does not touch stay shared.
+template <typename It>
+Rb insert_sorted_batch(Rb root, It first, It last) {
+    if (!root) {
+        return from_sorted(first, last);
+    }
+    for (; first != last; ++first) {
+        root = insert(std::move(root), *first);
+    }
+    return root;
+}
+
+
+// `node` is a fresh copy whose left subtree lost one black node. Restores the
+// black height where the colours allow it; otherwise sets `shorter` and leaves
+// the deficit to the parent.
+inline Rb fix_left(Rb node, bool &shorter) {
+    Rb w = node->right;
+    if (w->color == RED) {
+        // rotate the red sibling up; below it the parent is red, so the fix ends there
+        bool inner_shorter;
+        Rb inner = fix_left(mk_rb(RED, node->key, node->left, w->left), inner_shorter);
+        shorter = false;
+        return mk_rb(BLACK, w->key, std::move(inner), w->right);
+    }
+
+    bool near_red = w->left && w->left->color == RED;
+    bool far_red = w->right && w->right->color == RED;
+    if (!near_red && !far_red) {
+        node->right = mk_rb(RED, w->key, w->left, w->right);
+        shorter = node->color == BLACK;
+        node->color = BLACK;
+        return node;
+    }
+    if (!far_red) {
+        Rb wl = w->left;
+        w = mk_rb(BLACK, wl->key, wl->left, mk_rb(RED, w->key, wl->right, w->right));
+    }
+    shorter = false;
+    Rb far = w->right;
+    return mk_rb(node->color, w->key,
+                 mk_rb(BLACK, node->key, node->left, w->left),
+                 mk_rb(BLACK, far->key, far->left, far->right));
+}
+
+inline Rb fix_right(Rb node, bool &shorter) {
+    Rb w = node->left;
+    if (w->color == RED) {
+        bool inner_shorter;
+        Rb inner = fix_right(mk_rb(RED, node->key, w->right, node->right), inner_shorter);
+        shorter = false;
+        return mk_rb(BLACK, w->key, w->left, std::move(inner));
+    }
+
+    bool near_red = w->right && w->right->color == RED;
+    bool far_red = w->left && w->left->color == RED;
+    if (!near_red && !far_red) {
+        node->left = mk_rb(RED, w->key, w->left, w->right);
+        shorter = node->color == BLACK;
+        node->color = BLACK;
+        return node;
+    }
+    if (!far_red) {
+        Rb wr = w->right;
+        w = mk_rb(BLACK, wr->key, mk_rb(RED, w->key, w->left, wr->left), wr->right);
+    }
+    shorter = false;
+    Rb far = w->left;
+    return mk_rb(node->color, w->key,
+                 mk_rb(BLACK, far->key, far->left, far->right),
+                 mk_rb(BLACK, node->key, w->right, node->right));
+}
+
+// what replaces `root` once it is unlinked, for a root with at most one child
+inline Rb unlink(const Rb &root, bool &shorter) {
+    Rb child = root->left ? root->left : root->right;
+    if (root->color == RED) {
+        shorter = false;
+        return child;
+    }
+    if (child) {
+        // a black node with a single child has a red leaf below it
+        shorter = false;
+        return mk_rb(BLACK, child->key, child->left, child->right);
+    }
+    shorter = true;
+    return nullptr;
+}
+
+inline Rb remove_min(const Rb &root, int &min_key, bool &shorter) {
+    if (!root->left) {
+        min_key = root->key;
+        return unlink(root, shorter);
+    }
+    Rb new_root = mk_rb(root->color, root->key, remove_min(root->left, min_key, shorter), root->right);
+    return shorter ? fix_left(std::move(new_root), shorter) : new_root;
+}
+
+// Copies the search path only. Fix-ups stop at the first level whose black
+// height is unchanged, above that the path is just relinked.
+inline Rb remove_helper(const Rb &root, int key, bool &shorter) {
+    if (!root) {
+        shorter = false;
+        return nullptr;
+    }
+    if (key < root->key) {
+        Rb l = remove_helper(root->left, key, shorter);
+        if (l == root->left) {
+            return root;
+        }
+        Rb new_root = mk_rb(root->color, root->key, std::move(l), root->right);
+        return shorter ? fix_left(std::move(new_root), shorter) : new_root;
+    }
+    else if (root->key < key) {
+        Rb r = remove_helper(root->right, key, shorter);
+        if (r == root->right) {
+            return root;
+        }
+        Rb new_root = mk_rb(root->color, root->key, root->left, std::move(r));
+        return shorter ? fix_right(std::move(new_root), shorter) : new_root;
+    }
+    else {
+        if (root->left && root->right) {
+            int min_key;
+            Rb r = remove_min(root->right, min_key, shorter);
+            Rb new_root = mk_rb(root->color, min_key, root->left, std::move(r));
+            return shorter ? fix_right(std::move(new_root), shorter) : new_root;
+        }
+        return unlink(root, shorter);
+    }
+}
+
+
+inline Rb remove(Rb root, int key) {
+    bool shorter;
+    Rb new_root = remove_helper(root, key, shorter);
+    if (new_root && new_root->color == RED) {
+        new_root = mk_rb(BLACK, new_root->key, new_root->left, new_root->right);
+    }
+    return new_root;
+}
+
+
+inline bool contains(const Rb &root, int key) {
+    const RbNode *node = root.get();
+    while (node && node->key != key) {
+        node = (key < node->key ? node->left : node->right).get();
+    }
+    return node != nullptr;
+}
+
+inline int size(const Rb &rb) {
+    return rb ? rb->count : 0;
+}
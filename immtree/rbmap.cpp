@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "rbmap.h"
+
+
+namespace _test {
+
+    void assert(bool x, const char *msg) {
+        if (!x) {
+            fprintf(stderr, "%s\n", msg); fflush(stderr);
+            abort();
+        }
+    }
+
+    template <typename Map, typename Expect>
+    void assert_same(const Map &m, const Expect &expect, const char *msg) {
+        assert(m.size() == expect.size() && m.verify(), msg);
+        for (auto &[k, v] : expect) {
+            assert(m.find_default(k, -1) == v, msg);
+        }
+        auto it = m.begin();
+        for (auto &[k, v] : expect) {
+            assert(it != m.end() && it.key() == k && it.value() == v, msg);
+            ++it;
+        }
+        assert(it == m.end(), msg);
+    }
+
+    // random workload against std::map with the same ordering, keeping old versions
+    template <typename Policy, typename Compare>
+    void test_random_ops(int n) {
+        using Map = RBMap<int, int, Policy, Compare>;
+        std::default_random_engine e{};
+        std::map<int, int, Compare> expect;
+        std::vector<std::pair<Map, std::map<int, int, Compare>>> kept;
+        Map m;
+
+        for (int i = 0; i < n; ++i) {
+            int k = std::uniform_int_distribution<int>(0, n / 2)(e);
+            switch (e() % 4) {
+            case 0:
+                m = m.insert(k, i);
+                expect[k] = i;
+                break;
+            case 1:
+                m = std::move(m).insert(k, i);
+                expect[k] = i;
+                break;
+            case 2:
+                m = m.erase(k);
+                expect.erase(k);
+                break;
+            default:
+                m = std::move(m).erase(k);
+                expect.erase(k);
+                break;
+            }
+            if (i % (n / 20 + 1) == 0) {
+                assert_same(m, expect, "random ops");
+                kept.emplace_back(m, expect);
+            }
+        }
+        for (auto &[old, old_expect] : kept) {
+            assert_same(old, old_expect, "random ops -- kept version");
+        }
+
+        auto t = m.transient();
+        for (int k = 0; k <= n / 2; k += 2) {
+            t.erase(k);
+            t.insert(k + 1, -k);
+        }
+        auto changed = std::move(t).persistent();
+        assert(changed.verify(), "transient -- verify");
+        for (int k = 0; k <= n / 2; k += 2) {
+            assert(!changed.find(k) && *changed.find(k + 1) == -k, "transient");
+        }
+        assert_same(m, expect, "transient -- source untouched");
+    }
+
+    void test_iterate(int n) {
+        for (int size : {0, 1, 2, 3, 7, 8, 20, n}) {
+            std::vector<std::pair<int, int>> kvs;
+            for (int i = 0; i < size; ++i) {
+                kvs.emplace_back(i * 2, i);
+            }
+            auto m = RBMap<int, int>::from_sorted(kvs.begin(), kvs.end());
+            assert(m.size() == (size_t)size && m.verify(), "from sorted");
+
+            int i = 0;
+            for (auto [k, v] : m) {
+                assert(k == i * 2 && v == i, "iterate");
+                ++i;
+            }
+            assert(i == size, "iterate -- count");
+            for (auto it = m.rbegin(); it != m.rend(); ++it) {
+                assert((*it).first == --i * 2, "iterate -- reverse");
+            }
+
+            for (int k = -1; k <= size * 2; ++k) {
+                auto lo = m.lower_bound(k);
+                auto hi = m.upper_bound(k);
+                int expect_lo = k < 0 ? 0 : (k + 1) / 2;
+                int expect_hi = k < 0 ? 0 : k / 2 + 1;
+                assert(expect_lo >= size ? lo == m.end() : lo.key() == expect_lo * 2, "lower bound");
+                assert(expect_hi >= size ? hi == m.end() : hi.key() == expect_hi * 2, "upper bound");
+            }
+            int lo = size / 2 - 1, hi = size;
+            i = std::max(lo + 1, 0) / 2;
+            for (auto [k, v] : m.range(lo, hi)) {
+                assert(k == i * 2 && v == i, "range");
+                ++i;
+            }
+            assert(i == std::min((hi + 1) / 2, size), "range -- end");
+        }
+
+        std::vector<std::pair<int, int>> desc;
+        for (int i = n; i > 0; --i) {
+            desc.emplace_back(i, i);
+        }
+        auto m = RBMap<int, int, DefaultPolicy, std::greater<int>>::from_sorted(desc.begin(), desc.end());
+        assert(m.verify() && m.begin().key() == n && m.lower_bound(n / 2).key() == n / 2, "descending order");
+    }
+
+    // batches of every size around the lane count, hits and misses, against find
+    template <typename Map>
+    void test_find_many(int n) {
+        std::default_random_engine e{};
+        Map m;
+        std::vector<const int *> out;
+        assert(Map{}.find_many(std::vector<int>{1, 2, 3}) == std::vector<const int *>(3), "find many -- empty map");
+        for (int i = 0; i < n; ++i) {
+            m = std::move(m).insert(e() % (4 * n), i);
+        }
+        for (int len : {0, 1, 15, 16, 17, 100, n}) {
+            std::vector<int> keys(len);
+            for (auto &k : keys) {
+                k = e() % (4 * n);
+            }
+            if (len > 2) {
+                keys[1] = keys[0];
+            }
+            out.assign(len + 1, &len);
+            m.find_many(keys.data(), len, out.data());
+            for (int i = 0; i < len; ++i) {
+                assert(out[i] == m.find(keys[i]), "find many -- same as find");
+            }
+            assert(out[len] == &len, "find many -- stays in bounds");
+        }
+    }
+
+    struct StatsPolicy: DefaultPolicy {
+        using Stats = CountingStats;
+    };
+
+    // a persistent insert copies each node on its path once and nothing else
+    void test_copies(int n) {
+        using Map = RBMap<int, int, StatsPolicy>;
+        auto &c = CountingStats::local();
+        std::default_random_engine e{};
+        Map m;
+        for (int i = 0; i < n; ++i) {
+            m = std::move(m).insert(e() % (n * 4), i);
+        }
+
+        for (int i = 0; i < n; ++i) {
+            CountingStats::reset();
+            auto next = m.insert(e() % (n * 4), i);
+            int path = 0, copies = 0;
+            while (!c.path_length[0][path]) {
+                ++path;
+            }
+            while (!c.copies[0][copies]) {
+                ++copies;
+            }
+            bool added = next.size() > m.size();
+            assert(copies == path - added && (size_t)copies == c.nodes_copied, "copies -- insert");
+            assert(next.verify(), "copies -- verify");
+
+            CountingStats::reset();
+            int k = e() % (n * 4);
+            auto smaller = m.erase(k);
+            if (smaller.size() < m.size()) {
+                path = 0;
+                while (!c.path_length[1][path]) {
+                    ++path;
+                }
+                assert(c.nodes_copied <= (size_t)path + 2 && smaller.verify(), "copies -- erase");
+            }
+            else {
+                assert(c.nodes_copied == 0, "copies -- erase absent");
+            }
+        }
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000;
+    _test::test_random_ops<DefaultPolicy, std::less<int>>(n * 10);
+    _test::test_random_ops<DefaultPolicy, std::greater<int>>(n * 10);
+    _test::test_random_ops<ThreadSafePolicy, std::less<int>>(n);
+    _test::test_iterate(n * 10);
+    _test::test_copies(n);
+    _test::test_find_many<RBMap<int, int>>(n * 10);
+    _test::test_find_many<RBMap<int, int, DefaultPolicy, std::greater<int>>>(n);
+}
@@ -0,0 +1,901 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "policy.h"
+
+
+// Persistent red-black map with the interface of AVLMap. Compare is default
+// constructed wherever it is needed, so it must not carry state.
+//
+// A node's colour lives in the low bit of the link that points to it rather
+// than in the node. Recolouring a child therefore only writes to its parent,
+// and the parent is always on the copied path: insert allocates exactly one
+// node per level it copies, erase at most three more for the sibling it
+// rotates.
+template <typename K, typename V, typename Policy = DefaultPolicy, typename Compare = std::less<K>>
+class RBMap {
+    using Stats = typename Policy::Stats;
+
+    struct RBNode;
+
+    // Owning reference to a node, like Rc, with the node's colour in bit 0.
+    // Null links are black.
+    class Link {
+        uintptr_t bits = 0;
+
+    public:
+        Link() noexcept = default;
+
+        Link(const Link &other) noexcept: bits{other.bits} {
+            if (auto p = get()) {
+                RBNode::RefCount::inc(p->refs);
+            }
+        }
+
+        Link(Link &&other) noexcept: bits{other.bits} {
+            other.bits = 0;
+        }
+
+        ~Link() {
+            auto p = get();
+            if (p && RBNode::RefCount::dec(p->refs)) {
+                RBNode::destroy(p);
+            }
+        }
+
+        Link &operator=(const Link &other) noexcept {
+            Link{other}.swap(*this);
+            return *this;
+        }
+
+        Link &operator=(Link &&other) noexcept {
+            Link{std::move(other)}.swap(*this);
+            return *this;
+        }
+
+        // gives up ownership without touching the count
+        RBNode *release() noexcept {
+            auto p = get();
+            bits = 0;
+            return p;
+        }
+
+        // takes over a fresh node with refs == 1
+        static Link adopt(RBNode *p, bool red) noexcept {
+            static_assert(alignof(RBNode) >= 2, "bit 0 of node addresses holds the colour");
+            Link link;
+            link.bits = reinterpret_cast<uintptr_t>(p) | red;
+            return link;
+        }
+
+        void swap(Link &other) noexcept {
+            std::swap(bits, other.bits);
+        }
+
+        RBNode *get() const noexcept {
+            return reinterpret_cast<RBNode *>(bits & ~uintptr_t{1});
+        }
+
+        RBNode *operator->() const noexcept {
+            return get();
+        }
+
+        RBNode &operator*() const noexcept {
+            return *get();
+        }
+
+        explicit operator bool() const noexcept {
+            return get() != nullptr;
+        }
+
+        bool red() const noexcept {
+            return bits & 1;
+        }
+
+        // only called on non-null links when red
+        void set_red(bool red) noexcept {
+            bits = (bits & ~uintptr_t{1}) | red;
+        }
+
+        bool unique() const noexcept {
+            auto p = get();
+            return p && RBNode::RefCount::load(p->refs) == 1;
+        }
+    };
+
+    struct RBNode {
+        using RefCount = typename Policy::RefCount;
+
+        mutable typename RefCount::type refs{1};
+        size_t count;   // nodes in this subtree
+        Link left, right;
+        K key;
+        V val;
+
+        RBNode(const RBNode &other, Link left, Link right):
+            count{other.count},
+            left{std::move(left)},
+            right{std::move(right)},
+            key{other.key},
+            val{other.val} {}
+
+        RBNode(K key, V val, Link left={}, Link right={}):
+            left{std::move(left)},
+            right{std::move(right)},
+            key{std::move(key)},
+            val{std::move(val)} {
+            update();
+        }
+
+        static void destroy(RBNode *node) {
+            Policy::Reclaim::retire(node);
+        }
+
+        static void free(RBNode *node) {
+            Policy::Alloc::destroy(node);
+        }
+
+        template <typename F>
+        void drop_children(F &&f) {
+            for (auto link : {&left, &right}) {
+                RBNode *child = link->release();
+                if (child && RefCount::dec(child->refs)) {
+                    f(child);
+                }
+            }
+        }
+
+        void update() {
+            count = (left ? left->count : 0) + (right ? right->count : 0) + 1;
+        }
+    };
+
+    // 2 log2(n + 1) bounds the height, plus room for the extra level the
+    // first erase case adds to the path
+    static constexpr int max_depth = 2 * 64 + 2;
+
+    Link root;
+
+    explicit RBMap(Link root): root{std::move(root)} {}
+
+    static bool less(const K &a, const K &b) {
+        return Compare{}(a, b);
+    }
+
+public:
+    RBMap(): root{} {}
+
+    class Transient;
+    class iterator;
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+
+    struct Range {
+        iterator first, last;
+
+        iterator begin() const {
+            return first;
+        }
+
+        iterator end() const {
+            return last;
+        }
+    };
+
+    RBMap insert(K key, V val) const & {
+        auto new_root = root;
+        insert_at(new_root, std::move(key), std::move(val));
+        return RBMap{std::move(new_root)};
+    }
+
+    // nodes no other version can reach are updated in place instead of copied
+    RBMap insert(K key, V val) && {
+        insert_at(root, std::move(key), std::move(val));
+        return std::move(*this);
+    }
+
+    RBMap erase(const K &key) const & {
+        auto new_root = root;
+        erase_at(new_root, key);
+        return RBMap{std::move(new_root)};
+    }
+
+    RBMap erase(const K &key) && {
+        erase_at(root, key);
+        return std::move(*this);
+    }
+
+    // [first, last) yields pairs with strictly increasing keys; O(n)
+    template <typename It>
+    static RBMap from_sorted(It first, It last) {
+        size_t n = std::distance(first, last);
+        // the complete levels are black and the partial last one red
+        int red_depth = 0;
+        while ((size_t{2} << red_depth) - 1 <= n) {
+            ++red_depth;
+        }
+        return RBMap{build(first, n, 0, red_depth)};
+    }
+
+    Transient transient() const & {
+        return Transient{root};
+    }
+
+    Transient transient() && {
+        return Transient{std::move(root)};
+    }
+
+    size_t size() const {
+        return root ? root->count : 0;
+    }
+
+    const V *find(const K &key) const {
+        return find(root.get(), key);
+    }
+
+    const V& find_default(const K &key, const V &default_value) const {
+        auto val = find(key);
+        return val ? *val : default_value;
+    }
+
+    // out[i] = find(keys[i]) for i < n, interleaved like AVLMap::find_many
+    void find_many(const K *keys, size_t n, const V **out) const {
+        struct Lane {
+            size_t i;
+            const RBNode *node;
+        } lanes[find_lanes];
+        const RBNode *top = root.get();
+        size_t next = 0;
+        int active = 0;
+        for (; active < find_lanes && next < n; ++active, ++next) {
+            lanes[active] = {next, top};
+        }
+        if (!top) {
+            std::fill(out, out + n, nullptr);
+            return;
+        }
+
+        while (active > 0) {
+            for (int j = 0; j < active;) {
+                Lane &lane = lanes[j];
+                const K &key = keys[lane.i];
+                const RBNode *node = lane.node;
+                const RBNode *child = nullptr;
+                bool hit = false;
+                if (less(key, node->key)) {
+                    child = node->left.get();
+                }
+                else if (less(node->key, key)) {
+                    child = node->right.get();
+                }
+                else {
+                    hit = true;
+                }
+                if (child) {
+                    __builtin_prefetch(child);
+                    lane.node = child;
+                    ++j;
+                    continue;
+                }
+                out[lane.i] = hit ? &node->val : nullptr;
+                if (next < n) {
+                    lane = {next++, top};
+                    ++j;
+                }
+                else {
+                    lane = lanes[--active];
+                }
+            }
+        }
+    }
+
+    std::vector<const V *> find_many(const std::vector<K> &keys) const {
+        std::vector<const V *> out(keys.size());
+        find_many(keys.data(), keys.size(), out.data());
+        return out;
+    }
+
+    iterator begin() const;
+    iterator end() const;
+    iterator lower_bound(const K &key) const;
+    iterator upper_bound(const K &key) const;
+
+    reverse_iterator rbegin() const {
+        return reverse_iterator{end()};
+    }
+
+    reverse_iterator rend() const {
+        return reverse_iterator{begin()};
+    }
+
+    // entries with lo <= key < hi
+    Range range(const K &lo, const K &hi) const {
+        return {lower_bound(lo), lower_bound(hi)};
+    }
+
+    // checks ordering, colours, black heights and counts of the whole tree, O(n)
+    bool verify() const {
+        return !root.red() && verify(root, nullptr, nullptr) >= 0;
+    }
+
+private:
+    static constexpr int find_lanes = 16;
+
+    template <typename... Args>
+    static inline Link mk(bool red, Args&&... args) {
+        return Link::adopt(Policy::Alloc::template create<RBNode>(std::forward<Args>(args)...), red);
+    }
+
+    static const V *find(const RBNode *node, const K &key) {
+        while (node) {
+            if (less(key, node->key)) {
+                node = node->left.get();
+            }
+            else if (less(node->key, key)) {
+                node = node->right.get();
+            }
+            else {
+                return &node->val;
+            }
+        }
+        return nullptr;
+    }
+
+    // replaces a shared node with a private copy so it can be modified
+    static inline RBNode *own(Link &slot) {
+        if (!slot.unique()) {
+            slot = mk(slot.red(), *slot, slot->left, slot->right);
+            Stats::node_copied();
+        }
+        return slot.get();
+    }
+
+    // Rotations move whole links, so every node keeps its colour. Both nodes
+    // involved must be owned.
+    static void rotate_left(Link &slot) {
+        Link a = std::move(slot);
+        Link b = std::move(a->right);
+        a->right = std::move(b->left);
+        a->update();
+        b->left = std::move(a);
+        b->update();
+        slot = std::move(b);
+    }
+
+    static void rotate_right(Link &slot) {
+        Link a = std::move(slot);
+        Link b = std::move(a->left);
+        a->left = std::move(b->right);
+        a->update();
+        b->right = std::move(a);
+        b->update();
+        slot = std::move(b);
+    }
+
+    // Inserts into the tree held by `slot`, changing uniquely owned nodes in
+    // place and copying the rest of the path. Returns whether the key is new.
+    static bool insert_at(Link &slot, K key, V val) {
+        Link *path[max_depth];
+        int n = 0;
+        auto ptr = &slot;
+        Stats::op_begin();
+
+        while (ptr->unique()) {
+            auto node = ptr->get();
+            if (less(key, node->key)) {
+                path[n++] = ptr;
+                ptr = &node->left;
+            }
+            else if (less(node->key, key)) {
+                path[n++] = ptr;
+                ptr = &node->right;
+            }
+            else {
+                node->val = std::move(val);
+                Stats::op_end(TreeOp::insert, n + 1);
+                return false;
+            }
+        }
+
+        // everything below a shared node is shared too, so copy from here on;
+        // `shared` keeps the old path alive while it is being read
+        Link shared = std::move(*ptr);
+        const RBNode *old = shared.get();
+        bool red = shared.red();
+
+        while (old) {
+            Stats::node_copied();
+            if (less(key, old->key)) {
+                *ptr = mk(red, *old, Link{}, old->right);
+                path[n++] = ptr;
+                ptr = &(*ptr)->left;
+                red = old->left.red();
+                old = old->left.get();
+            }
+            else if (less(old->key, key)) {
+                *ptr = mk(red, *old, old->left, Link{});
+                path[n++] = ptr;
+                ptr = &(*ptr)->right;
+                red = old->right.red();
+                old = old->right.get();
+            }
+            else {
+                *ptr = mk(red, std::move(key), std::move(val), old->left, old->right);
+                Stats::op_end(TreeOp::insert, n + 1);
+                return false;
+            }
+        }
+
+        *ptr = mk(true, std::move(key), std::move(val));
+        const RBNode *added = ptr->get();
+        for (int i = 0; i < n; ++i) {
+            ++(*path[i])->count;
+        }
+        int path_length = n + 1;
+
+        // path[d] holds the red node x; the parent and grandparent are on the
+        // path and owned, and so are the links to the uncle
+        path[n] = ptr;
+        int d = n;
+        while (d >= 2 && path[d - 1]->red()) {
+            Link &parent = *path[d - 1];
+            Link &grand = *path[d - 2];
+            bool parent_left = path[d - 1] == &grand->left;
+            Link &uncle = parent_left ? grand->right : grand->left;
+
+            if (uncle.red()) {
+                parent.set_red(false);
+                uncle.set_red(false);
+                grand.set_red(true);
+                d -= 2;
+                continue;
+            }
+            if (parent_left != (path[d] == &parent->left)) {
+                if (parent_left) {
+                    Stats::rotation(Rotation::lr);
+                    rotate_left(parent);
+                }
+                else {
+                    Stats::rotation(Rotation::rl);
+                    rotate_right(parent);
+                }
+            }
+            else {
+                Stats::rotation(parent_left ? Rotation::ll : Rotation::rr);
+            }
+            parent.set_red(false);
+            grand.set_red(true);
+            if (parent_left) {
+                rotate_right(grand);
+            }
+            else {
+                rotate_left(grand);
+            }
+            break;
+        }
+        slot.set_red(false);
+        check_path(slot, added->key);
+        Stats::op_end(TreeOp::insert, path_length);
+        return true;
+    }
+
+    // Removes key from the tree held by `slot`, with the same in-place and
+    // copying rules as insert_at. Returns whether the key was there.
+    static bool erase_at(Link &slot, const K &key) {
+        if (!find(slot.get(), key)) {
+            return false;
+        }
+
+        Link *path[max_depth];
+        int n = 0;
+        auto ptr = &slot;
+        Stats::op_begin();
+        while (true) {
+            bool go_left = less(key, (*ptr)->key);
+            if (!go_left && !less((*ptr)->key, key)) {
+                break;
+            }
+            path[n++] = ptr;
+            ptr = go_left ? &own(*ptr)->left : &own(*ptr)->right;
+        }
+
+        if ((*ptr)->left && (*ptr)->right) {
+            // take over the smallest entry of the right subtree and unlink that instead
+            RBNode *node = own(*ptr);
+            path[n++] = ptr;
+            ptr = &node->right;
+            while ((*ptr)->left) {
+                path[n++] = ptr;
+                ptr = &own(*ptr)->left;
+            }
+            RBNode *min = ptr->get();
+            if (ptr->unique()) {
+                node->key = std::move(min->key);
+                node->val = std::move(min->val);
+            }
+            else {
+                node->key = min->key;
+                node->val = min->val;
+            }
+        }
+
+        // the node in *ptr has at most one child, which takes its place
+        bool removed_black = !ptr->red();
+        const RBNode *gone = ptr->get();
+        *ptr = gone->left ? gone->left : gone->right;
+        for (int i = 0; i < n; ++i) {
+            --(*path[i])->count;
+        }
+        path[n++] = ptr;
+        int path_length = n;
+
+        if (removed_black) {
+            fix_double_black(path, n - 1);
+        }
+        slot.set_red(false);
+        if (const K *succ = check_path(slot, key)) {
+            check_path(slot, *succ);
+        }
+        Stats::op_end(TreeOp::erase, path_length);
+        return true;
+    }
+
+    // The subtree in *path[d] is one black node short. Nodes on the path are
+    // owned; the sibling is copied before it is rotated or has a child
+    // recoloured.
+    static void fix_double_black(Link **path, int d) {
+        while (d > 0 && !path[d]->red()) {
+            Link &parent = *path[d - 1];
+            RBNode *p = parent.get();
+            bool x_left = path[d] == &p->left;
+            Link &sibling = x_left ? p->right : p->left;
+
+            if (sibling.red()) {
+                // make the sibling black by rotating it above the parent;
+                // x gets one level deeper and keeps its slot in p
+                own(sibling);
+                sibling.set_red(false);
+                parent.set_red(true);
+                if (x_left) {
+                    rotate_left(parent);
+                }
+                else {
+                    rotate_right(parent);
+                }
+                path[d + 1] = path[d];
+                path[d] = x_left ? &parent->left : &parent->right;
+                ++d;
+                continue;
+            }
+
+            RBNode *s = sibling.get();
+            Link &near = x_left ? s->left : s->right;
+            Link &far = x_left ? s->right : s->left;
+            if (!near.red() && !far.red()) {
+                sibling.set_red(true);
+                --d;
+                continue;
+            }
+
+            s = own(sibling);
+            if (!(x_left ? s->right : s->left).red()) {
+                Link &inner = x_left ? s->left : s->right;
+                own(inner);
+                inner.set_red(false);
+                sibling.set_red(true);
+                if (x_left) {
+                    rotate_right(sibling);
+                }
+                else {
+                    rotate_left(sibling);
+                }
+                s = sibling.get();
+            }
+            sibling.set_red(parent.red());
+            parent.set_red(false);
+            (x_left ? s->right : s->left).set_red(false);
+            if (x_left) {
+                rotate_left(parent);
+            }
+            else {
+                rotate_right(parent);
+            }
+            return;
+        }
+        path[d]->set_red(false);
+    }
+
+    template <typename It>
+    static Link build(It &first, size_t n, int depth, int red_depth) {
+        if (n == 0) {
+            return {};
+        }
+        auto left = build(first, n / 2, depth + 1, red_depth);
+        auto &&kv = *first;
+        ++first;
+        auto right = build(first, n - n / 2 - 1, depth + 1, red_depth);
+        return mk(depth == red_depth, kv.first, kv.second, std::move(left), std::move(right));
+    }
+
+    // With Policy::checked, checks the path to key and the children along it
+    // as AVLMap does, adding colours and black heights. Black heights are
+    // counted down the left spine, so this is O(log^2 n).
+    static const K *check_path(const Link &root, const K &key) {
+        const K *low = nullptr, *high = nullptr;
+        if constexpr (Policy::checked) {
+            for (const Link *link = &root; *link;) {
+                const RBNode *node = link->get();
+                check_node(*link, low, high);
+                check_node(node->left, low, &node->key);
+                check_node(node->right, &node->key, high);
+                if (less(key, node->key)) {
+                    high = &node->key;
+                    link = &node->left;
+                }
+                else {
+                    low = &node->key;
+                    link = &node->right;
+                }
+            }
+        }
+        return high;
+    }
+
+    static bool within(const Link &link, const K *low, const K *high) {
+        return !link || ((!low || less(*low, link->key)) && (!high || less(link->key, *high)));
+    }
+
+    static void check_node(const Link &link, const K *low, const K *high) {
+        const RBNode *node = link.get();
+        if (!node) {
+            return;
+        }
+        const Link &l = node->left, &r = node->right;
+        if (!within(link, low, high) || !within(l, low, &node->key) || !within(r, &node->key, high)) {
+            invariant_failed("RBMap", "order");
+        }
+        if (link.red() && (l.red() || r.red())) {
+            invariant_failed("RBMap", "red node with a red child");
+        }
+        if (black_height(l) != black_height(r)) {
+            invariant_failed("RBMap", "black height");
+        }
+        if (node->count != (l ? l->count : 0) + (r ? r->count : 0) + 1) {
+            invariant_failed("RBMap", "count");
+        }
+    }
+
+    static int black_height(const Link &link) {
+        int h = 0;
+        for (const Link *p = &link; *p; p = &(*p)->left) {
+            h += !p->red();
+        }
+        return h;
+    }
+
+    // black height of the subtree, or -1 if it breaks an invariant
+    static int verify(const Link &link, const K *low, const K *high) {
+        const RBNode *node = link.get();
+        if (!node) {
+            return 0;
+        }
+        if ((low && !less(*low, node->key)) || (high && !less(node->key, *high))) {
+            return -1;
+        }
+        if (link.red() && (node->left.red() || node->right.red())) {
+            return -1;
+        }
+        int lh = verify(node->left, low, &node->key);
+        int rh = verify(node->right, &node->key, high);
+        if (lh < 0 || lh != rh) {
+            return -1;
+        }
+        size_t count = (node->left ? node->left->count : 0) + (node->right ? node->right->count : 0) + 1;
+        if (node->count != count) {
+            return -1;
+        }
+        return lh + !link.red();
+    }
+};
+
+
+// Mutable builder over an RBMap; see AVLMap::Transient.
+template <typename K, typename V, typename Policy, typename Compare>
+class RBMap<K, V, Policy, Compare>::Transient {
+    friend class RBMap;
+
+    Link root;
+
+    explicit Transient(Link root): root{std::move(root)} {}
+
+public:
+    Transient(): root{} {}
+
+    void insert(K key, V val) {
+        insert_at(root, std::move(key), std::move(val));
+    }
+
+    void erase(const K &key) {
+        erase_at(root, key);
+    }
+
+    size_t size() const {
+        return root ? root->count : 0;
+    }
+
+    const V *find(const K &key) const {
+        return RBMap::find(root.get(), key);
+    }
+
+    RBMap persistent() && {
+        return RBMap{std::move(root)};
+    }
+};
+
+
+// Same fixed-stack iterator as AVLMap::iterator, deep enough for the
+// red-black height bound.
+template <typename K, typename V, typename Policy, typename Compare>
+class RBMap<K, V, Policy, Compare>::iterator {
+    friend class RBMap;
+
+    const RBNode *root = nullptr;
+    const RBNode *stack[max_depth];
+    int depth = 0;     // 0 at end()
+
+    const RBNode *top() const {
+        return stack[depth - 1];
+    }
+
+    void push_leftmost(const RBNode *node) {
+        for (; node; node = node->left.get()) {
+            stack[depth++] = node;
+        }
+    }
+
+    void push_rightmost(const RBNode *node) {
+        for (; node; node = node->right.get()) {
+            stack[depth++] = node;
+        }
+    }
+
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::pair<const K &, const V &>;
+    using difference_type = std::ptrdiff_t;
+    using reference = value_type;
+
+    struct pointer {
+        value_type kv;
+
+        const value_type *operator->() const {
+            return &kv;
+        }
+    };
+
+    iterator() = default;
+
+    const K &key() const {
+        return top()->key;
+    }
+
+    const V &value() const {
+        return top()->val;
+    }
+
+    reference operator*() const {
+        return {top()->key, top()->val};
+    }
+
+    pointer operator->() const {
+        return {{top()->key, top()->val}};
+    }
+
+    iterator &operator++() {
+        const RBNode *node = top();
+        if (node->right) {
+            push_leftmost(node->right.get());
+            return *this;
+        }
+        do {
+            node = stack[--depth];
+        } while (depth > 0 && top()->right.get() == node);
+        return *this;
+    }
+
+    iterator &operator--() {
+        if (depth == 0) {
+            push_rightmost(root);
+            return *this;
+        }
+        const RBNode *node = top();
+        if (node->left) {
+            push_rightmost(node->left.get());
+            return *this;
+        }
+        do {
+            node = stack[--depth];
+        } while (depth > 0 && top()->left.get() == node);
+        return *this;
+    }
+
+    iterator operator++(int) {
+        auto old = *this;
+        ++*this;
+        return old;
+    }
+
+    iterator operator--(int) {
+        auto old = *this;
+        --*this;
+        return old;
+    }
+
+    friend bool operator==(const iterator &a, const iterator &b) {
+        return a.depth == b.depth && (a.depth == 0 || a.top() == b.top());
+    }
+
+    friend bool operator!=(const iterator &a, const iterator &b) {
+        return !(a == b);
+    }
+};
+
+template <typename K, typename V, typename Policy, typename Compare>
+auto RBMap<K, V, Policy, Compare>::begin() const -> iterator {
+    iterator it;
+    it.root = root.get();
+    it.push_leftmost(root.get());
+    return it;
+}
+
+template <typename K, typename V, typename Policy, typename Compare>
+auto RBMap<K, V, Policy, Compare>::end() const -> iterator {
+    iterator it;
+    it.root = root.get();
+    return it;
+}
+
+template <typename K, typename V, typename Policy, typename Compare>
+auto RBMap<K, V, Policy, Compare>::lower_bound(const K &key) const -> iterator {
+    iterator it;
+    it.root = root.get();
+    int keep = 0;
+    for (const RBNode *node = root.get(); node;) {
+        it.stack[it.depth++] = node;
+        if (!less(node->key, key)) {
+            keep = it.depth;
+            node = node->left.get();
+        }
+        else {
+            node = node->right.get();
+        }
+    }
+    it.depth = keep;
+    return it;
+}
+
+template <typename K, typename V, typename Policy, typename Compare>
+auto RBMap<K, V, Policy, Compare>::upper_bound(const K &key) const -> iterator {
+    iterator it;
+    it.root = root.get();
+    int keep = 0;
+    for (const RBNode *node = root.get(); node;) {
+        it.stack[it.depth++] = node;
+        if (less(key, node->key)) {
+            keep = it.depth;
+            node = node->left.get();
+        }
+        else {
+            node = node->right.get();
+        }
+    }
+    it.depth = keep;
+    return it;
+}
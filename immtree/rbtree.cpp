@@ -1,147 +1,11 @@
-#include <cstddef>
 #include <cstdio>
-#include <memory>
-
-
-enum Color {
-    RED = 0,
-    BLACK = 1,
-};
-
-
-struct RbNode {
-    Color color;
-    int key;
-    std::shared_ptr<RbNode> left, right;
-
-    RbNode(Color color, int key, std::shared_ptr<RbNode> left, std::shared_ptr<RbNode> right)
-        :color{color}, key{key}, left{std::move(left)}, right{std::move(right)} {}
-};
-
-using Rb = std::shared_ptr<RbNode>;
-
-Rb mk_rb(Color color, int key, Rb left, Rb right) {
-    return std::make_shared<RbNode>(color, key, left, right);
-}
-
-Rb balance(Rb &&root) {
-    if (root->color == BLACK) {
-        if (root->left && root->left->color == RED) {
-            if (root->left->left && root->left->left->color == RED) {
-                Rb l = (root->left);
-                Rb c = (l->right);
-                root->left = c;
-                l->right = root;
-                l->left->color = BLACK;
-                return l;
-            }
-            if (root->left->right && root->left->right->color == RED) {
-                Rb l = (root->left);
-                Rb lr = (l->right);
-                Rb b = (lr->left);
-                Rb c = (lr->right);
-                l->right = b;
-                root->left = c;
-                lr->left = l;
-                lr->right = root;
-                lr->left->color = BLACK;
-                return lr;
-            }
-        }
-        if (root->right && root->right->color == RED) {
-            if (root->right->left && root->right->left->color == RED) {
-                Rb r = (root->right);
-                Rb rl = (r->left);
-                Rb b = (rl->left);
-                Rb c = (rl->right);
-                root->right = b;
-                r->left = c;
-                rl->left = root;
-                rl->right = r;
-                rl->right->color = BLACK;
-                return rl;
-            }
-            if (root->right->right && root->right->right->color == RED) {
-                Rb r = (root->right);
-                Rb b = (r->left);
-                root->right = b;
-                r->left = root;
-                r->right->color = BLACK;
-                return r;
-            }
-        }
-    }
-    return root;
-}
-
-
-Rb insert_helper(Rb root, int key) {
-    if (!root) {
-        return mk_rb(RED, key, nullptr, nullptr);
-    }
-    else {
-        if (key < root->key) {
-            Rb new_root = mk_rb(root->color, root->key, insert_helper(root->left, key), root->right);
-            return balance(std::move(new_root));
-        }
-        else if (root->key < key) {
-            Rb new_root = mk_rb(root->color, root->key, root->left, insert_helper(root->right, key));
-            return balance(std::move(new_root));
-        }
-        else {
-            Rb new_root = mk_rb(RED, key, root->left, root->right);
-            return new_root;
-        }
-    }
-}
-
-
-Rb insert(Rb root, int key) {
-    Rb new_root = insert_helper(std::move(root), key);
-    new_root->color = BLACK;
-    return new_root;
-}
-
-
-Rb remove_helper(Rb root, int key) {
-    if (!root) {
-        return nullptr;
-    }
-    else {
-        if (key < root->key) {
-            Rb new_root = mk_rb(root->color, root->key, remove_helper(root->left, key), root->right);
-            return new_root;
-        }
-        else if (root->key < key) {
-            Rb new_root = mk_rb(root->color, root->key, root->left, remove_helper(root->right, key));
-            return new_root;
-        }
-        else {
-            if (root->left && root->right) {
-
-            }
-        }
-    }
-}
-
-std::pair<Rb, RbNode*> remove_min(Rb root) {
-    if (!root->left) {
-        return {root->right, root.get()};
-    }
-    else {
-        auto [rb, removed] = remove_min(root->left);
-        Rb new_root = mk_rb(root->color, root->key, rb, root->right);
-        return {new_root, removed};
-    }
-}
-
-
-int size(Rb rb) {
-    return rb ? 1 + size(rb->left) + size(rb->right) : 0;
-}
-
+#include <cstdlib>
 #include <vector>
 #include <random>
+#include <algorithm>
+
+#include "rb.h"
+
 
 void print_rb_helper(Rb rb) {
     if (rb) {
@@ -162,12 +26,14 @@ namespace _test {
     void assert(bool x, const char *msg) {
         if (!x) {
             fprintf(stderr, "%s\n", msg); fflush(stderr);
+            abort();
         }
     }
     
     void validate_order(Rb root, int64_t low=INT64_MIN, int64_t high=INT64_MAX) {
         if (root) {
             assert(low < (int64_t)root->key && (int64_t)root->key < high, "order error\n");
+            assert(size(root) == 1 + size(root->left) + size(root->right), "count error\n");
             if (root->left) {
                 validate_order(root->left, low, root->key);
             }
@@ -217,11 +83,66 @@ namespace _test {
     }
 
     void rb_attr5(Rb root) {
-        int n_black_expect = 01;
+        int n_black_expect = -1;
         rb_attr5_helper(root, 0, n_black_expect);
     }
 
 
+    void test_from_sorted(int n) {
+        for (int m = 0; m <= n; ++m) {
+            std::vector<int> keys;
+            for (int i = 0; i < m; ++i) {
+                keys.push_back(i * 3);
+            }
+            Rb rb = from_sorted(keys.begin(), keys.end());
+            assert(size(rb) == m, "from sorted -- size");
+            validate_order(rb);
+            rb_attr2(rb);
+            rb_attr4(rb);
+            rb_attr5(rb);
+
+            std::vector<int> more;
+            for (int i = 0; i < m; ++i) {
+                more.push_back(i * 3 + 1);
+            }
+            Rb merged = insert_sorted_batch(rb, more.begin(), more.end());
+            assert(size(merged) == 2 * m && size(rb) == m, "sorted batch -- size");
+            validate_order(merged);
+            rb_attr2(merged);
+            rb_attr4(merged);
+            rb_attr5(merged);
+        }
+    }
+
+    void test_remove(int n) {
+        std::default_random_engine e{};
+        std::vector<int> keys;
+        Rb rb;
+        for (int i = 0; i < n; ++i) {
+            keys.push_back(e() % (4 * n));
+            rb = insert(rb, keys.back());
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        std::shuffle(keys.begin(), keys.end(), e);
+
+        std::vector<Rb> trees{rb};
+        for (size_t i = 0; i < keys.size(); ++i) {
+            Rb next = remove(trees.back(), keys[i]);
+            assert(size(next) == (int)(keys.size() - i - 1), "remove -- size");
+            assert(remove(next, keys[i]) == next, "remove -- absent");
+            validate_order(next);
+            rb_attr2(next);
+            rb_attr4(next);
+            rb_attr5(next);
+            trees.push_back(next);
+        }
+        for (size_t i = 0; i < trees.size(); i += 17) {
+            assert(size(trees[i]) == (int)(keys.size() - i), "remove -- old version");
+            rb_attr5(trees[i]);
+        }
+    }
+
     void test_insert(int n) {
         std::vector<Rb> trees(1, Rb());
         std::default_random_engine e{};
@@ -229,15 +150,20 @@ namespace _test {
             Rb last = trees.back();
             int key = e();
             Rb new_rb = insert(last, key);
+            assert(contains(new_rb, key), "contains");
             trees.push_back(new_rb);
-            for (int j = 0; j < trees.size(); ++j) {
-                Rb rb = trees[j];
-                assert(size(rb) == j, "size");
-                validate_order(rb);
-                rb_attr2(rb);
-                rb_attr4(rb);
-                rb_attr4(rb);
-            }
+            assert(size(new_rb) == i + 1, "size");
+            validate_order(new_rb);
+            rb_attr2(new_rb);
+            rb_attr4(new_rb);
+            rb_attr5(new_rb);
+        }
+        // inserting must leave the old versions alone; a sample of them is enough
+        for (size_t j = 0; j < trees.size(); j += 7) {
+            assert(size(trees[j]) == (int)j, "size -- old version");
+            validate_order(trees[j]);
+            rb_attr4(trees[j]);
+            rb_attr5(trees[j]);
         }
     }
 }
@@ -249,6 +175,8 @@ namespace _test {
 int main(int argc, char **argv) {
     int n = atoi(argv[1]);
     _test::test_insert(n);
+    _test::test_from_sorted(n);
+    _test::test_remove(n * 10);
     Rb a = mk_rb(BLACK, 0, nullptr, nullptr);
     Rb b = insert(a, 1);
     Rb c = insert(b, 2);
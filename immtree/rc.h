@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+
+// Counting policies for the intrusive Rc below. A node type T used with Rc<T>
+// provides `using RefCount = ...`, a `mutable RefCount::type refs` member
+// starting at 1, and `static void destroy(T *)` called when refs drops to 0.
+
+struct LocalCount {
+    using type = uint32_t;
+    static constexpr bool thread_safe = false;
+
+    static void inc(type &c) {
+        ++c;
+    }
+
+    static bool dec(type &c) {
+        return --c == 0;
+    }
+
+    static uint32_t load(const type &c) {
+        return c;
+    }
+};
+
+struct AtomicCount {
+    using type = std::atomic<uint32_t>;
+    static constexpr bool thread_safe = true;
+
+    static void inc(type &c) {
+        c.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static bool dec(type &c) {
+        return c.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    static uint32_t load(const type &c) {
+        return c.load(std::memory_order_acquire);
+    }
+};
+
+
+template <typename T>
+class Rc {
+    T *ptr;
+
+public:
+    Rc() noexcept: ptr{nullptr} {}
+    Rc(std::nullptr_t) noexcept: ptr{nullptr} {}
+
+    Rc(const Rc &other) noexcept: ptr{other.ptr} {
+        if (ptr) {
+            T::RefCount::inc(ptr->refs);
+        }
+    }
+
+    Rc(Rc &&other) noexcept: ptr{other.ptr} {
+        other.ptr = nullptr;
+    }
+
+    ~Rc() {
+        if (ptr && T::RefCount::dec(ptr->refs)) {
+            T::destroy(ptr);
+        }
+    }
+
+    Rc &operator=(const Rc &other) noexcept {
+        Rc{other}.swap(*this);
+        return *this;
+    }
+
+    Rc &operator=(Rc &&other) noexcept {
+        Rc{std::move(other)}.swap(*this);
+        return *this;
+    }
+
+    Rc &operator=(std::nullptr_t) noexcept {
+        Rc{}.swap(*this);
+        return *this;
+    }
+
+    // takes over a reference the caller already owns, e.g. a fresh node with refs == 1
+    static Rc adopt(T *p) noexcept {
+        Rc rc;
+        rc.ptr = p;
+        return rc;
+    }
+
+    // shares `p`, which must be kept alive by some other reference
+    static Rc share(T *p) noexcept {
+        if (p) {
+            T::RefCount::inc(p->refs);
+        }
+        return adopt(p);
+    }
+
+    // gives up ownership without touching the count
+    T *release() noexcept {
+        T *p = ptr;
+        ptr = nullptr;
+        return p;
+    }
+
+    void swap(Rc &other) noexcept {
+        std::swap(ptr, other.ptr);
+    }
+
+    T *get() const noexcept {
+        return ptr;
+    }
+
+    T *operator->() const noexcept {
+        return ptr;
+    }
+
+    T &operator*() const noexcept {
+        return *ptr;
+    }
+
+    explicit operator bool() const noexcept {
+        return ptr != nullptr;
+    }
+
+    bool unique() const noexcept {
+        return ptr && T::RefCount::load(ptr->refs) == 1;
+    }
+
+    uint32_t use_count() const noexcept {
+        return ptr ? T::RefCount::load(ptr->refs) : 0;
+    }
+
+    friend bool operator==(const Rc &a, const Rc &b) noexcept {
+        return a.ptr == b.ptr;
+    }
+
+    friend bool operator!=(const Rc &a, const Rc &b) noexcept {
+        return a.ptr != b.ptr;
+    }
+
+    friend bool operator==(const Rc &a, std::nullptr_t) noexcept {
+        return a.ptr == nullptr;
+    }
+
+    friend bool operator!=(const Rc &a, std::nullptr_t) noexcept {
+        return a.ptr != nullptr;
+    }
+};
@@ -0,0 +1,172 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "map.h"
+
+
+namespace _test {
+
+    void assert(bool x, const char *msg) {
+        if (!x) {
+            fprintf(stderr, "%s\n", msg); fflush(stderr);
+            abort();
+        }
+    }
+
+    // counts live values, so a test can tell every node was freed
+    struct Tracked {
+        static inline std::atomic<long> live{0};
+        int v;
+
+        Tracked(int v = 0): v{v} {
+            ++live;
+        }
+
+        Tracked(const Tracked &other): v{other.v} {
+            ++live;
+        }
+
+        Tracked &operator=(const Tracked &) = default;
+
+        ~Tracked() {
+            --live;
+        }
+    };
+
+    struct DeferredPolicy: DefaultPolicy {
+        using Reclaim = DeferredReclaim;
+    };
+
+    struct BackgroundPolicy: ThreadSafePolicy {
+        using Reclaim = BackgroundReclaim;
+    };
+
+    template <typename Map>
+    Map build(int n, int step) {
+        Map m;
+        for (int i = 0; i < n; ++i) {
+            m = std::move(m).insert(i * step, i);
+        }
+        return m;
+    }
+
+    template <typename Map>
+    bool holds(const Map &m, int n, int step) {
+        for (int i = 0; i < n; i += 7) {
+            auto v = m.find(i * step);
+            if (!v || v->v != i) {
+                return false;
+            }
+        }
+        return m.size() == (size_t)n;
+    }
+
+    // dropping queues one node; drain frees bounded slices and never
+    // touches what a kept version still uses
+    template <template <typename, typename, typename> class Engine>
+    void test_deferred(int n) {
+        using Map = PersistentMap<int, Tracked, Engine, DeferredPolicy>;
+        {
+            Map big = build<Map>(n, 2);
+            DeferredReclaim::drain();
+            long live = Tracked::live;
+
+            Map kept = big.insert(1, -1).erase(0);
+            big = Map{};
+            assert(DeferredReclaim::pending() <= 2 && Tracked::live > live, "deferred -- drop is queued");
+
+            Map other = build<Map>(n, 3);
+            for (size_t freed; (freed = DeferredReclaim::drain(16)) > 0;) {
+                assert(freed <= 16, "deferred -- budget");
+                assert(holds(other, n, 3), "deferred -- other version intact while draining");
+            }
+            assert(holds(kept.insert(0, 0).erase(1), n, 2) && kept.size() == (size_t)n, "deferred -- kept version");
+        }
+        assert(DeferredReclaim::pending() > 0, "deferred -- versions queued at scope exit");
+        DeferredReclaim::drain();
+        assert(Tracked::live == 0 && DeferredReclaim::pending() == 0, "deferred -- everything freed");
+
+        // a thread's leftovers go when it exits
+        std::thread([n] {
+            build<Map>(n, 1);
+            assert(DeferredReclaim::pending() > 0, "deferred -- thread leftovers");
+        }).join();
+        assert(Tracked::live == 0, "deferred -- thread exit");
+    }
+
+    // no block is handed out twice, for each small size class
+    template <size_t... Sizes>
+    bool pools_distinct(size_t n) {
+        bool ok = true;
+        ([&] {
+            std::vector<void *> blocks;
+            std::unordered_set<void *> seen;
+            for (size_t i = 0; i < n; ++i) {
+                blocks.push_back(NodePool<Sizes>::allocate());
+                ok = seen.insert(blocks.back()).second && ok;
+            }
+            for (auto p: blocks) {
+                NodePool<Sizes>::deallocate(p);
+            }
+        }(), ...);
+        return ok;
+    }
+
+    // a version dropped on a thread whose first pool use is the retire: the
+    // queue is built before the pool caches, so it is drained after them
+    void test_thread_exit(int n) {
+        using Map = AVLMap<int, int, DeferredPolicy>;
+        for (size_t budget: {1000, 1365, 2730, 4096}) {
+            Map m = build<Map>(n, 1);
+            std::thread([&m, budget] {
+                Map mine = std::move(m);
+                mine = Map{};
+                DeferredReclaim::drain(budget);
+            }).join();
+            assert(pools_distinct<16, 32, 48, 64, 80, 96, 112, 128>(2 * n), "deferred -- thread exit after pool cache");
+        }
+    }
+
+    // versions dropped on several threads at once, freed on the background thread
+    template <template <typename, typename, typename> class Engine>
+    void test_background(int n) {
+        using Map = PersistentMap<int, Tracked, Engine, BackgroundPolicy>;
+        Map base = build<Map>(n, 1);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&base, n, t] {
+                for (int round = 0; round < 10; ++round) {
+                    Map mine = base;
+                    for (int i = 0; i < n / 10; ++i) {
+                        mine = std::move(mine).insert(n + t * n + i, i).erase(i * 7 % n);
+                    }
+                    assert(mine.size() == (size_t)n, "background -- version");
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        BackgroundReclaim::flush();
+        assert(holds(base, n, 1), "background -- shared version intact");
+        base = Map{};
+        BackgroundReclaim::flush();
+        assert(Tracked::live == 0 && BackgroundReclaim::pending() == 0, "background -- everything freed");
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000;
+    _test::test_deferred<AVLMap>(n * 10);
+    _test::test_deferred<RBMap>(n * 10);
+    _test::test_deferred<BTreeMap>(n * 10);
+    _test::test_thread_exit(n * 20);
+    _test::test_background<AVLMap>(n);
+    _test::test_background<RBMap>(n);
+    _test::test_background<BTreeMap>(n);
+}
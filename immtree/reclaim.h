@@ -0,0 +1,201 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Reclamation policies for tree nodes, selected through Policy::Reclaim:
+// what happens once the last reference to a node is gone. A node type calls
+// Reclaim::retire(node) from its `destroy` and provides
+//
+//   static void free(Node *)           destroys and deallocates one node
+//   template <typename F>
+//   void drop_children(F &&f)          empties its links, calling f(child) for
+//                                      each child it held the last reference to
+//
+// ImmediateReclaim frees the whole subtree on the spot, through the
+// destructors of the links. The deferred policies only queue the node, so
+// dropping a large version costs the caller O(1); the subtree is then freed
+// one node at a time off a queue, without recursion.
+
+struct ImmediateReclaim {
+    template <typename Node>
+    static void retire(Node *node) {
+        Node::free(node);
+    }
+};
+
+
+// Nodes waiting to be freed, and how to free each of them.
+class ReclaimQueue {
+    struct Item {
+        void *node;
+        void (*reclaim)(void *, ReclaimQueue &);
+    };
+
+    std::vector<Item> items;
+
+    template <typename Node>
+    static void reclaim(void *p, ReclaimQueue &q) {
+        auto node = static_cast<Node *>(p);
+        node->drop_children([&q](Node *child) { q.push(child); });
+        Node::free(node);
+    }
+
+public:
+    template <typename Node>
+    void push(Node *node) {
+        items.push_back({node, &reclaim<Node>});
+    }
+
+    // frees up to budget nodes, including children queued on the way
+    size_t drain(size_t budget = SIZE_MAX) {
+        size_t freed = 0;
+        while (freed < budget && !items.empty()) {
+            Item item = items.back();
+            items.pop_back();
+            item.reclaim(item.node, *this);
+            ++freed;
+        }
+        return freed;
+    }
+
+    size_t size() const {
+        return items.size();
+    }
+
+    bool empty() const {
+        return items.empty();
+    }
+
+    void swap(ReclaimQueue &other) {
+        items.swap(other.items);
+    }
+
+    void append(ReclaimQueue &other) {
+        items.insert(items.end(), other.items.begin(), other.items.end());
+        other.items.clear();
+    }
+};
+
+
+// Queues nodes per thread; the thread frees them a bounded amount at a time
+// with drain(), e.g. between requests. Anything left goes when the thread
+// exits. Works with either RefCount.
+struct DeferredReclaim {
+    struct Local {
+        ReclaimQueue queue;
+
+        // may run after the thread's pool caches are gone; NodePool then
+        // frees to its shared stock
+        ~Local() {
+            queue.drain();
+        }
+    };
+
+    static ReclaimQueue &queue() {
+        static thread_local Local local;
+        return local.queue;
+    }
+
+    template <typename Node>
+    static void retire(Node *node) {
+        queue().push(node);
+    }
+
+    // frees up to budget nodes retired on this thread, returns how many
+    static size_t drain(size_t budget = SIZE_MAX) {
+        return queue().drain(budget);
+    }
+
+    static size_t pending() {
+        return queue().size();
+    }
+};
+
+
+// Hands nodes to one background thread, started on first use, that frees
+// them in slices of `slice` nodes. The thread updates reference counts of
+// nodes other versions may still use, so the RefCount must be atomic.
+struct BackgroundReclaim {
+    static constexpr size_t slice = 4096;
+
+    class Worker {
+        std::mutex mu;
+        std::condition_variable wake, idle;
+        ReclaimQueue incoming;
+        bool busy = false;
+
+        void run() {
+            ReclaimQueue work;
+            std::unique_lock<std::mutex> lock{mu};
+            while (true) {
+                wake.wait(lock, [this] { return !incoming.empty(); });
+                work.append(incoming);
+                busy = true;
+                lock.unlock();
+                while (work.drain(slice) == slice) {
+                    // let retiring threads in between slices
+                    lock.lock();
+                    work.append(incoming);
+                    lock.unlock();
+                }
+                lock.lock();
+                busy = false;
+                if (incoming.empty()) {
+                    idle.notify_all();
+                }
+            }
+        }
+
+    public:
+        Worker() {
+            std::thread{[this] { run(); }}.detach();
+        }
+
+        template <typename Node>
+        void push(Node *node) {
+            std::lock_guard<std::mutex> lock{mu};
+            incoming.push(node);
+            if (incoming.size() == 1) {
+                wake.notify_one();
+            }
+        }
+
+        void flush() {
+            std::unique_lock<std::mutex> lock{mu};
+            idle.wait(lock, [this] { return !busy && incoming.empty(); });
+        }
+
+        size_t pending() {
+            std::lock_guard<std::mutex> lock{mu};
+            return incoming.size();
+        }
+    };
+
+    // never destroyed: the thread runs until the process exits
+    static Worker &worker() {
+        static Worker *w = new Worker;
+        return *w;
+    }
+
+    template <typename Node>
+    static void retire(Node *node) {
+        static_assert(Node::RefCount::thread_safe, "BackgroundReclaim needs AtomicCount");
+        worker().push(node);
+    }
+
+    // waits until everything retired so far is freed
+    static void flush() {
+        worker().flush();
+    }
+
+    // nodes retired but not picked up yet
+    static size_t pending() {
+        return worker().pending();
+    }
+};
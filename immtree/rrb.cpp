@@ -0,0 +1,162 @@
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "rrb.h"
+
+
+namespace _test {
+
+    void assert(bool x, const char *msg) {
+        if (!x) {
+            fprintf(stderr, "%s\n", msg); fflush(stderr);
+            abort();
+        }
+    }
+
+    template <typename Vec, typename T>
+    void assert_same(const Vec &v, const std::vector<T> &expect, const char *msg) {
+        assert(v.size() == expect.size() && v.verify(), msg);
+        size_t i = 0;
+        for (auto &x : v) {
+            assert(x == expect[i] && v[i] == expect[i], msg);
+            ++i;
+        }
+        assert(i == expect.size(), msg);
+    }
+
+    // every version kept, appended to both in place and by copy
+    template <typename Vec>
+    void test_push_back(int n) {
+        std::vector<Vec> versions(1);
+        for (int i = 0; i < n; ++i) {
+            versions.push_back(i % 3 ? versions.back().push_back(i) : Vec{versions.back()}.push_back(i));
+        }
+        for (int k = 0; k <= n; k += 7) {
+            const Vec &v = versions[k];
+            assert(v.size() == (size_t)k && v.verify(), "push_back -- old version");
+            for (int i = 0; i < k; i += 5) {
+                assert(v[i] == i, "push_back -- old contents");
+            }
+        }
+        Vec big;
+        for (int i = 0; i < n * 100; ++i) {
+            big = std::move(big).push_back(i);
+        }
+        std::vector<int> expect(n * 100);
+        for (int i = 0; i < n * 100; ++i) {
+            expect[i] = i;
+        }
+        assert_same(big, expect, "push_back -- in place");
+    }
+
+    template <typename Vec>
+    void test_set(int n) {
+        std::default_random_engine e{};
+        std::vector<int> expect(n);
+        Vec v = Vec::from(expect.begin(), expect.end());
+        for (int i = 0; i < n; ++i) {
+            size_t at = e() % n;
+            Vec before = v;
+            v = i % 2 ? v.set(at, i) : std::move(v).set(at, i);
+            assert(before[at] == expect[at], "set -- old version");
+            expect[at] = i;
+            assert(v[at] == i, "set -- new version");
+        }
+        assert_same(v, expect, "set");
+    }
+
+    // random pieces glued and cut again, checked against std::vector
+    template <typename Vec>
+    void test_concat_slice(int n) {
+        std::default_random_engine e{};
+        std::vector<std::pair<Vec, std::vector<int>>> pool;
+        int next = 0;
+        for (int i = 0; i < 16; ++i) {
+            int len = e() % (i < 8 ? 40 : 3000);
+            std::vector<int> expect;
+            for (int j = 0; j < len; ++j) {
+                expect.push_back(next++);
+            }
+            pool.emplace_back(Vec::from(expect.begin(), expect.end()), expect);
+        }
+
+        for (int round = 0; round < n; ++round) {
+            auto &[a, ea] = pool[e() % pool.size()];
+            auto &[b, eb] = pool[e() % pool.size()];
+            if (e() % 2) {
+                Vec c = Vec::concat(a, b);
+                std::vector<int> ec = ea;
+                ec.insert(ec.end(), eb.begin(), eb.end());
+                assert_same(c, ec, "concat");
+                if (ec.size() < 200000) {
+                    pool.emplace_back(std::move(c), std::move(ec));
+                }
+            }
+            else {
+                size_t from = ea.empty() ? 0 : e() % ea.size(), to = from + e() % (ea.size() - from + 1);
+                Vec s = a.slice(from, to);
+                std::vector<int> es(ea.begin() + from, ea.begin() + to);
+                assert_same(s, es, "slice");
+                s = std::move(s).push_back(-round);
+                es.push_back(-round);
+                pool.emplace_back(std::move(s), std::move(es));
+            }
+            if (pool.size() > 64) {
+                pool.erase(pool.begin() + e() % pool.size());
+            }
+        }
+        for (auto &[v, expect] : pool) {
+            assert_same(v, expect, "concat slice -- kept versions");
+        }
+    }
+
+    // a long chain of small concats stays shallow enough to index quickly
+    template <typename Vec>
+    void test_many_concats(int n) {
+        Vec v;
+        std::vector<int> expect;
+        for (int i = 0; i < n; ++i) {
+            std::vector<int> piece(i % 37 + 1, i);
+            v = Vec::concat(v, Vec::from(piece.begin(), piece.end()));
+            expect.insert(expect.end(), piece.begin(), piece.end());
+        }
+        assert_same(v, expect, "many concats");
+        assert_same(v.slice(expect.size() / 3, expect.size() / 2),
+                    std::vector<int>(expect.begin() + expect.size() / 3, expect.begin() + expect.size() / 2),
+                    "many concats -- slice");
+    }
+
+    // values that own memory are copied and freed with the nodes
+    void test_strings(int n) {
+        using Vec = RRBVector<std::string>;
+        std::vector<std::string> expect;
+        Vec v;
+        for (int i = 0; i < n; ++i) {
+            expect.push_back(std::to_string(i) + std::string(20, 'x'));
+            v = std::move(v).push_back(expect.back());
+        }
+        Vec w = Vec::concat(v.drop(n / 3), v.take(n / 3)).set(0, "first");
+        std::vector<std::string> ew(expect.begin() + n / 3, expect.end());
+        ew.insert(ew.end(), expect.begin(), expect.begin() + n / 3);
+        ew[0] = "first";
+        assert_same(w, ew, "strings");
+        assert_same(v, expect, "strings -- original");
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000;
+    _test::test_push_back<RRBVector<int>>(n);
+    _test::test_push_back<RRBVector<int, DefaultPolicy, 2>>(n);
+    _test::test_set<RRBVector<int>>(n * 10);
+    _test::test_set<RRBVector<int, DefaultPolicy, 2>>(n);
+    _test::test_concat_slice<RRBVector<int>>(n);
+    _test::test_concat_slice<RRBVector<int, DefaultPolicy, 2>>(n);
+    _test::test_many_concats<RRBVector<int>>(n * 10);
+    _test::test_many_concats<RRBVector<int, DefaultPolicy, 2>>(n);
+    _test::test_strings(n * 10);
+}
@@ -0,0 +1,655 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+
+#include "policy.h"
+
+
+// Persistent vector as a relaxed radix-balanced tree: nodes hold up to
+// Branch children or values, and the last 1..Branch elements sit in a tail
+// leaf outside the tree. push_back writes the tail and moves it into the
+// tree once it is full, so appends are O(1) amortised. get and set are
+// O(log n); concat and slice are O(log n) too, at the price of nodes that
+// are not full. Every inner node keeps the running element counts of its
+// children, and lookups start at the slot the radix would give for full
+// children and step right from there. V must be default constructible.
+template <typename V, typename Policy = DefaultPolicy, int Bits = 5>
+class RRBVector {
+    static_assert(Bits >= 2 && Bits <= 8, "Bits must be between 2 and 8");
+
+    static constexpr int Branch = 1 << Bits;
+    // how many nodes a concat may leave on one level beyond the fewest that
+    // hold their children
+    static constexpr int extras = 2;
+
+    struct Leaf;
+    struct Inner;
+
+    struct Node {
+        using RefCount = typename Policy::RefCount;
+
+        mutable typename RefCount::type refs{1};
+        int n;
+        bool leaf;
+
+        Node(int n, bool leaf): n{n}, leaf{leaf} {}
+
+        static void destroy(Node *node) {
+            Policy::Reclaim::retire(node);
+        }
+
+        static void free(Node *node) {
+            if (node->leaf) {
+                Policy::Alloc::destroy(static_cast<Leaf *>(node));
+            }
+            else {
+                Policy::Alloc::destroy(static_cast<Inner *>(node));
+            }
+        }
+
+        template <typename F>
+        void drop_children(F &&f) {
+            if (leaf) {
+                return;
+            }
+            for (auto &link : static_cast<Inner *>(this)->children) {
+                Node *child = link.release();
+                if (child && RefCount::dec(child->refs)) {
+                    f(child);
+                }
+            }
+        }
+    };
+
+    struct Leaf: Node {
+        V vals[Branch];
+
+        Leaf(): Node{0, true} {}
+
+        Leaf(const Leaf &other): Node{other.n, true} {
+            std::copy(other.vals, other.vals + other.n, vals);
+        }
+    };
+
+    struct Inner: Node {
+        size_t sizes[Branch];   // elements in children[0..i]
+        Rc<Node> children[Branch];
+
+        Inner(): Node{0, false} {}
+
+        Inner(const Inner &other): Node{other.n, false} {
+            std::copy(other.sizes, other.sizes + other.n, sizes);
+            std::copy(other.children, other.children + other.n, children);
+        }
+    };
+
+    Rc<Node> root;      // everything before the tail
+    Rc<Node> tail;      // null only when empty
+    size_t _size;
+    int height;         // of root, 0 when it is a leaf
+
+    RRBVector(Rc<Node> root, int height, Rc<Node> tail, size_t size):
+        root{std::move(root)}, tail{std::move(tail)}, _size{size}, height{height} {}
+
+public:
+    class iterator;
+    using const_iterator = iterator;
+
+    RRBVector(): root{}, tail{}, _size{0}, height{0} {}
+
+    template <typename It>
+    static RRBVector from(It first, It last) {
+        RRBVector v;
+        for (; first != last; ++first) {
+            v.push_back_at(*first);
+        }
+        return v;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    // i < size()
+    const V &operator[](size_t i) const {
+        const Node *leaf = leaf_for(i);
+        return static_cast<const Leaf *>(leaf)->vals[i];
+    }
+
+    RRBVector set(size_t i, V val) const & {
+        RRBVector v = *this;
+        v.set_at(i, val);
+        return v;
+    }
+
+    RRBVector set(size_t i, V val) && {
+        set_at(i, val);
+        return std::move(*this);
+    }
+
+    RRBVector push_back(V val) const & {
+        RRBVector v = *this;
+        v.push_back_at(val);
+        return v;
+    }
+
+    RRBVector push_back(V val) && {
+        push_back_at(val);
+        return std::move(*this);
+    }
+
+    // a followed by b
+    static RRBVector concat(const RRBVector &a, const RRBVector &b) {
+        if (a.empty()) {
+            return b;
+        }
+        if (b.empty()) {
+            return a;
+        }
+        if (!b.root) {
+            RRBVector v = a;
+            auto leaf = static_cast<const Leaf *>(b.tail.get());
+            for (int i = 0; i < leaf->n; ++i) {
+                v.push_back_at(leaf->vals[i]);
+            }
+            return v;
+        }
+        Rc<Node> left = a.root;
+        int lh = push_leaf(left, a.height, a.tail);
+        Rc<Node> top = concat_trees(left, lh, b.root, b.height);
+        int h = std::max(lh, b.height) + 1;
+        collapse(top, h);
+        return {std::move(top), h, b.tail, a._size + b._size};
+    }
+
+    // the first k elements
+    RRBVector take(size_t k) const {
+        if (k >= _size) {
+            return *this;
+        }
+        if (k == 0) {
+            return {};
+        }
+        size_t off = tail_offset();
+        if (k > off) {
+            return {root, height, take_tree(tail, 0, k - off), k};
+        }
+        // the leaf holding the new last element becomes the tail
+        size_t i = k - 1;
+        Node *leaf = leaf_for(i);
+        size_t start = k - 1 - i;
+        Rc<Node> new_root;
+        int h = 0;
+        if (start > 0) {
+            new_root = take_tree(root, height, start);
+            h = height;
+            collapse(new_root, h);
+        }
+        return {std::move(new_root), h, take_tree(Rc<Node>::share(leaf), 0, i + 1), k};
+    }
+
+    // all but the first k elements
+    RRBVector drop(size_t k) const {
+        if (k == 0) {
+            return *this;
+        }
+        if (k >= _size) {
+            return {};
+        }
+        size_t off = tail_offset();
+        if (k >= off) {
+            return {nullptr, 0, drop_tree(tail, 0, k - off), _size - k};
+        }
+        Rc<Node> new_root = drop_tree(root, height, k);
+        int h = height;
+        collapse(new_root, h);
+        return {std::move(new_root), h, tail, _size - k};
+    }
+
+    // elements [from, to)
+    RRBVector slice(size_t from, size_t to) const {
+        return from < to ? take(to).drop(from) : RRBVector{};
+    }
+
+    iterator begin() const;
+    iterator end() const;
+
+    // checks node sizes, depth and size tables of the whole tree, O(n)
+    bool verify() const {
+        if (!tail) {
+            return _size == 0 && !root && height == 0;
+        }
+        if (!tail->leaf || tail->n < 1 || (!root && height != 0)) {
+            return false;
+        }
+        size_t n = 0;
+        return (!root || verify(root.get(), height, n)) && n + tail->n == _size;
+    }
+
+private:
+    size_t tail_offset() const {
+        return _size - (tail ? tail->n : 0);
+    }
+
+    static size_t count(const Node *node) {
+        return node->leaf ? node->n : static_cast<const Inner *>(node)->sizes[node->n - 1];
+    }
+
+    // Child of a node at height h that holds element i, with i made relative
+    // to it. Children hold at most Branch^h elements, so the slot cannot be
+    // left of i >> (Bits * h).
+    static int child_index(const Inner *inner, int h, size_t &i) {
+        int j = i >> (Bits * h);
+        while (inner->sizes[j] <= i) {
+            ++j;
+        }
+        if (j > 0) {
+            i -= inner->sizes[j - 1];
+        }
+        return j;
+    }
+
+    // leaf holding element i, with i made relative to it
+    Node *leaf_for(size_t &i) const {
+        size_t off = tail_offset();
+        if (i >= off) {
+            i -= off;
+            return tail.get();
+        }
+        Node *node = root.get();
+        for (int h = height; h > 0; --h) {
+            auto inner = static_cast<Inner *>(node);
+            node = inner->children[child_index(inner, h, i)].get();
+        }
+        return node;
+    }
+
+    static Rc<Node> mk_leaf() {
+        return Rc<Node>::adopt(Policy::Alloc::template create<Leaf>());
+    }
+
+    static Rc<Node> mk_inner() {
+        return Rc<Node>::adopt(Policy::Alloc::template create<Inner>());
+    }
+
+    static Leaf *as_leaf(const Rc<Node> &node) {
+        return static_cast<Leaf *>(node.get());
+    }
+
+    static Inner *as_inner(const Rc<Node> &node) {
+        return static_cast<Inner *>(node.get());
+    }
+
+    // replaces a shared node with a private copy so it can be modified
+    static Node *own(Rc<Node> &slot) {
+        if (!slot.unique()) {
+            if (slot->leaf) {
+                slot = Rc<Node>::adopt(Policy::Alloc::template create<Leaf>(*as_leaf(slot)));
+            }
+            else {
+                slot = Rc<Node>::adopt(Policy::Alloc::template create<Inner>(*as_inner(slot)));
+            }
+        }
+        return slot.get();
+    }
+
+    static void push_child(Inner *inner, Rc<Node> child) {
+        size_t before = inner->n > 0 ? inner->sizes[inner->n - 1] : 0;
+        inner->sizes[inner->n] = before + count(child.get());
+        inner->children[inner->n++] = std::move(child);
+    }
+
+    void set_at(size_t i, V &val) {
+        size_t off = tail_offset();
+        if (i >= off) {
+            static_cast<Leaf *>(own(tail))->vals[i - off] = std::move(val);
+            return;
+        }
+        Rc<Node> *slot = &root;
+        for (int h = height; h > 0; --h) {
+            auto inner = static_cast<Inner *>(own(*slot));
+            slot = &inner->children[child_index(inner, h, i)];
+        }
+        static_cast<Leaf *>(own(*slot))->vals[i] = std::move(val);
+    }
+
+    template <typename T>
+    void push_back_at(T &&val) {
+        if (tail && tail->n == Branch) {
+            height = push_leaf(root, height, std::move(tail));
+        }
+        if (!tail) {
+            tail = mk_leaf();
+        }
+        auto leaf = static_cast<Leaf *>(own(tail));
+        leaf->vals[leaf->n++] = std::forward<T>(val);
+        ++_size;
+    }
+
+    // node under h single-child inner nodes
+    static Rc<Node> wrap(Rc<Node> node, int h) {
+        while (h-- > 0) {
+            auto parent = mk_inner();
+            push_child(as_inner(parent), std::move(node));
+            node = std::move(parent);
+        }
+        return node;
+    }
+
+    // whether a leaf fits in below the right edge of a node at height h
+    static bool has_room(const Node *node, int h) {
+        for (; h > 0; --h) {
+            if (node->n < Branch) {
+                return true;
+            }
+            node = static_cast<const Inner *>(node)->children[node->n - 1].get();
+        }
+        return false;
+    }
+
+    // Adds a leaf, which need not be full, after the last one of the tree of
+    // the given height in `slot`. Returns the new height.
+    static int push_leaf(Rc<Node> &slot, int height, Rc<Node> leaf) {
+        if (!slot) {
+            slot = std::move(leaf);
+            return 0;
+        }
+        if (has_room(slot.get(), height)) {
+            append_leaf(slot, height, std::move(leaf));
+            return height;
+        }
+        auto top = mk_inner();
+        push_child(as_inner(top), std::move(slot));
+        push_child(as_inner(top), wrap(std::move(leaf), height));
+        slot = std::move(top);
+        return height + 1;
+    }
+
+    static void append_leaf(Rc<Node> &slot, int height, Rc<Node> leaf) {
+        auto inner = static_cast<Inner *>(own(slot));
+        Rc<Node> &last = inner->children[inner->n - 1];
+        if (has_room(last.get(), height - 1)) {
+            size_t n = leaf->n;
+            append_leaf(last, height - 1, std::move(leaf));
+            inner->sizes[inner->n - 1] += n;
+        }
+        else {
+            push_child(inner, wrap(std::move(leaf), height - 1));
+        }
+    }
+
+    // removes single-child nodes from the top
+    static void collapse(Rc<Node> &root, int &height) {
+        while (height > 0 && root->n == 1) {
+            Rc<Node> child = as_inner(root)->children[0];
+            root = std::move(child);
+            --height;
+        }
+    }
+
+    // the first k elements of a subtree, 0 < k; shares what it keeps whole
+    static Rc<Node> take_tree(const Rc<Node> &node, int h, size_t k) {
+        if (k == count(node.get())) {
+            return node;
+        }
+        if (h == 0) {
+            auto copy = mk_leaf();
+            std::copy(as_leaf(node)->vals, as_leaf(node)->vals + k, as_leaf(copy)->vals);
+            copy->n = k;
+            return copy;
+        }
+        const Inner *src = as_inner(node);
+        auto copy = mk_inner();
+        size_t i = k - 1;
+        int j = child_index(src, h, i);
+        for (int c = 0; c < j; ++c) {
+            push_child(as_inner(copy), src->children[c]);
+        }
+        push_child(as_inner(copy), take_tree(src->children[j], h - 1, i + 1));
+        return copy;
+    }
+
+    // all but the first k elements of a subtree, k < its size
+    static Rc<Node> drop_tree(const Rc<Node> &node, int h, size_t k) {
+        if (k == 0) {
+            return node;
+        }
+        if (h == 0) {
+            auto copy = mk_leaf();
+            std::copy(as_leaf(node)->vals + k, as_leaf(node)->vals + node->n, as_leaf(copy)->vals);
+            copy->n = node->n - k;
+            return copy;
+        }
+        const Inner *src = as_inner(node);
+        auto copy = mk_inner();
+        int j = child_index(src, h, k);
+        push_child(as_inner(copy), drop_tree(src->children[j], h - 1, k));
+        for (int c = j + 1; c < src->n; ++c) {
+            push_child(as_inner(copy), src->children[c]);
+        }
+        return copy;
+    }
+
+    // Joins two trees into one node a level above the taller; its one or two
+    // children then have the same height as the taller tree. Only the nodes
+    // along the seam are rebuilt.
+    static Rc<Node> concat_trees(const Rc<Node> &l, int hl, const Rc<Node> &r, int hr) {
+        if (hl > hr) {
+            const Inner *li = as_inner(l);
+            return rebalance(li, concat_trees(li->children[li->n - 1], hl - 1, r, hr), nullptr, hl);
+        }
+        if (hl < hr) {
+            const Inner *ri = as_inner(r);
+            return rebalance(nullptr, concat_trees(l, hl, ri->children[0], hr - 1), ri, hr);
+        }
+        auto top = mk_inner();
+        if (hl == 0) {
+            if (l->n + r->n <= Branch) {
+                auto merged = mk_leaf();
+                auto dst = as_leaf(merged);
+                std::copy(as_leaf(l)->vals, as_leaf(l)->vals + l->n, dst->vals);
+                std::copy(as_leaf(r)->vals, as_leaf(r)->vals + r->n, dst->vals + l->n);
+                merged->n = l->n + r->n;
+                push_child(as_inner(top), std::move(merged));
+            }
+            else {
+                push_child(as_inner(top), l);
+                push_child(as_inner(top), r);
+            }
+            return top;
+        }
+        const Inner *li = as_inner(l), *ri = as_inner(r);
+        return rebalance(li, concat_trees(li->children[li->n - 1], hl - 1, ri->children[0], hr - 1), ri, hl);
+    }
+
+    // The children of left but its last, of mid and of right but its first,
+    // all at height h - 1, under at most two nodes of height h, which go
+    // under a new node. Nodes too short for the count to stay within
+    // `extras` of the fewest are merged into their right neighbours.
+    static Rc<Node> rebalance(const Inner *left, const Rc<Node> &mid, const Inner *right, int h) {
+        const Rc<Node> *all[2 * Branch];
+        int n = 0;
+        for (int c = 0; left && c < left->n - 1; ++c) {
+            all[n++] = &left->children[c];
+        }
+        for (int c = 0; c < mid->n; ++c) {
+            all[n++] = &as_inner(mid)->children[c];
+        }
+        for (int c = 1; right && c < right->n; ++c) {
+            all[n++] = &right->children[c];
+        }
+
+        int plan[2 * Branch];
+        int slots = 0;
+        for (int i = 0; i < n; ++i) {
+            plan[i] = (*all[i])->n;
+            slots += plan[i];
+        }
+        int packed_n = plan_nodes(plan, n, slots);
+
+        Rc<Node> packed[2 * Branch];
+        int src = 0, offset = 0;
+        for (int k = 0; k < packed_n; ++k) {
+            const Node *s = all[src]->get();
+            if (offset == 0 && s->n == plan[k]) {
+                packed[k] = *all[src++];
+                continue;
+            }
+            Rc<Node> node = h == 1 ? mk_leaf() : mk_inner();
+            while (node->n < plan[k]) {
+                s = all[src]->get();
+                int take = std::min(plan[k] - node->n, s->n - offset);
+                if (h == 1) {
+                    auto from = static_cast<const Leaf *>(s)->vals + offset;
+                    std::copy(from, from + take, as_leaf(node)->vals + node->n);
+                    node->n += take;
+                }
+                else {
+                    for (int c = offset; c < offset + take; ++c) {
+                        push_child(as_inner(node), static_cast<const Inner *>(s)->children[c]);
+                    }
+                }
+                offset += take;
+                if (offset == s->n) {
+                    ++src;
+                    offset = 0;
+                }
+            }
+            packed[k] = std::move(node);
+        }
+
+        auto top = mk_inner();
+        for (int k = 0; k < packed_n; k += Branch) {
+            auto node = mk_inner();
+            for (int c = k; c < std::min(packed_n, k + Branch); ++c) {
+                push_child(as_inner(node), std::move(packed[c]));
+            }
+            push_child(as_inner(top), std::move(node));
+        }
+        return top;
+    }
+
+    // Rewrites plan, the slot counts of n nodes, so that at most `extras`
+    // more nodes than needed remain: the first node with fewer than
+    // Branch - 1 slots is spread over the ones after it. Returns the new n.
+    static int plan_nodes(int *plan, int n, int slots) {
+        int optimal = (slots + Branch - 1) / Branch;
+        int i = 0;
+        while (n > optimal + extras) {
+            while (plan[i] >= Branch - 1) {
+                ++i;
+            }
+            int remaining = plan[i];
+            do {
+                int fill = std::min(remaining + plan[i + 1], Branch);
+                plan[i] = fill;
+                remaining += plan[i + 1] - fill;
+                ++i;
+            } while (remaining > 0);
+            std::move(plan + i + 1, plan + n, plan + i);
+            --n;
+            --i;
+        }
+        return n;
+    }
+
+    static bool verify(const Node *node, int h, size_t &n) {
+        if (node->n < 1 || node->n > Branch || node->leaf != (h == 0)) {
+            return false;
+        }
+        if (node->leaf) {
+            n += node->n;
+            return true;
+        }
+        auto inner = static_cast<const Inner *>(node);
+        size_t before = n;
+        for (int i = 0; i < inner->n; ++i) {
+            if (!verify(inner->children[i].get(), h - 1, n) || inner->sizes[i] != n - before) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+
+// Forward iterator over the elements in order; looks a leaf up once per
+// leaf. Valid as long as the vector it comes from.
+template <typename V, typename Policy, int Bits>
+class RRBVector<V, Policy, Bits>::iterator {
+    friend class RRBVector;
+
+    const RRBVector *vec = nullptr;
+    size_t i = 0;
+    const Leaf *leaf = nullptr;     // holds elements [first, last)
+    size_t first = 0, last = 0;
+
+    iterator(const RRBVector *vec, size_t i): vec{vec}, i{i} {
+        locate();
+    }
+
+    void locate() {
+        if (i < vec->_size) {
+            size_t k = i;
+            leaf = static_cast<const Leaf *>(vec->leaf_for(k));
+            first = i - k;
+            last = first + leaf->n;
+        }
+    }
+
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = V;
+    using difference_type = std::ptrdiff_t;
+    using reference = const V &;
+    using pointer = const V *;
+
+    iterator() = default;
+
+    reference operator*() const {
+        return leaf->vals[i - first];
+    }
+
+    pointer operator->() const {
+        return &leaf->vals[i - first];
+    }
+
+    iterator &operator++() {
+        if (++i == last) {
+            locate();
+        }
+        return *this;
+    }
+
+    iterator operator++(int) {
+        auto old = *this;
+        ++*this;
+        return old;
+    }
+
+    friend bool operator==(const iterator &a, const iterator &b) {
+        return a.i == b.i;
+    }
+
+    friend bool operator!=(const iterator &a, const iterator &b) {
+        return a.i != b.i;
+    }
+};
+
+template <typename V, typename Policy, int Bits>
+auto RRBVector<V, Policy, Bits>::begin() const -> iterator {
+    return iterator{this, 0};
+}
+
+template <typename V, typename Policy, int Bits>
+auto RRBVector<V, Policy, Bits>::end() const -> iterator {
+    return iterator{this, _size};
+}
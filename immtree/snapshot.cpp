@@ -0,0 +1,138 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "snapshot.h"
+
+
+namespace _test {
+
+    void assert(bool x, const char *msg) {
+        if (!x) {
+            fprintf(stderr, "%s\n", msg); fflush(stderr);
+            abort();
+        }
+    }
+
+    std::string temp_path(const char *name) {
+        const char *dir = getenv("TMPDIR");
+        return std::string(dir ? dir : "/tmp") + "/" + name;
+    }
+
+    template <typename Version>
+    void assert_same(const Version &v, const std::map<int, double> &expect, const char *msg) {
+        assert(v.size() == expect.size(), msg);
+        auto it = v.begin();
+        for (auto &[k, val] : expect) {
+            assert(it != v.end() && it.key() == k && it->second == val, msg);
+            assert(v.find_default(k, -1) == val, msg);
+            assert(!v.find(k + 1) || expect.count(k + 1), msg);
+            ++it;
+        }
+        assert(it == v.end(), msg);
+    }
+
+    void test_round_trip(int n) {
+        using Map = AVLMap<int, double>;
+        std::default_random_engine e{};
+        std::vector<Map> versions(1);
+        std::vector<std::map<int, double>> expect(1);
+
+        for (int i = 0; i < n; ++i) {
+            int k = std::uniform_int_distribution<int>(0, n)(e);
+            auto m = versions.back();
+            auto em = expect.back();
+            if (i % 4 == 0) {
+                m = m.erase(k);
+                em.erase(k);
+            }
+            else {
+                m = m.insert(k, i * 0.5);
+                em[k] = i * 0.5;
+            }
+            if (i % (n / 10 + 1) == 0) {
+                versions.push_back(m);
+                expect.push_back(em);
+            }
+            else {
+                versions.back() = m;
+                expect.back() = em;
+            }
+        }
+
+        auto path = temp_path("immtree_snapshot_test");
+        size_t total = 0;
+        {
+            SnapshotWriter<int, double> w{path.c_str()};
+            for (size_t i = 0; i < versions.size(); ++i) {
+                assert(w.add(versions[i]) == i, "writer -- index");
+                total += versions[i].size();
+            }
+            // the last version shares most of its nodes with the one before
+            assert(w.nodes() < total, "writer -- sharing");
+            w.finish();
+        }
+
+        MappedSnapshot<int, double> snap{path.c_str()};
+        assert(snap.versions() == versions.size(), "reader -- versions");
+        for (size_t i = 0; i < versions.size(); ++i) {
+            assert_same(snap.version(i), expect[i], "reader -- version");
+            auto loaded = snap.version(i).load();
+            assert(loaded.verify(), "reader -- load");
+            auto d = Map::diff(loaded, versions[i]);
+            assert(d.added.empty() && d.removed.empty() && d.changed.empty(), "reader -- load");
+        }
+
+        // a snapshot with a different value type is refused
+        bool refused = false;
+        try {
+            MappedSnapshot<int, int> wrong{path.c_str()};
+        }
+        catch (const std::runtime_error &) {
+            refused = true;
+        }
+        assert(refused, "reader -- layout check");
+        remove(path.c_str());
+    }
+
+    AVLMap<int, double> build(int i, int n) {
+        auto t = AVLMap<int, double>{}.transient();
+        for (int k = 0; k < n; ++k) {
+            t.insert(k, i * 1000 + k);
+        }
+        return std::move(t).persistent();
+    }
+
+    // versions freed right after add() must not pass their node addresses
+    // on to the next version's nodes
+    void test_temporaries(int n) {
+        auto path = temp_path("immtree_snapshot_temporaries");
+        {
+            SnapshotWriter<int, double> w{path.c_str()};
+            for (int i = 0; i < 4; ++i) {
+                w.add(build(i, n));
+            }
+            w.finish();
+        }
+        MappedSnapshot<int, double> snap{path.c_str()};
+        assert(snap.versions() == 4, "temporaries -- versions");
+        for (int i = 0; i < 4; ++i) {
+            std::map<int, double> expect;
+            for (int k = 0; k < n; ++k) {
+                expect[k] = i * 1000 + k;
+            }
+            assert_same(snap.version(i), expect, "temporaries -- version");
+        }
+        remove(path.c_str());
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000;
+    _test::test_round_trip(n * 10);
+    _test::test_temporaries(n / 10);
+}
@@ -0,0 +1,385 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avl.h"
+
+
+// On-disk snapshot of one or more AVLMap versions, laid out so that a reader
+// can mmap the file and search it in place.
+//
+//   SnapshotHeader | nodes ... | roots[n_roots]
+//
+// Nodes are written children first and refer to each other by file offset
+// (0 for none). A node reachable from several versions is written once, so
+// the file keeps the sharing the versions had in memory. Keys and values are
+// stored as raw bytes in the native byte order; the header records enough
+// of the layout to reject files written with a different one.
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t byte_order;    // 0x01020304 as written
+    uint32_t node_size;
+    uint32_t key_size;
+    uint32_t val_size;
+    uint64_t n_roots;
+    uint64_t roots;         // offset of the root table
+};
+
+template <typename K, typename V>
+struct SnapshotNode {
+    uint64_t left, right;
+    uint64_t count;
+    K key;
+    V val;
+};
+
+inline constexpr char snapshot_magic[8] = {'I', 'M', 'T', 'S', 'N', 'A', 'P', '1'};
+
+
+template <typename K, typename V>
+class SnapshotWriter {
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "snapshots store keys and values as raw bytes");
+
+    using Node = SnapshotNode<K, V>;
+
+    FILE *out;
+    uint64_t offset;
+    std::unordered_map<const void *, uint64_t> written;
+    std::vector<uint64_t> roots;
+    // the versions added, kept alive until finish(): `written` goes by node
+    // address, which a freed node could hand on to a later version's node
+    std::vector<std::shared_ptr<const void>> held;
+
+    static constexpr uint64_t align_up(uint64_t x) {
+        return (x + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    }
+
+    void write(const void *data, size_t size) {
+        if (fwrite(data, 1, size, out) != size) {
+            throw std::system_error(errno, std::generic_category(), "snapshot write");
+        }
+        offset += size;
+    }
+
+    template <typename N>
+    uint64_t write_node(const N *node) {
+        if (!node) {
+            return 0;
+        }
+        auto it = written.find(node);
+        if (it != written.end()) {
+            return it->second;
+        }
+
+        Node rec;
+        memset(&rec, 0, sizeof rec);     // no stray bytes in the padding
+        rec.left = write_node(node->left.get());
+        rec.right = write_node(node->right.get());
+        rec.count = node->count;
+        rec.key = node->key;
+        rec.val = node->val;
+
+        uint64_t at = offset;
+        write(&rec, sizeof rec);
+        written.emplace(node, at);
+        return at;
+    }
+
+public:
+    explicit SnapshotWriter(const char *path): out{fopen(path, "wb")}, offset{0} {
+        if (!out) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        char zeros[align_up(sizeof(SnapshotHeader))] = {};
+        write(zeros, sizeof zeros);
+    }
+
+    ~SnapshotWriter() {
+        if (out) {
+            fclose(out);
+        }
+    }
+
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    // writes the nodes of map no earlier version shared, returns its index in the file
+    template <typename Policy>
+    size_t add(const AVLMap<K, V, Policy> &map) {
+        held.push_back(std::make_shared<const AVLMap<K, V, Policy>>(map));
+        roots.push_back(write_node(map.root.get()));
+        return roots.size() - 1;
+    }
+
+    // nodes written so far, each shared node counted once
+    size_t nodes() const {
+        return written.size();
+    }
+
+    void finish() {
+        SnapshotHeader header;
+        memset(&header, 0, sizeof header);
+        memcpy(header.magic, snapshot_magic, sizeof header.magic);
+        header.byte_order = 0x01020304;
+        header.node_size = sizeof(Node);
+        header.key_size = sizeof(K);
+        header.val_size = sizeof(V);
+        header.n_roots = roots.size();
+        header.roots = offset;
+
+        write(roots.data(), roots.size() * sizeof(uint64_t));
+        if (fseek(out, 0, SEEK_SET) != 0) {
+            throw std::system_error(errno, std::generic_category(), "snapshot seek");
+        }
+        write(&header, sizeof header);
+        int err = fclose(out) == 0 ? 0 : errno;
+        out = nullptr;
+        held.clear();
+        if (err) {
+            throw std::system_error(err, std::generic_category(), "snapshot close");
+        }
+    }
+};
+
+
+// Read-only view of a snapshot file. Lookups and iteration read the mapped
+// nodes directly; nothing is copied or rebuilt when the file is opened. Only
+// the header and the root table are checked, node records are trusted.
+template <typename K, typename V>
+class MappedSnapshot {
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "snapshots store keys and values as raw bytes");
+
+    using Node = SnapshotNode<K, V>;
+
+    const char *base = nullptr;
+    size_t length = 0;
+    const uint64_t *roots = nullptr;
+    size_t n_roots = 0;
+
+    [[noreturn]] void fail(const std::string &what) {
+        release();
+        throw std::runtime_error("snapshot: " + what);
+    }
+
+    static const Node *at(const char *base, uint64_t offset) {
+        return offset ? reinterpret_cast<const Node *>(base + offset) : nullptr;
+    }
+
+    void release() {
+        if (base) {
+            munmap(const_cast<char *>(base), length);
+            base = nullptr;
+        }
+    }
+
+public:
+    class Version;
+    class iterator;
+
+    explicit MappedSnapshot(const char *path) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            int err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), path);
+        }
+        length = st.st_size;
+        void *p = length ? mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        int err = errno;
+        close(fd);
+        if (p == MAP_FAILED) {
+            if (!length) {
+                throw std::runtime_error("snapshot: empty file");
+            }
+            throw std::system_error(err, std::generic_category(), path);
+        }
+        base = static_cast<const char *>(p);
+
+        SnapshotHeader header;
+        if (length < sizeof header) {
+            fail("truncated header");
+        }
+        memcpy(&header, base, sizeof header);
+        if (memcmp(header.magic, snapshot_magic, sizeof header.magic) != 0) {
+            fail("bad magic");
+        }
+        if (header.byte_order != 0x01020304 || header.node_size != sizeof(Node) ||
+            header.key_size != sizeof(K) || header.val_size != sizeof(V)) {
+            fail("written with a different key, value or node layout");
+        }
+        if (header.roots % alignof(uint64_t) != 0 || header.roots > length ||
+            header.n_roots > (length - header.roots) / sizeof(uint64_t)) {
+            fail("root table out of range");
+        }
+        roots = reinterpret_cast<const uint64_t *>(base + header.roots);
+        n_roots = header.n_roots;
+        for (size_t i = 0; i < n_roots; ++i) {
+            if (roots[i] && (roots[i] % alignof(Node) != 0 || roots[i] + sizeof(Node) > header.roots)) {
+                fail("root out of range");
+            }
+        }
+    }
+
+    ~MappedSnapshot() {
+        release();
+    }
+
+    MappedSnapshot(const MappedSnapshot &) = delete;
+    MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+
+    size_t versions() const {
+        return n_roots;
+    }
+
+    // valid while the snapshot stays open
+    Version version(size_t i) const {
+        return Version{base, at(base, roots[i])};
+    }
+};
+
+
+template <typename K, typename V>
+class MappedSnapshot<K, V>::Version {
+    friend class MappedSnapshot;
+
+    const char *base;
+    const Node *root;
+
+    Version(const char *base, const Node *root): base{base}, root{root} {}
+
+public:
+    size_t size() const {
+        return root ? root->count : 0;
+    }
+
+    const V *find(const K &key) const {
+        const Node *node = root;
+        while (node) {
+            if (key < node->key) {
+                node = at(base, node->left);
+            }
+            else if (node->key < key) {
+                node = at(base, node->right);
+            }
+            else {
+                return &node->val;
+            }
+        }
+        return nullptr;
+    }
+
+    const V &find_default(const K &key, const V &default_value) const {
+        auto val = find(key);
+        return val ? *val : default_value;
+    }
+
+    iterator begin() const {
+        iterator it{base};
+        it.push_leftmost(root);
+        return it;
+    }
+
+    iterator end() const {
+        return iterator{base};
+    }
+
+    // copies the version back into memory, O(n)
+    template <typename Policy = DefaultPolicy>
+    AVLMap<K, V, Policy> load() const {
+        return AVLMap<K, V, Policy>::from_sorted(begin(), end());
+    }
+};
+
+
+// forward iteration in key order over a mapped version, on a fixed stack like AVLMap::iterator
+template <typename K, typename V>
+class MappedSnapshot<K, V>::iterator {
+    friend class Version;
+
+    const char *base;
+    const Node *stack[48];
+    int depth = 0;
+
+    explicit iterator(const char *base): base{base} {}
+
+    void push_leftmost(const Node *node) {
+        for (; node; node = at(base, node->left)) {
+            stack[depth++] = node;
+        }
+    }
+
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::pair<const K &, const V &>;
+    using difference_type = std::ptrdiff_t;
+    using reference = value_type;
+
+    struct pointer {
+        value_type kv;
+
+        const value_type *operator->() const {
+            return &kv;
+        }
+    };
+
+    const K &key() const {
+        return stack[depth - 1]->key;
+    }
+
+    const V &value() const {
+        return stack[depth - 1]->val;
+    }
+
+    reference operator*() const {
+        return {key(), value()};
+    }
+
+    pointer operator->() const {
+        return {{key(), value()}};
+    }
+
+    iterator &operator++() {
+        const Node *node = stack[--depth];
+        push_leftmost(at(base, node->right));
+        return *this;
+    }
+
+    iterator operator++(int) {
+        auto old = *this;
+        ++*this;
+        return old;
+    }
+
+    friend bool operator==(const iterator &a, const iterator &b) {
+        return a.depth == b.depth && (a.depth == 0 || a.stack[a.depth - 1] == b.stack[b.depth - 1]);
+    }
+
+    friend bool operator!=(const iterator &a, const iterator &b) {
+        return !(a == b);
+    }
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+
+
+// Instrumentation hooks for the persistent trees, selected through
+// Policy::Stats. NoStats compiles every hook away; CountingStats keeps
+// counters and histograms per thread.
+
+enum class TreeOp { insert, erase };
+enum class Rotation { ll, lr, rl, rr };
+
+struct NoStats {
+    static constexpr bool enabled = false;
+
+    static void op_begin() {}
+    static void op_end(TreeOp, int) {}
+    static void node_copied() {}
+    static void rotation(Rotation) {}
+    static void early_break() {}
+};
+
+struct CountingStats {
+    static constexpr bool enabled = true;
+    static constexpr int buckets = 64;   // the last bucket also takes everything longer
+
+    struct Counters {
+        size_t ops[2] = {};
+        size_t nodes_copied = 0;
+        size_t rotations[4] = {};
+        size_t early_breaks = 0;
+        size_t path_length[2][buckets] = {};    // nodes on the search path, per op
+        size_t copies[2][buckets] = {};         // nodes copied, per op
+        size_t copies_this_op = 0;
+    };
+
+    // counters of the calling thread
+    static Counters &local() {
+        static thread_local Counters counters;
+        return counters;
+    }
+
+    static void reset() {
+        local() = Counters{};
+    }
+
+    static void op_begin() {
+        local().copies_this_op = 0;
+    }
+
+    static void op_end(TreeOp op, int path_length) {
+        auto &c = local();
+        int i = static_cast<int>(op);
+        ++c.ops[i];
+        ++c.path_length[i][bucket(path_length)];
+        ++c.copies[i][bucket(c.copies_this_op)];
+    }
+
+    static void node_copied() {
+        auto &c = local();
+        ++c.nodes_copied;
+        ++c.copies_this_op;
+    }
+
+    static void rotation(Rotation r) {
+        ++local().rotations[static_cast<int>(r)];
+    }
+
+    static void early_break() {
+        ++local().early_breaks;
+    }
+
+    // one JSON object; histograms are arrays indexed by length, trailing zeros dropped
+    static void dump_json(FILE *out, const Counters &c = local()) {
+        fprintf(out, "{\"ops\": {\"insert\": %zu, \"erase\": %zu}, ", c.ops[0], c.ops[1]);
+        fprintf(out, "\"nodes_copied\": %zu, \"early_breaks\": %zu, ", c.nodes_copied, c.early_breaks);
+        fprintf(out, "\"rotations\": {\"ll\": %zu, \"lr\": %zu, \"rl\": %zu, \"rr\": %zu}, ",
+                c.rotations[0], c.rotations[1], c.rotations[2], c.rotations[3]);
+        fprintf(out, "\"path_length\": {\"insert\": ");
+        dump_histogram(out, c.path_length[0]);
+        fprintf(out, ", \"erase\": ");
+        dump_histogram(out, c.path_length[1]);
+        fprintf(out, "}, \"copies_per_op\": {\"insert\": ");
+        dump_histogram(out, c.copies[0]);
+        fprintf(out, ", \"erase\": ");
+        dump_histogram(out, c.copies[1]);
+        fprintf(out, "}}\n");
+    }
+
+private:
+    static int bucket(size_t x) {
+        return x < buckets ? static_cast<int>(x) : buckets - 1;
+    }
+
+    static void dump_histogram(FILE *out, const size_t (&h)[buckets]) {
+        int n = buckets;
+        while (n > 0 && h[n - 1] == 0) {
+            --n;
+        }
+        fputc('[', out);
+        for (int i = 0; i < n; ++i) {
+            fprintf(out, i ? ", %zu" : "%zu", h[i]);
+        }
+        fputc(']', out);
+    }
+};
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "versioned.h"
+
+
+namespace _test {
+
+    void assert(bool x, const char *msg) {
+        if (!x) {
+            fprintf(stderr, "%s\n", msg); fflush(stderr);
+            abort();
+        }
+    }
+
+    using History = VersionedMap<int, int>;
+    using Map = History::Map;
+
+    void assert_same(const Map *m, const std::map<int, int> &expect, const char *msg) {
+        assert(m && m->verify() && m->size() == expect.size(), msg);
+        auto it = expect.begin();
+        for (auto [key, val] : *m) {
+            assert(key == it->first && val == it->second, msg);
+            ++it;
+        }
+    }
+
+    // last N, with pins, checked against copies of every version
+    void test_keep_last(int n) {
+        std::default_random_engine e{};
+        History h{{10, History::Clock::duration::max(), 16}};
+        std::vector<std::map<int, int>> expect(1);
+        for (int i = 1; i <= n; ++i) {
+            int key = e() % (n / 2);
+            auto id = h.update([&](const Map &m) { return i % 5 ? m.insert(key, i) : m.erase(key); });
+            assert(id == (History::Version)i && h.head_id() == id, "keep last -- ids");
+            expect.push_back(expect.back());
+            if (i % 5) {
+                expect.back()[key] = i;
+            }
+            else {
+                expect.back().erase(key);
+            }
+            if (i % 100 == 0) {
+                assert(h.pin(i), "keep last -- pin");
+            }
+            assert(h.size() <= size_t(10 + 16 + i / 100), "keep last -- bounded");
+        }
+        h.collect();
+        assert(h.size() == 10 + (size_t)n / 100 - (n % 100 < 10), "keep last -- collected");
+        for (int i = 0; i <= n; ++i) {
+            const Map *m = h.get(i);
+            bool kept = i > n - 10 || (i > 0 && i % 100 == 0);
+            assert(!m == !kept, "keep last -- which versions");
+            if (m) {
+                assert_same(m, expect[i], "keep last -- contents");
+            }
+        }
+
+        assert(h.unpin(100) && !h.pin(99), "keep last -- unpin");
+        h.collect();
+        assert(!h.get(100) && h.get(200), "keep last -- unpinned dropped");
+        auto ids = h.versions();
+        assert(std::is_sorted(ids.begin(), ids.end()) && ids.back() == (History::Version)n, "keep last -- order");
+    }
+
+    // get() of a pinned version stays valid across the collects commit runs
+    void test_pinned_pointer() {
+        History h{{2, History::Clock::duration::zero(), 1}};
+        auto v = h.commit(Map{}.insert(1, 1));
+        assert(h.pin(v), "pinned pointer -- pin");
+        const Map *m = h.get(v);
+        for (int i = 0; i < 4; ++i) {
+            h.update([&](const Map &head) { return head.insert(i + 2, i); });
+        }
+        assert(h.get(v) == m && m->size() == 1 && m->find(1), "pinned pointer -- still valid");
+    }
+
+    void test_window(int n) {
+        using namespace std::chrono;
+        History h{{SIZE_MAX, seconds(60), 1000000}};
+        auto t0 = History::Clock::now();
+        for (int i = 1; i <= n; ++i) {
+            h.commit(h.head().insert(i, i), t0 + seconds(i));
+        }
+        assert(h.size() == (size_t)n + 1, "window -- nothing dropped before collect");
+        assert(h.collect(t0 + seconds(n)) == (size_t)n - 59, "window -- collect");
+        assert(!h.get(n - 60) && h.get(n - 59) && h.get(n)->size() == (size_t)n, "window -- kept");
+        assert(h.collect(t0 + seconds(n + 3600)) == 59 && h.size() == 1, "window -- head stays");
+    }
+
+    // the head of a chain of small edits pins little of its own
+    void test_footprint(int n) {
+        History h;
+        for (int i = 0; i < n; ++i) {
+            h.update([i](const Map &m) { return m.insert(i, i); });
+        }
+        auto head = h.footprint(h.head_id());
+        assert(head.unique_bytes + head.shared_bytes == (size_t)n * Map::node_bytes, "footprint -- total");
+        assert(head.unique_bytes <= 48 * Map::node_bytes, "footprint -- head is mostly shared");
+
+        // an independent version shares nothing
+        std::vector<std::pair<int, int>> entries;
+        for (int i = 0; i < n; ++i) {
+            entries.emplace_back(i, i);
+        }
+        auto id = h.commit(Map::from_sorted(entries.begin(), entries.end()));
+        assert(h.footprint(id).unique_bytes == (size_t)n * Map::node_bytes, "footprint -- independent");
+        assert(h.footprint(id - 1).unique_bytes == head.unique_bytes, "footprint -- old head unchanged");
+
+        size_t before = h.retained_bytes();
+        assert(before > 2 * (size_t)n * Map::node_bytes, "footprint -- retained");
+        h = History{{1}};
+        h.commit(Map::from_sorted(entries.begin(), entries.end()));
+        h.collect();
+        assert(h.size() == 1 && h.retained_bytes() == (size_t)n * Map::node_bytes, "footprint -- after collect");
+        assert(!h.footprint(12345).unique_bytes, "footprint -- dropped version");
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000;
+    _test::test_keep_last(n);
+    _test::test_pinned_pointer();
+    _test::test_window(n);
+    _test::test_footprint(n);
+}
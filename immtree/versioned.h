@@ -0,0 +1,178 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "avl.h"
+
+
+// History of AVLMap versions under increasing ids, with a retention policy.
+// A version is kept while it is one of the `last` newest and younger than
+// `window`, while it is pinned, or while it is the newest. The rest expire
+// and are dropped together every `batch` commits or on collect(). Versions
+// share unchanged nodes, so what one of them costs is the part no other
+// version or copy uses; footprint() reports that next to the shared part.
+template <typename K, typename V, typename Policy = DefaultPolicy>
+class VersionedMap {
+public:
+    using Map = AVLMap<K, V, Policy>;
+    using Version = uint64_t;
+    using Clock = std::chrono::steady_clock;
+
+    struct Retention {
+        size_t last = SIZE_MAX;
+        Clock::duration window = Clock::duration::max();
+        size_t batch = 64;
+    };
+
+    struct Footprint {
+        size_t unique_bytes;    // freed if this version alone were dropped
+        size_t shared_bytes;    // also used by another version or copy
+    };
+
+private:
+    struct Entry {
+        Clock::time_point at;
+        Map map;
+        bool pinned = false;
+    };
+
+    Retention retention;
+    // node-based, so collect() leaves the entries it keeps where they are
+    // and get() stays valid for as long as the version is held
+    std::map<Version, Entry> entries;
+    Version next_id = 1;
+    size_t since_collect = 0;
+
+    Entry *entry(Version id) {
+        auto it = entries.find(id);
+        return it != entries.end() ? &it->second : nullptr;
+    }
+
+    const Entry *entry(Version id) const {
+        return const_cast<VersionedMap *>(this)->entry(id);
+    }
+
+public:
+    // starts with version 0, the empty map
+    explicit VersionedMap(Retention retention = Retention{}): retention{retention} {
+        entries.emplace(0, Entry{Clock::now(), Map{}});
+    }
+
+    // the newest version
+    const Map &head() const {
+        return entries.rbegin()->second.map;
+    }
+
+    Version head_id() const {
+        return entries.rbegin()->first;
+    }
+
+    // Adds map as the newest version and returns its id. `at` is its
+    // timestamp for the retention window.
+    Version commit(Map map, Clock::time_point at = Clock::now()) {
+        entries.emplace_hint(entries.end(), next_id, Entry{at, std::move(map)});
+        if (++since_collect >= retention.batch) {
+            collect(at);
+        }
+        return next_id++;
+    }
+
+    // commits f(head())
+    template <typename F>
+    Version update(F &&f) {
+        return commit(f(head()));
+    }
+
+    // nullptr once the version has been dropped; stays valid until then
+    const Map *get(Version id) const {
+        const Entry *e = entry(id);
+        return e ? &e->map : nullptr;
+    }
+
+    // keeps a version past its retention; false if it is already gone
+    bool pin(Version id) {
+        Entry *e = entry(id);
+        if (!e) {
+            return false;
+        }
+        e->pinned = true;
+        return true;
+    }
+
+    // lets the version expire again at the next collect()
+    bool unpin(Version id) {
+        Entry *e = entry(id);
+        if (!e) {
+            return false;
+        }
+        e->pinned = false;
+        return true;
+    }
+
+    // ids of the versions held, oldest first
+    std::vector<Version> versions() const {
+        std::vector<Version> ids;
+        for (auto &[id, e] : entries) {
+            ids.push_back(id);
+        }
+        return ids;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    // Drops the versions that have expired by `now`, returns how many. The
+    // policy keeps a suffix of the history, so only the older part is looked
+    // at; pinned versions in it stay.
+    size_t collect(Clock::time_point now = Clock::now()) {
+        since_collect = 0;
+        // keep_from: the oldest entry of the kept suffix
+        auto keep_from = std::prev(entries.end());
+        size_t kept = 1;
+        while (keep_from != entries.begin() && kept < retention.last &&
+               now - std::prev(keep_from)->second.at < retention.window) {
+            --keep_from;
+            ++kept;
+        }
+
+        size_t dropped = 0;
+        for (auto it = entries.begin(); it != keep_from;) {
+            if (it->second.pinned) {
+                ++it;
+            }
+            else {
+                it = entries.erase(it);
+                ++dropped;
+            }
+        }
+        return dropped;
+    }
+
+    // O(nodes the version does not share)
+    Footprint footprint(Version id) const {
+        const Entry *e = entry(id);
+        if (!e) {
+            return {0, 0};
+        }
+        auto s = e->map.sharing();
+        return {(s.nodes - s.shared) * Map::node_bytes, s.shared * Map::node_bytes};
+    }
+
+    // every node of every version held, counted once; O(distinct nodes)
+    size_t retained_bytes() const {
+        std::unordered_set<const void *> seen;
+        size_t nodes = 0;
+        for (auto &[id, e] : entries) {
+            nodes += e.map.mark_nodes(seen);
+        }
+        return nodes * Map::node_bytes;
+    }
+};
@@ -0,0 +1,250 @@
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "radix_batch.h"
+
+
+namespace _test {
+
+    void assert(bool x, const char *msg) {
+        if (!x) {
+            fprintf(stderr, "%s\n", msg); fflush(stderr);
+            abort();
+        }
+    }
+
+    // the original digit-at-a-time long division, as a reference
+    std::string naive_convert(std::string input, int input_radix, int output_radix) {
+        std::string output;
+        for (int i = 0, n = input.size(), v = 0; i < n;) {
+            if (input[i] == '0') {
+                ++i;
+                continue;
+            }
+            for (int j = i; j < n; ++j) {
+                v *= input_radix;
+                v += to_int(input[j]);
+                input[j] = to_char(v / output_radix);
+                v %= output_radix;
+            }
+            output.push_back(to_char(v));
+            v = 0;
+        }
+        if (output.empty()) {
+            return "0";
+        }
+        else {
+            return std::string(output.rbegin(), output.rend());
+        }
+    }
+
+    std::string random_digits(std::default_random_engine &e, size_t n, int radix) {
+        std::string s;
+        for (size_t i = 0; i < n; ++i) {
+            s.push_back(to_char(e() % radix));
+        }
+        return s;
+    }
+
+    void test_against_naive(int n) {
+        std::default_random_engine e{};
+        int pairs[][2] = {{10, 16}, {16, 10}, {36, 7}, {2, 36}, {3, 10}, {10, 10}, {36, 2}, {10, 32}};
+        for (auto [from, to] : pairs) {
+            RadixConverter converter{from, to};
+            for (size_t len : {1, 2, 5, 19, 20, 21, 40, 100, 700}) {
+                auto s = random_digits(e, len, from);
+                assert(converter.convert(s) == naive_convert(s, from, to), "against naive -- short");
+            }
+            // long enough to go through Karatsuba, Newton and Barrett
+            auto s = random_digits(e, n, from);
+            assert(converter.convert(s) == naive_convert(s, from, to), "against naive -- long");
+        }
+    }
+
+    // numbers around the cached powers, where Barrett corrects its estimate;
+    // up to the lengths where it works modulo B^k - 1, and exact multiples
+    // leave a remainder of zero
+    void test_power_boundaries(int n) {
+        for (int radix : {10, 16, 36}) {
+            RadixConverter same{radix, radix};
+            std::string top(1, to_char(radix - 1));
+            for (int len = 1; len <= n * 10; len = len * 2 + 1) {
+                std::string one = "1" + std::string(len, '0');
+                std::string max(len, top[0]);
+                assert(same.convert(one) == one && same.convert(max) == max, "power boundaries");
+                assert(same.convert("000" + max) == max, "power boundaries -- leading zeros");
+            }
+        }
+    }
+
+    void test_round_trip(int n) {
+        std::default_random_engine e{};
+        RadixConverter to_hex{10, 16}, to_dec{16, 10};
+        for (int len : {n, n * 10}) {
+            auto s = random_digits(e, len, 10);
+            s[0] = '1';
+            assert(to_dec.convert(to_hex.convert(s)) == s, "round trip");
+        }
+    }
+
+    // every kernel level this CPU has against the scalar one and the reference
+    void test_kernels(int n) {
+        std::default_random_engine e{};
+        const RadixKernels &scalar = radix_kernels(RadixIsa::scalar);
+        for (RadixIsa isa : {RadixIsa::scalar, RadixIsa::ssse3, RadixIsa::avx2}) {
+            if (!radix_isa_supported(isa)) {
+                continue;
+            }
+            const RadixKernels &k = radix_kernels(isa);
+            for (int radix = 2; radix <= 36; ++radix) {
+                for (size_t len : {0, 1, 15, 16, 17, 31, 32, 33, 100}) {
+                    auto s = random_digits(e, len, radix);
+                    for (char &c : s) {
+                        if (e() % 8 == 0) {
+                            c = e() % 2 ? 'A' + e() % 26 : char(e() % 256);
+                        }
+                    }
+                    assert(k.first_bad_digit(s.data(), len, radix) == scalar.first_bad_digit(s.data(), len, radix),
+                           "kernels -- first bad digit");
+                }
+            }
+
+            auto dec = random_digits(e, 16, 10);
+            assert(k.decimal16(dec.data()) == std::stoull(dec), "kernels -- decimal16");
+
+            int pairs[][2] = {{16, 2}, {2, 16}, {8, 32}, {4, 16}, {16, 8}, {32, 2}, {2, 4}, {16, 16}, {10, 16}, {2, 10}};
+            for (auto [from, to] : pairs) {
+                RadixConverter converter{from, to, isa};
+                for (size_t len : {1, 15, 16, 17, 32, 63, 64, 65, 130, 1000}) {
+                    auto s = random_digits(e, len, from);
+                    s[0] = e() % 2 ? '1' : s[0];
+                    for (char &c : s) {
+                        c = e() % 4 == 0 ? char(toupper(c)) : c;
+                    }
+                    assert(converter.convert(s) == naive_convert(s, from, to), "kernels -- against naive");
+                }
+            }
+
+            RadixConverter to_bin{16, 2, isa}, to_hex{2, 16, isa};
+            auto s = random_digits(e, n * 100, 16);
+            s[0] = '1';
+            assert(to_hex.convert(to_bin.convert(s)) == s, "kernels -- round trip");
+        }
+    }
+
+    std::string read_back(FILE *f) {
+        std::string s;
+        char buf[4096];
+        rewind(f);
+        for (size_t n; (n = fread(buf, 1, sizeof buf, f)) > 0;) {
+            s.append(buf, n);
+        }
+        return s;
+    }
+
+    // mapped and piped input, small blocks, bad and blank lines, output in order
+    void test_batch(int n) {
+        std::default_random_engine e{};
+        std::string input, expect;
+        size_t bad = 0;
+        for (int i = 0; i < n; ++i) {
+            std::string number = random_digits(e, 1 + e() % (i % 100 == 0 ? 2000 : 30), 10);
+            switch (e() % 16) {
+            case 0:
+                input += "\n";
+                expect += "\n";
+                continue;
+            case 1:
+                input += "  " + number + "\r\n";
+                break;
+            case 2:
+                input += number + "x\n";
+                expect += "\n";
+                ++bad;
+                continue;
+            default:
+                input += number + "\n";
+            }
+            expect += naive_convert(number, 10, 16) + "\n";
+        }
+        input += "123";     // no newline at the end
+        expect += "7b\n";
+
+        for (bool piped : {false, true}) {
+            RadixBatch batch{10, 16, {4, 4096, nullptr}};
+            FILE *out = tmpfile();
+            RadixBatch::Result result;
+            if (piped) {
+                int fds[2];
+                assert(pipe(fds) == 0, "batch -- pipe");
+                std::thread feed([&input, fd = fds[1]] {
+                    for (size_t at = 0; at < input.size();) {
+                        ssize_t w = write(fd, input.data() + at, std::min<size_t>(input.size() - at, 1000));
+                        at += w > 0 ? w : 0;
+                    }
+                    close(fd);
+                });
+                result = batch.run(fds[0], fileno(out));
+                feed.join();
+                close(fds[0]);
+            }
+            else {
+                FILE *in = tmpfile();
+                fwrite(input.data(), 1, input.size(), in);
+                fflush(in);
+                result = batch.run(fileno(in), fileno(out));
+                fclose(in);
+            }
+            assert(result.lines == (size_t)n + 1 && result.errors == bad, "batch -- counts");
+            assert(read_back(out) == expect, piped ? "batch -- piped output" : "batch -- mapped output");
+            fclose(out);
+        }
+    }
+
+    void test_errors() {
+        RadixConverter converter{10, 16};
+        std::string out;
+        RadixError error{};
+        assert(!converter.convert("", out, &error) && error.kind == RadixError::empty, "errors -- empty");
+        assert(!converter.convert("12a4", out, &error) && error.kind == RadixError::bad_digit &&
+               error.position == 2, "errors -- bad digit");
+        assert(!converter.convert("1 2", out) && !converter.convert("-1", out), "errors -- not digits");
+        assert(converter.convert("0000") == "0" && converter.convert("255") == "ff", "errors -- good input");
+        assert(convert("FF", 16, 10) == "255" && convert("Zz", 36, 10) == "1295", "upper case digits");
+
+        bool thrown = false;
+        try {
+            convert("12", 1, 10);
+        }
+        catch (const std::invalid_argument &) {
+            thrown = true;
+        }
+        assert(thrown, "errors -- radix");
+        thrown = false;
+        try {
+            converter.convert("0x12");
+        }
+        catch (const std::invalid_argument &) {
+            thrown = true;
+        }
+        assert(thrown, "errors -- throwing convert");
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 6000;
+    _test::test_errors();
+    _test::test_against_naive(n);
+    _test::test_power_boundaries(n);
+    _test::test_round_trip(n);
+    _test::test_kernels(n);
+    _test::test_batch(n);
+}
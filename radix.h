@@ -0,0 +1,879 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "radix_simd.h"
+
+// Digit values for radices up to 36; -1 for anything that is not a digit.
+inline int to_int(char c) {
+    return '0' <= c && c <= '9' ? c - '0' :
+            'a' <= c && c <= 'z' ? c - 'a' + 10:
+            'A' <= c && c <= 'Z' ? c - 'A' + 10: -1;
+}
+
+inline char to_char(int x) {
+    return x <= 9 ? '0' + x : 'a' + (x - 10);
+}
+
+
+struct RadixError {
+    enum Kind { empty, bad_digit } kind;
+    size_t position;    // of the offending character, for bad_digit
+
+    std::string message() const {
+        return kind == empty ? "empty number" : "invalid digit at position " + std::to_string(position);
+    }
+};
+
+
+// Converts unsigned numbers between radices 2..36 through a binary big
+// integer of 64-bit limbs.
+//
+// Digits are handled a limb at a time: a chunk of `digits` digits is one
+// multiply-add (parsing) or one division (printing) on the big integer.
+// That is quadratic in the limb count, so above a few dozen limbs both
+// directions split the number in halves at powers radix^(digits * 2^i)
+// instead; parsing then costs multiplications and printing Barrett
+// divisions, O(M(n) log n) either way. Multiplication is Karatsuba up to a
+// few hundred limbs and a number-theoretic transform modulo two 63-bit
+// primes above that. The powers, their reciprocals and the transforms of
+// both are cached in the converter, so reuse one converter per thread
+// rather than building one per number.
+//
+// At -O2 that parses half a million decimal digits in well under 0.1 s and
+// prints them in 0.2-0.3 s. Getting printing down to milliseconds is left
+// for later: it needs a vectorised transform and a division that avoids
+// the full quotient product (a scaled remainder tree).
+//
+// When a radix is a power of two its side is plain bit repacking, linear
+// in the length; hex and binary do that with the SIMD kernels of
+// radix_simd.h, which also validate digits and parse decimal chunks.
+class RadixConverter {
+    using Limbs = std::vector<uint64_t>;    // least significant first, no high zero limbs
+    using u128 = unsigned __int128;
+
+    static constexpr size_t karatsuba_limbs = 24;
+    static constexpr size_t ntt_limbs = 512;
+    static constexpr size_t newton_limbs = 32;
+    static constexpr size_t schoolbook_limbs = 32;
+
+    // a number's 32-bit digits transformed modulo the two primes of mul_ntt
+    struct Spectrum {
+        std::vector<uint64_t> c[2];
+    };
+
+    // radix^(digits * 2^i) for i = 0, 1, ... and their reciprocals, made on
+    // demand, and the transforms of both for the lengths Barrett uses
+    struct Powers {
+        int radix;
+        int digits = 0;         // per limb: largest k with radix^k < 2^64
+        uint64_t base = 1;      // radix^digits
+        int shift = 0;          // log2(radix) for powers of two, else 0
+        std::vector<Limbs> pow, inv;
+        std::vector<Spectrum> pow_spectra, inv_spectra;
+
+        explicit Powers(int radix): radix{radix} {
+            while (base <= UINT64_MAX / radix) {
+                base *= radix;
+                ++digits;
+            }
+            if ((radix & (radix - 1)) == 0) {
+                shift = __builtin_ctz(radix);
+            }
+            pow.push_back({base});
+        }
+
+        const Limbs &power(size_t i) {
+            while (pow.size() <= i) {
+                pow.push_back(mul(pow.back(), pow.back()));
+            }
+            return pow[i];
+        }
+
+        const Limbs &inverse(size_t i) {
+            while (inv.size() <= i) {
+                inv.push_back(reciprocal(power(inv.size())));
+            }
+            return inv[i];
+        }
+
+        // for products modulo B^k - 1
+        const Spectrum &power_spectrum(size_t i, size_t k) {
+            return spectrum(pow_spectra, power(i), i, k);
+        }
+
+        const Spectrum &inverse_spectrum(size_t i, size_t k) {
+            return spectrum(inv_spectra, inverse(i), i, k);
+        }
+
+        static const Spectrum &spectrum(std::vector<Spectrum> &cache, const Limbs &x, size_t i, size_t k) {
+            if (cache.size() <= i) {
+                cache.resize(i + 1);
+            }
+            if (cache[i].c[0].size() != 2 * k) {
+                cache[i] = transform(x.data(), x.size(), k);
+            }
+            return cache[i];
+        }
+
+        // digits in radix^(digits * 2^i)
+        size_t span(size_t i) const {
+            return size_t(digits) << i;
+        }
+    };
+
+    Powers in, out;
+    const RadixKernels *kernels;
+
+public:
+    // throws std::invalid_argument unless both radices are in 2..36
+    RadixConverter(int input_radix, int output_radix):
+        RadixConverter(input_radix, output_radix, radix_kernels().isa) {}
+
+    // with the kernels of a given level, which must be supported
+    RadixConverter(int input_radix, int output_radix, RadixIsa isa):
+        in{check_radix(input_radix)},
+        out{check_radix(output_radix)},
+        kernels{&radix_kernels(isa)} {
+        if (!radix_isa_supported(isa)) {
+            throw std::invalid_argument("instruction set not supported by this CPU");
+        }
+    }
+
+    int input_radix() const {
+        return in.radix;
+    }
+
+    int output_radix() const {
+        return out.radix;
+    }
+
+    // Digits of `input` in the output radix, lower case and without leading
+    // zeros. On an empty input or a character that is not a digit of the
+    // input radix, returns false and describes it in *error if given.
+    bool convert(std::string_view input, std::string &output, RadixError *error = nullptr) {
+        if (input.empty()) {
+            if (error) {
+                *error = {RadixError::empty, 0};
+            }
+            return false;
+        }
+        size_t bad = kernels->first_bad_digit(input.data(), input.size(), in.radix);
+        if (bad < input.size()) {
+            if (error) {
+                *error = {RadixError::bad_digit, bad};
+            }
+            return false;
+        }
+
+        size_t start = input.find_first_not_of('0');
+        output.clear();
+        if (start == std::string_view::npos) {
+            output.push_back('0');
+            return true;
+        }
+        input.remove_prefix(start);
+
+        if (input.size() <= size_t(in.digits)) {
+            append_digits(chunk_value(input.data(), input.size()), 1, output);
+            return true;
+        }
+        Limbs x = in.shift ? parse_bits(input.data(), input.size()) : parse(input.data(), input.size());
+        if (out.shift) {
+            emit_bits(x, output);
+            return true;
+        }
+        size_t i = 0;
+        while (x.size() > schoolbook_limbs && cmp(x, out.power(i + 1)) >= 0) {
+            ++i;
+        }
+        emit(x, i, false, output);
+        return true;
+    }
+
+    // throws std::invalid_argument on bad input
+    std::string convert(std::string_view input) {
+        std::string output;
+        RadixError error{};
+        if (!convert(input, output, &error)) {
+            throw std::invalid_argument(error.message());
+        }
+        return output;
+    }
+
+private:
+    static int check_radix(int radix) {
+        if (radix < 2 || radix > 36) {
+            throw std::invalid_argument("radix must be in 2..36, got " + std::to_string(radix));
+        }
+        return radix;
+    }
+
+    // value of n <= digits validated digits
+    uint64_t chunk_value(const char *s, size_t n) const {
+        uint64_t v = 0;
+        if (in.radix == 10 && n >= 16) {
+            v = kernels->decimal16(s);
+            s += 16;
+            n -= 16;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            v = v * in.radix + to_int(s[i]);
+        }
+        return v;
+    }
+
+    Limbs parse(const char *s, size_t n) {
+        if (n <= in.span(0) * schoolbook_limbs) {
+            size_t first = n % in.digits ? n % in.digits : in.digits;
+            Limbs x;
+            mul_add_small(x, 1, chunk_value(s, first));
+            for (size_t i = first; i < n; i += in.digits) {
+                mul_add_small(x, in.base, chunk_value(s + i, in.digits));
+            }
+            return x;
+        }
+        // the low half is as long as the largest cached span below n
+        size_t i = 0;
+        while (in.span(i + 1) < n) {
+            ++i;
+        }
+        size_t low = in.span(i);
+        Limbs x = mul(parse(s, n - low), in.power(i));
+        add_in_place(x, parse(s + n - low, low));
+        return x;
+    }
+
+    // n digits of a power-of-two radix, the last one at bit 0
+    Limbs parse_bits(const char *s, size_t n) const {
+        int b = in.shift;
+        Limbs x((n * b + 63) / 64, 0);
+        if (b == 4 || b == 1) {
+            size_t per = 64 / b, full = n / per, rest = n % per;
+            (b == 4 ? kernels->hex_to_limbs : kernels->bin_to_limbs)(s + rest, full, x.data());
+            if (rest) {
+                x[full] = chunk_value(s, rest);
+            }
+        }
+        else {
+            size_t bit = 0;
+            for (size_t i = n; i-- > 0; bit += b) {
+                uint64_t v = to_int(s[i]);
+                x[bit / 64] |= v << bit % 64;
+                if (bit % 64 + b > 64) {
+                    x[bit / 64 + 1] |= v >> (64 - bit % 64);
+                }
+            }
+        }
+        trim(x);
+        return x;
+    }
+
+    // appends x, not zero, in a power-of-two radix
+    void emit_bits(const Limbs &x, std::string &output) const {
+        int b = out.shift;
+        if (b == 4 || b == 1) {
+            append_digits(x.back(), 1, output);
+            size_t at = output.size(), rest = x.size() - 1;
+            output.resize(at + rest * (64 / b));
+            (b == 4 ? kernels->limbs_to_hex : kernels->limbs_to_bin)(x.data(), rest, &output[at]);
+            return;
+        }
+        size_t bits = 64 * x.size() - __builtin_clzll(x.back());
+        uint64_t mask = out.radix - 1;
+        for (size_t d = (bits + b - 1) / b; d-- > 0;) {
+            size_t bit = d * b, k = bit / 64;
+            uint64_t v = x[k] >> bit % 64;
+            if (bit % 64 + b > 64 && k + 1 < x.size()) {
+                v |= x[k + 1] << (64 - bit % 64);
+            }
+            output.push_back(to_char(v & mask));
+        }
+    }
+
+    // appends v with at least min_digits digits; division by a radix only
+    // known at run time is slow, so the common radices get their own loops
+    void append_digits(uint64_t v, int min_digits, std::string &output) const {
+        char buf[64], *end = buf + sizeof buf, *p = end;
+        if (out.shift) {
+            uint64_t mask = out.radix - 1;
+            do {
+                *--p = to_char(v & mask);
+                v >>= out.shift;
+            } while (v || end - p < min_digits);
+        }
+        else if (out.radix == 10) {
+            do {
+                *--p = '0' + v % 10;
+                v /= 10;
+            } while (v || end - p < min_digits);
+        }
+        else {
+            do {
+                *--p = to_char(v % out.radix);
+                v /= out.radix;
+            } while (v || end - p < min_digits);
+        }
+        output.append(p, end);
+    }
+
+    // Appends x < power(i + 1). With pad, writes exactly 2 span(i) digits,
+    // otherwise drops leading zeros.
+    void emit(const Limbs &x, size_t i, bool pad, std::string &output) {
+        if (x.size() <= schoolbook_limbs) {
+            Limbs t = x;
+            std::vector<uint64_t> chunks;   // least significant first
+            while (!t.empty()) {
+                chunks.push_back(divmod_small(t, out.base));
+            }
+            if (pad) {
+                output.append(2 * out.span(i) - chunks.size() * out.digits, '0');
+            }
+            for (size_t j = chunks.size(); j-- > 0;) {
+                append_digits(chunks[j], pad || j + 1 < chunks.size() ? out.digits : 1, output);
+            }
+            return;
+        }
+        Limbs q, r;
+        barrett(x, i, q, r);
+        if (!pad && q.empty()) {
+            emit(r, i - 1, false, output);
+        }
+        else {
+            emit(q, i - 1, pad, output);
+            emit(r, i - 1, true, output);
+        }
+    }
+
+    // Limb arithmetic. Functions on Limbs keep them trimmed; the raw pointer
+    // ones work on fixed widths.
+
+    static void trim(Limbs &a) {
+        while (!a.empty() && a.back() == 0) {
+            a.pop_back();
+        }
+    }
+
+    static int cmp(const Limbs &a, const Limbs &b) {
+        if (a.size() != b.size()) {
+            return a.size() < b.size() ? -1 : 1;
+        }
+        for (size_t i = a.size(); i-- > 0;) {
+            if (a[i] != b[i]) {
+                return a[i] < b[i] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    // a = a * m + add
+    static void mul_add_small(Limbs &a, uint64_t m, uint64_t add) {
+        uint64_t carry = add;
+        for (auto &limb : a) {
+            u128 t = u128(limb) * m + carry;
+            limb = uint64_t(t);
+            carry = uint64_t(t >> 64);
+        }
+        if (carry) {
+            a.push_back(carry);
+        }
+    }
+
+    // a /= d, returns the remainder
+    static uint64_t divmod_small(Limbs &a, uint64_t d) {
+        u128 rem = 0;
+        for (size_t i = a.size(); i-- > 0;) {
+            u128 cur = rem << 64 | a[i];
+            a[i] = uint64_t(cur / d);
+            rem = cur % d;
+        }
+        trim(a);
+        return uint64_t(rem);
+    }
+
+    // dst[0, n) += src[0, m), m <= n; returns the carry out of the top
+    static uint64_t add_to(uint64_t *dst, size_t n, const uint64_t *src, size_t m) {
+        uint64_t carry = 0;
+        size_t i = 0;
+        for (; i < std::min(n, m); ++i) {
+            u128 t = u128(dst[i]) + src[i] + carry;
+            dst[i] = uint64_t(t);
+            carry = uint64_t(t >> 64);
+        }
+        for (; carry && i < n; ++i) {
+            carry = ++dst[i] == 0;
+        }
+        return carry;
+    }
+
+    // dst[0, n) -= src[0, m), m <= n; returns the borrow out of the top
+    static uint64_t sub_from(uint64_t *dst, size_t n, const uint64_t *src, size_t m) {
+        uint64_t borrow = 0;
+        size_t i = 0;
+        for (; i < std::min(n, m); ++i) {
+            uint64_t s = src[i] + borrow;
+            uint64_t next = s < borrow || dst[i] < s;
+            dst[i] -= s;
+            borrow = next;
+        }
+        for (; borrow && i < n; ++i) {
+            borrow = dst[i]-- == 0;
+        }
+        return borrow;
+    }
+
+    // x mod B^k - 1 in k limbs, possibly as B^k - 1 for 0
+    static Limbs wrap(const Limbs &x, size_t k) {
+        Limbs r(k, 0);
+        const uint64_t one = 1;
+        for (size_t off = 0; off < x.size(); off += k) {
+            if (add_to(r.data(), k, x.data() + off, std::min(k, x.size() - off))) {
+                add_to(r.data(), k, &one, 1);
+            }
+        }
+        return r;
+    }
+
+    static void add_in_place(Limbs &a, const Limbs &b) {
+        a.resize(std::max(a.size(), b.size()) + 1, 0);
+        add_to(a.data(), a.size(), b.data(), b.size());
+        trim(a);
+    }
+
+    // a >= b
+    static void sub_in_place(Limbs &a, const Limbs &b) {
+        sub_from(a.data(), a.size(), b.data(), b.size());
+        trim(a);
+    }
+
+    static void add_one(Limbs &a) {
+        Limbs one{1};
+        add_in_place(a, one);
+    }
+
+    static void sub_one(Limbs &a) {
+        Limbs one{1};
+        sub_in_place(a, one);
+    }
+
+    // r[0, na + nb) = a * b
+    static void mul_basecase(const uint64_t *a, size_t na, const uint64_t *b, size_t nb, uint64_t *r) {
+        std::fill(r, r + na + nb, 0);
+        for (size_t i = 0; i < nb; ++i) {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < na; ++j) {
+                u128 t = u128(a[j]) * b[i] + r[i + j] + carry;
+                r[i + j] = uint64_t(t);
+                carry = uint64_t(t >> 64);
+            }
+            r[i + na] = carry;
+        }
+    }
+
+    // Arithmetic mod a prime p = c 2^40 + 1 < 2^63, in Montgomery form
+    // (x stands for x 2^64 mod p) where it multiplies.
+    struct NttPrime {
+        uint64_t p, pinv, r2, root;     // root: of unity, of order 2^40, as stored
+
+        NttPrime(uint64_t p, uint64_t generator): p{p}, pinv{1}, r2{0}, root{0} {
+            for (int i = 0; i < 6; ++i) {
+                pinv *= 2 - p * pinv;       // Newton's iteration for p^-1 mod 2^64
+            }
+            uint64_t r = uint64_t((u128(1) << 64) % p);
+            r2 = uint64_t(u128(r) * r % p);
+            root = pow(to(generator), (p - 1) >> 40);
+        }
+
+        // the two primes mul_ntt works modulo
+        static const NttPrime *primes() {
+            static const NttPrime p[2] = {{0x7ffffe0000000001, 7}, {0x7fffef0000000001, 5}};
+            return p;
+        }
+
+        // a b / 2^64 mod p
+        uint64_t mul(uint64_t a, uint64_t b) const {
+            u128 t = u128(a) * b;
+            uint64_t m = uint64_t(t) * pinv;
+            uint64_t hi = uint64_t(t >> 64), sub = uint64_t(u128(m) * p >> 64);
+            return hi - sub + (p & -uint64_t(hi < sub));
+        }
+
+        uint64_t add(uint64_t a, uint64_t b) const {
+            // masks rather than branches: on transform data they mispredict
+            uint64_t s = a + b;
+            return s - (p & -uint64_t(s >= p));
+        }
+
+        uint64_t sub(uint64_t a, uint64_t b) const {
+            return a - b + (p & -uint64_t(a < b));
+        }
+
+        uint64_t to(uint64_t a) const {
+            return mul(a, r2);
+        }
+
+        uint64_t pow(uint64_t a, uint64_t e) const {
+            uint64_t x = to(1);
+            for (; e; e >>= 1, a = mul(a, a)) {
+                if (e & 1) {
+                    x = mul(x, a);
+                }
+            }
+            return x;
+        }
+
+        // w[len + j] = (root of order 2 len)^j for each level len < n. The
+        // layout does not depend on n, so one table per thread and direction
+        // grows to the longest transform so far.
+        const uint64_t *roots(size_t n, bool inverse) const {
+            static thread_local std::vector<uint64_t> tables[2][2];
+            auto &w = tables[this == &primes()[1]][inverse];
+            for (size_t len = std::max<size_t>(w.size(), 1); len < n; len *= 2) {
+                uint64_t step = pow(root, (uint64_t(1) << 40) / (2 * len));
+                if (inverse) {
+                    step = pow(step, 2 * len - 1);
+                }
+                w.resize(2 * len);
+                w[len] = to(1);
+                for (size_t j = 1; j < len; ++j) {
+                    w[len + j] = mul(w[len + j - 1], step);
+                }
+            }
+            return w.data();
+        }
+
+        // decimation in frequency: natural order in, bit-reversed out
+        void forward(uint64_t *a, size_t n, const uint64_t *w) const {
+            for (size_t len = n / 2; len >= 1; len /= 2) {
+                for (size_t i = 0; i < n; i += 2 * len) {
+                    for (size_t j = 0; j < len; ++j) {
+                        uint64_t u = a[i + j], v = a[i + j + len];
+                        a[i + j] = add(u, v);
+                        a[i + j + len] = mul(sub(u, v), w[len + j]);
+                    }
+                }
+            }
+        }
+
+        // decimation in time with inverse roots: bit-reversed in, natural
+        // out, not yet divided by n
+        void inverse(uint64_t *a, size_t n, const uint64_t *w) const {
+            for (size_t len = 1; len < n; len *= 2) {
+                for (size_t i = 0; i < n; i += 2 * len) {
+                    for (size_t j = 0; j < len; ++j) {
+                        uint64_t u = a[i + j], v = mul(a[i + j + len], w[len + j]);
+                        a[i + j] = add(u, v);
+                        a[i + j + len] = sub(u, v);
+                    }
+                }
+            }
+        }
+
+        // a = the cyclic convolution whose transforms a and b hold
+        void multiply(std::vector<uint64_t> &a, const std::vector<uint64_t> &b) const {
+            size_t n = a.size();
+            // mul leaves a factor 2^-64 on each product; scaling by
+            // 2^128 / n makes up for it and the one of the last multiply
+            uint64_t scale = to(pow(to(n), p - 2));
+            for (size_t i = 0; i < n; ++i) {
+                a[i] = mul(a[i], b[i]);
+            }
+            inverse(a.data(), n, roots(n, true));
+            for (size_t i = 0; i < n; ++i) {
+                a[i] = mul(a[i], scale);
+            }
+        }
+    };
+
+    // x cut into 32-bit digits, as 2k coefficients transformed modulo both
+    // primes; nx <= k
+    static Spectrum transform(const uint64_t *x, size_t nx, size_t k) {
+        const NttPrime *primes = NttPrime::primes();
+        Spectrum t;
+        for (int j = 0; j < 2; ++j) {
+            auto &c = t.c[j];
+            c.assign(2 * k, 0);
+            for (size_t i = 0; i < nx; ++i) {
+                c[2 * i] = uint32_t(x[i]);
+                c[2 * i + 1] = x[i] >> 32;
+            }
+            primes[j].forward(c.data(), c.size(), primes[j].roots(c.size(), false));
+        }
+        return t;
+    }
+
+    // a * b mod B^k - 1 for k a power of two, from the transforms of both: a
+    // cyclic convolution of their 32-bit digits, which is the exact product
+    // once k >= na + nb. A coefficient is below min(na, nb) 2^65, well under
+    // the product of the primes, so the Chinese remainder gives it exactly.
+    // The k limbs may come out as B^k - 1 for 0.
+    static Limbs mul_ntt(Spectrum a, const Spectrum &b) {
+        const NttPrime &p0 = NttPrime::primes()[0], &p1 = NttPrime::primes()[1];
+        p0.multiply(a.c[0], b.c[0]);
+        p1.multiply(a.c[1], b.c[1]);
+
+        // p0^-1 mod p1, as stored
+        const uint64_t inv = p1.pow(p1.to(p0.p % p1.p), p1.p - 2);
+        size_t n = a.c[0].size(), k = n / 2;
+        Limbs r(k);
+        u128 carry = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t x0 = a.c[0][i], x1 = a.c[1][i];
+            uint64_t t = p1.mul(p1.sub(x1, x0 % p1.p), inv);
+            carry += x0 + u128(p0.p) * t;
+            uint64_t lo = uint64_t(carry) & 0xffffffff;
+            carry >>= 32;
+            r[i / 2] |= i % 2 ? lo << 32 : lo;
+        }
+        // B^k = 1: what is carried out of the top comes back in at the bottom
+        for (size_t i = 0; carry; i = (i + 1) % k) {
+            carry += r[i];
+            r[i] = uint64_t(carry);
+            carry >>= 64;
+        }
+        return r;
+    }
+
+    // smallest power of two >= n
+    static size_t ntt_size(size_t n) {
+        size_t k = 1;
+        while (k < n) {
+            k *= 2;
+        }
+        return k;
+    }
+
+    // r[0, na + nb) = a * b: Karatsuba once both sides are long enough, a
+    // number-theoretic transform once they are longer still
+    static void mul(const uint64_t *a, size_t na, const uint64_t *b, size_t nb, uint64_t *r) {
+        if (na < nb) {
+            std::swap(a, b);
+            std::swap(na, nb);
+        }
+        if (nb < karatsuba_limbs) {
+            mul_basecase(a, na, b, nb, r);
+            return;
+        }
+        if (nb >= ntt_limbs) {
+            size_t k = ntt_size(na + nb);
+            Spectrum ta = transform(a, na, k);
+            Limbs t = a == b && na == nb ? mul_ntt(ta, ta) : mul_ntt(ta, transform(b, nb, k));
+            std::copy(t.begin(), t.begin() + na + nb, r);
+            return;
+        }
+        if (2 * nb <= na) {
+            // lopsided: multiply b by nb-limb slices of a
+            std::fill(r, r + na + nb, 0);
+            Limbs t(2 * nb);
+            for (size_t off = 0; off < na; off += nb) {
+                size_t len = std::min(nb, na - off);
+                mul(a + off, len, b, nb, t.data());
+                add_to(r + off, na + nb - off, t.data(), len + nb);
+            }
+            return;
+        }
+
+        // a = a1 B^h + a0, b = b1 B^h + b0 with nb > h, so b1 is not empty
+        size_t h = na / 2, na1 = na - h, nb1 = nb - h;
+        mul(a, h, b, h, r);
+        mul(a + h, na1, b + h, nb1, r + 2 * h);
+
+        Limbs sa(na1 + 1, 0), sb(std::max(h, nb1) + 1, 0);
+        std::copy(a + h, a + na, sa.begin());
+        add_to(sa.data(), sa.size(), a, h);
+        std::copy(b, b + h, sb.begin());
+        add_to(sb.data(), sb.size(), b + h, nb1);
+
+        // (a0 + a1)(b0 + b1) - a0 b0 - a1 b1 = a0 b1 + a1 b0
+        Limbs mid(sa.size() + sb.size());
+        mul(sa.data(), sa.size(), sb.data(), sb.size(), mid.data());
+        sub_from(mid.data(), mid.size(), r, 2 * h);
+        sub_from(mid.data(), mid.size(), r + 2 * h, na1 + nb1);
+        add_to(r + h, na + nb - h, mid.data(), mid.size());
+    }
+
+    static Limbs mul(const Limbs &a, const Limbs &b) {
+        if (a.empty() || b.empty()) {
+            return {};
+        }
+        Limbs r(a.size() + b.size());
+        mul(a.data(), a.size(), b.data(), b.size(), r.data());
+        trim(r);
+        return r;
+    }
+
+    // a shifted down by n limbs
+    static Limbs shift_down(const Limbs &a, size_t n) {
+        return n < a.size() ? Limbs(a.begin() + n, a.end()) : Limbs{};
+    }
+
+    // Knuth's algorithm D: q = a / b, r = a % b
+    static void divmod(const Limbs &a, const Limbs &b, Limbs &q, Limbs &r) {
+        if (cmp(a, b) < 0) {
+            q.clear();
+            r = a;
+            return;
+        }
+        if (b.size() == 1) {
+            q = a;
+            r = {divmod_small(q, b[0])};
+            trim(r);
+            return;
+        }
+
+        // normalise so the top bit of the divisor is set
+        int s = __builtin_clzll(b.back());
+        size_t n = b.size(), m = a.size();
+        Limbs v(n), u(m + 1);
+        for (size_t i = n; i-- > 0;) {
+            v[i] = b[i] << s | (s && i ? b[i - 1] >> (64 - s) : 0);
+        }
+        u[m] = s ? a[m - 1] >> (64 - s) : 0;
+        for (size_t i = m; i-- > 0;) {
+            u[i] = a[i] << s | (s && i ? a[i - 1] >> (64 - s) : 0);
+        }
+
+        q.assign(m - n + 1, 0);
+        const u128 B = u128(1) << 64;
+        for (size_t j = m - n + 1; j-- > 0;) {
+            u128 num = u128(u[j + n]) << 64 | u[j + n - 1];
+            u128 qhat = num / v[n - 1], rhat = num % v[n - 1];
+            while (qhat >= B || qhat * v[n - 2] > (rhat << 64 | u[j + n - 2])) {
+                --qhat;
+                rhat += v[n - 1];
+                if (rhat >= B) {
+                    break;
+                }
+            }
+
+            // u[j, j + n] -= qhat * v
+            uint64_t carry = 0, borrow = 0;
+            for (size_t i = 0; i < n; ++i) {
+                u128 p = qhat * v[i] + carry;
+                carry = uint64_t(p >> 64);
+                uint64_t lo = uint64_t(p);
+                uint64_t s1 = u[i + j] - lo;
+                uint64_t b1 = u[i + j] < lo;
+                uint64_t s2 = s1 - borrow;
+                borrow = b1 + (s1 < borrow);
+                u[i + j] = s2;
+            }
+            uint64_t top = u[j + n];
+            u[j + n] = top - carry - borrow;
+            if (top < u128(carry) + borrow) {
+                // qhat was one too large; add v back
+                --qhat;
+                uint64_t c = 0;
+                for (size_t i = 0; i < n; ++i) {
+                    u128 t = u128(u[i + j]) + v[i] + c;
+                    u[i + j] = uint64_t(t);
+                    c = uint64_t(t >> 64);
+                }
+                u[j + n] += c;
+            }
+            q[j] = uint64_t(qhat);
+        }
+        trim(q);
+
+        r.assign(n, 0);
+        for (size_t i = 0; i < n; ++i) {
+            r[i] = u[i] >> s | (s ? u[i + 1] << (64 - s) : 0);
+        }
+        trim(r);
+    }
+
+    // floor(B^2m / p) for p of m limbs. Newton's iteration from the
+    // reciprocal of the top half of p, then a few exact corrections.
+    static Limbs reciprocal(const Limbs &p) {
+        size_t m = p.size();
+        Limbs scale(2 * m + 1, 0);
+        scale.back() = 1;
+        if (m <= newton_limbs) {
+            Limbs q, r;
+            divmod(scale, p, q, r);
+            return q;
+        }
+
+        // two guard limbs keep the error after one step to a few units
+        size_t h = m / 2 + 2, s = m - h;
+        Limbs x = reciprocal(Limbs(p.begin() + s, p.end()));
+        x.insert(x.begin(), s, 0);
+
+        // x += x (B^2m - p x) / B^2m
+        Limbs px = mul(p, x);
+        if (cmp(px, scale) <= 0) {
+            Limbs e = scale;
+            sub_in_place(e, px);
+            add_in_place(x, shift_down(mul(x, e), 2 * m));
+        }
+        else {
+            Limbs e = px;
+            sub_in_place(e, scale);
+            Limbs d = shift_down(mul(x, e), 2 * m);
+            add_one(d);
+            sub_in_place(x, d);
+        }
+
+        px = mul(p, x);
+        while (cmp(px, scale) > 0) {
+            sub_one(x);
+            sub_in_place(px, p);
+        }
+        Limbs rem = scale;
+        sub_in_place(rem, px);
+        while (cmp(rem, p) >= 0) {
+            add_one(x);
+            sub_in_place(rem, p);
+        }
+        return x;
+    }
+
+    // q = x / p, r = x % p for x < B^2m, where p = out.power(i) has m limbs.
+    // Long divisors multiply by the cached transforms of p and its
+    // reciprocal mu.
+    void barrett(const Limbs &x, size_t i, Limbs &q, Limbs &r) {
+        const Limbs &p = out.power(i), &mu = out.inverse(i);
+        size_t m = p.size();
+        if (m < ntt_limbs) {
+            q = shift_down(mul(shift_down(x, m - 1), mu), m + 1);
+            r = x;
+            sub_in_place(r, mul(q, p));
+        }
+        else {
+            Limbs high = shift_down(x, m - 1);
+            size_t k = ntt_size(2 * m + 2);
+            q = shift_down(mul_ntt(transform(high.data(), high.size(), k), out.inverse_spectrum(i, k)), m + 1);
+            trim(q);
+
+            // x - q p < 3p has at most m + 1 limbs, so it is enough to work
+            // modulo B^k - 1 for some k > m + 1: half the transform length
+            k = ntt_size(m + 2);
+            const uint64_t one = 1;
+            r = wrap(x, k);
+            Limbs qp = mul_ntt(transform(q.data(), q.size(), k), out.power_spectrum(i, k));
+            if (sub_from(r.data(), k, qp.data(), k)) {
+                sub_from(r.data(), k, &one, 1);     // + B^k - 1
+            }
+            if (std::all_of(r.begin(), r.end(), [](uint64_t l) { return l == UINT64_MAX; })) {
+                r.clear();
+            }
+            trim(r);
+        }
+        while (cmp(r, p) >= 0) {
+            sub_in_place(r, p);
+            add_one(q);
+        }
+    }
+};
+
+
+// one-off conversion; throws std::invalid_argument
+inline std::string convert(std::string_view input, int input_radix, int output_radix) {
+    return RadixConverter{input_radix, output_radix}.convert(input);
+}
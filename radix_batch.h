@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "radix.h"
+
+
+// Converts a stream of numbers, one per line, between two radices on all
+// cores. The input is cut into blocks of whole lines. Each worker thread
+// converts blocks with its own RadixConverter. The calling thread writes
+// finished blocks back in input order, one write per block, so nothing is
+// flushed per line.
+//
+// Regular files are mapped; pipes and terminals are read in block-sized
+// chunks. Surrounding blanks and a trailing '\r' are ignored. A line that
+// is not a number produces an empty output line, so line numbers still
+// match, and is reported on Options::errors.
+class RadixBatch {
+public:
+    struct Options {
+        unsigned threads = 0;                   // 0 for one per core
+        size_t block_size = size_t(1) << 20;    // input bytes per block, rounded up to a line
+        FILE *errors = stderr;                  // nullptr to count bad lines silently
+    };
+
+    struct Result {
+        size_t lines = 0;
+        size_t errors = 0;
+    };
+
+private:
+    struct Block {
+        std::string owned;          // the input when it is read rather than mapped
+        std::string_view input;     // whole lines
+        std::string output;
+        std::vector<std::pair<size_t, RadixError>> errors;     // by line within the block
+        size_t lines = 0;
+        bool done = false;
+    };
+
+    // hands out blocks of whole lines from a file descriptor
+    class Source {
+        int fd;
+        size_t block_size;
+        const char *map = nullptr;
+        size_t length = 0, pos = 0;
+        std::string carry;      // start of a line the last read cut off
+        bool eof = false;
+
+    public:
+        Source(int fd, size_t block_size): fd{fd}, block_size{block_size} {
+            struct stat st;
+            if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    map = static_cast<const char *>(p);
+                    length = st.st_size;
+                    madvise(p, length, MADV_SEQUENTIAL);
+                }
+            }
+        }
+
+        ~Source() {
+            if (map) {
+                munmap(const_cast<char *>(map), length);
+            }
+        }
+
+        Source(const Source &) = delete;
+        Source &operator=(const Source &) = delete;
+
+        // false once the input is exhausted
+        bool next(Block &b) {
+            if (map) {
+                if (pos == length) {
+                    return false;
+                }
+                size_t end = std::min(pos + block_size, length);
+                auto nl = static_cast<const char *>(memchr(map + end, '\n', length - end));
+                end = nl ? nl - map + 1 : length;
+                b.input = {map + pos, end - pos};
+                pos = end;
+                return true;
+            }
+
+            b.owned.swap(carry);
+            carry.clear();
+            size_t scanned = 0;
+            while (!eof) {
+                size_t have = b.owned.size();
+                if (have >= block_size && memchr(b.owned.data() + scanned, '\n', have - scanned)) {
+                    break;
+                }
+                scanned = have;
+                b.owned.resize(have + block_size);
+                ssize_t n = read(fd, &b.owned[have], block_size);
+                if (n < 0 && errno == EINTR) {
+                    b.owned.resize(have);
+                    continue;
+                }
+                if (n < 0) {
+                    throw std::system_error(errno, std::generic_category(), "read");
+                }
+                b.owned.resize(have + n);
+                eof = n == 0;
+            }
+            if (!eof) {
+                size_t last = b.owned.rfind('\n');
+                carry.assign(b.owned, last + 1);
+                b.owned.resize(last + 1);
+            }
+            b.input = b.owned;
+            return !b.owned.empty();
+        }
+    };
+
+    int input_radix, output_radix;
+    Options options;
+
+    static std::string_view trim(std::string_view line) {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string_view::npos) {
+            return {};
+        }
+        return line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+    }
+
+    static void convert_block(RadixConverter &converter, Block &b) {
+        b.output.clear();
+        b.errors.clear();
+        b.lines = 0;
+        std::string digits;
+        RadixError error;
+        const char *p = b.input.data(), *end = p + b.input.size();
+        while (p < end) {
+            auto nl = static_cast<const char *>(memchr(p, '\n', end - p));
+            const char *line_end = nl ? nl : end;
+            auto line = trim({p, size_t(line_end - p)});
+            if (!line.empty()) {
+                if (converter.convert(line, digits, &error)) {
+                    b.output += digits;
+                }
+                else {
+                    b.errors.emplace_back(b.lines, error);
+                }
+            }
+            b.output.push_back('\n');
+            ++b.lines;
+            p = nl ? nl + 1 : end;
+        }
+    }
+
+    static void write_all(int fd, const char *p, size_t n) {
+        while (n > 0) {
+            ssize_t w = write(fd, p, n);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w < 0) {
+                throw std::system_error(errno, std::generic_category(), "write");
+            }
+            p += w;
+            n -= w;
+        }
+    }
+
+public:
+    // throws std::invalid_argument unless both radices are in 2..36
+    RadixBatch(int input_radix, int output_radix): RadixBatch(input_radix, output_radix, Options{}) {}
+
+    RadixBatch(int input_radix, int output_radix, Options options):
+        input_radix{input_radix},
+        output_radix{output_radix},
+        options{options} {
+        RadixConverter{input_radix, output_radix};     // rejects bad radices here rather than in the workers
+        if (this->options.threads == 0) {
+            this->options.threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        this->options.block_size = std::max<size_t>(this->options.block_size, 1);
+    }
+
+    // Converts everything from in_fd to out_fd; neither is closed. Throws
+    // std::system_error if reading or writing fails.
+    Result run(int in_fd, int out_fd) {
+        Source source{in_fd, options.block_size};
+        // enough blocks in flight to keep every worker busy while one is written
+        std::vector<Block> slots(2 * options.threads + 1);
+        std::deque<Block *> todo;
+        std::mutex mu;
+        std::condition_variable work, finished;
+        bool closing = false;
+
+        auto worker = [&] {
+            RadixConverter converter{input_radix, output_radix};
+            std::unique_lock<std::mutex> lock{mu};
+            while (true) {
+                work.wait(lock, [&] { return closing || !todo.empty(); });
+                if (todo.empty()) {
+                    return;
+                }
+                Block *b = todo.front();
+                todo.pop_front();
+                lock.unlock();
+                convert_block(converter, *b);
+                lock.lock();
+                b->done = true;
+                finished.notify_all();
+            }
+        };
+
+        // joins the workers however run() leaves
+        struct Workers {
+            std::vector<std::thread> threads;
+            std::mutex &mu;
+            std::condition_variable &work;
+            bool &closing;
+
+            ~Workers() {
+                {
+                    std::lock_guard<std::mutex> lock{mu};
+                    closing = true;
+                }
+                work.notify_all();
+                for (auto &t : threads) {
+                    t.join();
+                }
+            }
+        } workers{{}, mu, work, closing};
+        for (unsigned i = 0; i < options.threads; ++i) {
+            workers.threads.emplace_back(worker);
+        }
+
+        Result result;
+        size_t submitted = 0, written = 0;
+        bool more = true;
+        while (true) {
+            while (more && submitted - written < slots.size()) {
+                Block &b = slots[submitted % slots.size()];
+                more = source.next(b);
+                if (more) {
+                    std::lock_guard<std::mutex> lock{mu};
+                    b.done = false;
+                    todo.push_back(&b);
+                    ++submitted;
+                    work.notify_one();
+                }
+            }
+            if (written == submitted) {
+                break;
+            }
+
+            Block &b = slots[written % slots.size()];
+            {
+                std::unique_lock<std::mutex> lock{mu};
+                finished.wait(lock, [&] { return b.done; });
+            }
+            write_all(out_fd, b.output.data(), b.output.size());
+            for (auto &[line, error] : b.errors) {
+                if (options.errors) {
+                    fprintf(options.errors, "line %zu: %s\n", result.lines + line + 1, error.message().c_str());
+                }
+            }
+            result.lines += b.lines;
+            result.errors += b.errors.size();
+            ++written;
+        }
+        return result;
+    }
+};
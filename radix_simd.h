@@ -0,0 +1,365 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RADIX_X86 1
+#endif
+
+
+// Digit kernels behind RadixConverter, in a scalar version and, on x86,
+// SSSE3 and AVX2 versions compiled with target attributes so the rest of
+// the program needs no -m flags. radix_kernels() picks the best level the
+// CPU supports once.
+//
+// Limb arrays are least significant first; digit strings most significant
+// first, so the kernels that repack bits fill or read limbs back to front.
+
+enum class RadixIsa { scalar, ssse3, avx2 };
+
+struct RadixKernels {
+    RadixIsa isa;
+
+    // index of the first character that is not a digit of radix, or n
+    size_t (*first_bad_digit)(const char *s, size_t n, int radix);
+
+    // 16 hex digits per limb: out[j] = s[16 (n - 1 - j), +16); digits validated
+    void (*hex_to_limbs)(const char *s, size_t n, uint64_t *out);
+
+    // inverse of hex_to_limbs, writes 16 n characters
+    void (*limbs_to_hex)(const uint64_t *limbs, size_t n, char *out);
+
+    // the same for binary, 64 digits per limb
+    void (*bin_to_limbs)(const char *s, size_t n, uint64_t *out);
+    void (*limbs_to_bin)(const uint64_t *limbs, size_t n, char *out);
+
+    // value of 16 validated decimal digits
+    uint64_t (*decimal16)(const char *s);
+};
+
+
+struct RadixScalar {
+    static int value(char c) {
+        return '0' <= c && c <= '9' ? c - '0' :
+                'a' <= c && c <= 'z' ? c - 'a' + 10:
+                'A' <= c && c <= 'Z' ? c - 'A' + 10: 255;
+    }
+
+    static size_t first_bad_digit(const char *s, size_t n, int radix) {
+        for (size_t i = 0; i < n; ++i) {
+            if (value(s[i]) >= radix) {
+                return i;
+            }
+        }
+        return n;
+    }
+
+    static void hex_to_limbs(const char *s, size_t n, uint64_t *out) {
+        for (size_t j = 0; j < n; ++j) {
+            const char *p = s + 16 * (n - 1 - j);
+            uint64_t v = 0;
+            for (int i = 0; i < 16; ++i) {
+                v = v << 4 | value(p[i]);
+            }
+            out[j] = v;
+        }
+    }
+
+    static void limbs_to_hex(const uint64_t *limbs, size_t n, char *out) {
+        for (size_t j = 0; j < n; ++j) {
+            uint64_t v = limbs[n - 1 - j];
+            for (int i = 15; i >= 0; --i) {
+                out[16 * j + i] = "0123456789abcdef"[v & 15];
+                v >>= 4;
+            }
+        }
+    }
+
+    static void bin_to_limbs(const char *s, size_t n, uint64_t *out) {
+        for (size_t j = 0; j < n; ++j) {
+            const char *p = s + 64 * (n - 1 - j);
+            uint64_t v = 0;
+            for (int i = 0; i < 64; ++i) {
+                v = v << 1 | (p[i] & 1);
+            }
+            out[j] = v;
+        }
+    }
+
+    static void limbs_to_bin(const uint64_t *limbs, size_t n, char *out) {
+        for (size_t j = 0; j < n; ++j) {
+            uint64_t v = limbs[n - 1 - j];
+            for (int i = 63; i >= 0; --i) {
+                out[64 * j + i] = '0' + (v & 1);
+                v >>= 1;
+            }
+        }
+    }
+
+    static uint64_t decimal16(const char *s) {
+        uint64_t v = 0;
+        for (int i = 0; i < 16; ++i) {
+            v = v * 10 + (s[i] - '0');
+        }
+        return v;
+    }
+};
+
+
+#ifdef RADIX_X86
+
+#define RADIX_SSSE3 __attribute__((target("ssse3")))
+#define RADIX_AVX2 __attribute__((target("avx2")))
+
+struct RadixSsse3 {
+    // byte-wise x <= limit, unsigned
+    RADIX_SSSE3 static __m128i at_most(__m128i x, __m128i limit) {
+        return _mm_cmpeq_epi8(_mm_min_epu8(x, limit), x);
+    }
+
+    // digit values of 16 characters; 255 or more for non-digits
+    RADIX_SSSE3 static __m128i values(__m128i c) {
+        __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+        __m128i is_digit = at_most(d, _mm_set1_epi8(9));
+        __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a' - 10));
+        __m128i is_letter = _mm_and_si128(at_most(l, _mm_set1_epi8(35)), _mm_cmpgt_epi8(l, _mm_set1_epi8(9)));
+        __m128i bad = _mm_andnot_si128(_mm_or_si128(is_digit, is_letter), _mm_set1_epi8(-1));
+        return _mm_or_si128(_mm_or_si128(_mm_and_si128(is_digit, d), _mm_andnot_si128(is_digit, l)), bad);
+    }
+
+    RADIX_SSSE3 static size_t first_bad_digit(const char *s, size_t n, int radix) {
+        __m128i limit = _mm_set1_epi8(char(radix - 1));
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = values(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i)));
+            unsigned ok = _mm_movemask_epi8(at_most(v, limit));
+            if (ok != 0xffff) {
+                return i + __builtin_ctz(~ok);
+            }
+        }
+        return i + RadixScalar::first_bad_digit(s + i, n - i, radix);
+    }
+
+    RADIX_SSSE3 static uint64_t hex16(const char *p) {
+        __m128i v = values(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+        __m128i bytes = _mm_packus_epi16(_mm_maddubs_epi16(v, _mm_set1_epi16(0x0110)), v);
+        return __builtin_bswap64(uint64_t(_mm_cvtsi128_si64(bytes)));
+    }
+
+    RADIX_SSSE3 static void hex_to_limbs(const char *s, size_t n, uint64_t *out) {
+        for (size_t j = 0; j < n; ++j) {
+            out[j] = hex16(s + 16 * (n - 1 - j));
+        }
+    }
+
+    RADIX_SSSE3 static __m128i hex_chars(uint64_t v) {
+        __m128i x = _mm_cvtsi64_si128(int64_t(__builtin_bswap64(v)));
+        __m128i lo = _mm_and_si128(x, _mm_set1_epi8(15));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), _mm_set1_epi8(15));
+        __m128i table = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+        return _mm_shuffle_epi8(table, _mm_unpacklo_epi8(hi, lo));
+    }
+
+    RADIX_SSSE3 static void limbs_to_hex(const uint64_t *limbs, size_t n, char *out) {
+        for (size_t j = 0; j < n; ++j) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16 * j), hex_chars(limbs[n - 1 - j]));
+        }
+    }
+
+    // bit 15 - i of the result is digit i
+    RADIX_SSSE3 static unsigned bin16(const char *p) {
+        __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        __m128i x = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), reverse);
+        return _mm_movemask_epi8(_mm_slli_epi64(x, 7));
+    }
+
+    RADIX_SSSE3 static void bin_to_limbs(const char *s, size_t n, uint64_t *out) {
+        for (size_t j = 0; j < n; ++j) {
+            const char *p = s + 64 * (n - 1 - j);
+            out[j] = uint64_t(bin16(p)) << 48 | uint64_t(bin16(p + 16)) << 32 |
+                     uint64_t(bin16(p + 32)) << 16 | bin16(p + 48);
+        }
+    }
+
+    // 16 characters for the 16 bits of w, most significant first
+    RADIX_SSSE3 static __m128i bin_chars(unsigned w) {
+        __m128i spread = _mm_shuffle_epi8(_mm_cvtsi32_si128(int(w)),
+                                          _mm_setr_epi8(1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0));
+        __m128i bits = _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+        __m128i set = _mm_cmpeq_epi8(_mm_and_si128(spread, bits), bits);
+        return _mm_sub_epi8(_mm_set1_epi8('0'), set);
+    }
+
+    RADIX_SSSE3 static void limbs_to_bin(const uint64_t *limbs, size_t n, char *out) {
+        for (size_t j = 0; j < n; ++j) {
+            uint64_t v = limbs[n - 1 - j];
+            for (int q = 0; q < 4; ++q) {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 64 * j + 16 * q),
+                                 bin_chars(unsigned(v >> (48 - 16 * q)) & 0xffff));
+            }
+        }
+    }
+
+    // pairs, then fours, then eights of digits; the halves meet in scalar
+    RADIX_SSSE3 static uint64_t decimal16(const char *s) {
+        __m128i d = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s)), _mm_set1_epi8('0'));
+        __m128i twos = _mm_maddubs_epi16(d, _mm_set1_epi16(0x010a));
+        __m128i fours = _mm_madd_epi16(twos, _mm_set1_epi32(0x00010064));
+        __m128i packed = _mm_packs_epi32(fours, fours);
+        __m128i eights = _mm_madd_epi16(packed, _mm_set1_epi32(0x00012710));
+        uint64_t hi = uint32_t(_mm_cvtsi128_si32(eights));
+        uint64_t lo = uint32_t(_mm_cvtsi128_si32(_mm_srli_si128(eights, 4)));
+        return hi * 100000000 + lo;
+    }
+};
+
+struct RadixAvx2 {
+    RADIX_AVX2 static __m256i at_most(__m256i x, __m256i limit) {
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(x, limit), x);
+    }
+
+    RADIX_AVX2 static __m256i values(__m256i c) {
+        __m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+        __m256i is_digit = at_most(d, _mm256_set1_epi8(9));
+        __m256i l = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a' - 10));
+        __m256i is_letter = _mm256_and_si256(at_most(l, _mm256_set1_epi8(35)), _mm256_cmpgt_epi8(l, _mm256_set1_epi8(9)));
+        __m256i bad = _mm256_andnot_si256(_mm256_or_si256(is_digit, is_letter), _mm256_set1_epi8(-1));
+        return _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(is_digit, d), _mm256_andnot_si256(is_digit, l)), bad);
+    }
+
+    RADIX_AVX2 static size_t first_bad_digit(const char *s, size_t n, int radix) {
+        __m256i limit = _mm256_set1_epi8(char(radix - 1));
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i v = values(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i)));
+            unsigned ok = _mm256_movemask_epi8(at_most(v, limit));
+            if (ok != 0xffffffff) {
+                return i + __builtin_ctz(~ok);
+            }
+        }
+        return i + RadixSsse3::first_bad_digit(s + i, n - i, radix);
+    }
+
+    // two limbs per step, one per 128-bit lane
+    RADIX_AVX2 static void hex_to_limbs(const char *s, size_t n, uint64_t *out) {
+        size_t j = 0;
+        for (; j + 2 <= n; j += 2) {
+            __m256i v = values(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + 16 * (n - 2 - j))));
+            __m256i bytes = _mm256_packus_epi16(_mm256_maddubs_epi16(v, _mm256_set1_epi16(0x0110)), v);
+            out[j + 1] = __builtin_bswap64(uint64_t(_mm256_extract_epi64(bytes, 0)));
+            out[j] = __builtin_bswap64(uint64_t(_mm256_extract_epi64(bytes, 2)));
+        }
+        if (j < n) {
+            out[j] = RadixSsse3::hex16(s);
+        }
+    }
+
+    RADIX_AVX2 static void limbs_to_hex(const uint64_t *limbs, size_t n, char *out) {
+        __m256i table = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+                                         '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+        size_t j = 0;
+        for (; j + 2 <= n; j += 2) {
+            __m256i x = _mm256_setr_epi64x(int64_t(__builtin_bswap64(limbs[n - 1 - j])), 0,
+                                           int64_t(__builtin_bswap64(limbs[n - 2 - j])), 0);
+            __m256i lo = _mm256_and_si256(x, _mm256_set1_epi8(15));
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), _mm256_set1_epi8(15));
+            __m256i chars = _mm256_shuffle_epi8(table, _mm256_unpacklo_epi8(hi, lo));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 16 * j), chars);
+        }
+        if (j < n) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16 * j), RadixSsse3::hex_chars(limbs[0]));
+        }
+    }
+
+    // bit 31 - i of the result is digit i
+    RADIX_AVX2 static unsigned bin32(const char *p) {
+        __m256i reverse = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                           15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        __m256i x = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)), reverse);
+        unsigned m = _mm256_movemask_epi8(_mm256_slli_epi64(x, 7));
+        return m << 16 | m >> 16;
+    }
+
+    RADIX_AVX2 static void bin_to_limbs(const char *s, size_t n, uint64_t *out) {
+        for (size_t j = 0; j < n; ++j) {
+            const char *p = s + 64 * (n - 1 - j);
+            out[j] = uint64_t(bin32(p)) << 32 | bin32(p + 32);
+        }
+    }
+
+    RADIX_AVX2 static void limbs_to_bin(const uint64_t *limbs, size_t n, char *out) {
+        __m256i pick = _mm256_setr_epi8(3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+                                        1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+        __m256i bits = _mm256_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1,
+                                        -128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+        for (size_t j = 0; j < n; ++j) {
+            uint64_t v = limbs[n - 1 - j];
+            for (int h = 0; h < 2; ++h) {
+                __m256i spread = _mm256_shuffle_epi8(_mm256_set1_epi32(int(uint32_t(v >> (32 - 32 * h)))), pick);
+                __m256i set = _mm256_cmpeq_epi8(_mm256_and_si256(spread, bits), bits);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 64 * j + 32 * h),
+                                    _mm256_sub_epi8(_mm256_set1_epi8('0'), set));
+            }
+        }
+    }
+};
+
+#undef RADIX_SSSE3
+#undef RADIX_AVX2
+
+#endif
+
+
+inline bool radix_isa_supported(RadixIsa isa) {
+#ifdef RADIX_X86
+    switch (isa) {
+    case RadixIsa::avx2:
+        return __builtin_cpu_supports("avx2");
+    case RadixIsa::ssse3:
+        return __builtin_cpu_supports("ssse3");
+    default:
+        return true;
+    }
+#else
+    return isa == RadixIsa::scalar;
+#endif
+}
+
+// kernels of one level, which must be supported
+inline const RadixKernels &radix_kernels(RadixIsa isa) {
+    static const RadixKernels scalar{RadixIsa::scalar, RadixScalar::first_bad_digit,
+                                     RadixScalar::hex_to_limbs, RadixScalar::limbs_to_hex,
+                                     RadixScalar::bin_to_limbs, RadixScalar::limbs_to_bin,
+                                     RadixScalar::decimal16};
+#ifdef RADIX_X86
+    static const RadixKernels ssse3{RadixIsa::ssse3, RadixSsse3::first_bad_digit,
+                                    RadixSsse3::hex_to_limbs, RadixSsse3::limbs_to_hex,
+                                    RadixSsse3::bin_to_limbs, RadixSsse3::limbs_to_bin,
+                                    RadixSsse3::decimal16};
+    static const RadixKernels avx2{RadixIsa::avx2, RadixAvx2::first_bad_digit,
+                                   RadixAvx2::hex_to_limbs, RadixAvx2::limbs_to_hex,
+                                   RadixAvx2::bin_to_limbs, RadixAvx2::limbs_to_bin,
+                                   RadixSsse3::decimal16};
+    switch (isa) {
+    case RadixIsa::avx2:
+        return avx2;
+    case RadixIsa::ssse3:
+        return ssse3;
+    default:
+        break;
+    }
+#endif
+    return scalar;
+}
+
+// the best level this CPU supports
+inline const RadixKernels &radix_kernels() {
+    static const RadixKernels &best =
+        radix_isa_supported(RadixIsa::avx2) ? radix_kernels(RadixIsa::avx2) :
+        radix_isa_supported(RadixIsa::ssse3) ? radix_kernels(RadixIsa::ssse3) :
+        radix_kernels(RadixIsa::scalar);
+    return best;
+}